@@ -2,9 +2,10 @@ import { AcceptRegexProps, ConcatRegexProps, RegexProps, UnionRegexProps } from
 
 
 export type NotifyType =
-  'RegexCompile' | 'RegexAccept' | 'RegexUnion'
+  'RegexCompile' | 'RegexAccept' | 'RegexUnion' | 'RegexSimplify'
   | 'LexiconAddToken' | 'LexiconAddState' | 'LexiconAddTransfer' | 'LexiconSetAccept'
   | 'ScannerSetSource' | 'ScannerSetState' | 'ScannerNextInput' | 'ScannerNextLine' | 'ScannerAcceptToken'
+  | 'ScannerEditSource'
 
 export interface BasicNotify {
   $: NotifyType
@@ -28,6 +29,12 @@ export interface RegexUnionNotify extends BasicNotify {
   right: string
 }
 
+export interface RegexSimplifyNotify extends BasicNotify {
+  $: 'RegexSimplify'
+  origin: string
+  regex: RegexProps
+}
+
 export interface LexiconAddTokenNotify extends BasicNotify {
   $: 'LexiconAddToken'
   id: number
@@ -58,6 +65,13 @@ export interface ScannerSetSourceNotify extends BasicNotify {
   source: string
 }
 
+export interface ScannerEditSourceNotify extends BasicNotify {
+  $: 'ScannerEditSource'
+  offset: number
+  removed: number
+  inserted: string
+}
+
 export interface ScannerSetStateNotify extends BasicNotify {
   $: 'ScannerSetState'
   state: number
@@ -88,6 +102,22 @@ export interface ScannerAcceptTokenNotify extends BasicNotify {
   token: Token
 }
 
-export type Notify = RegexCompileNotify | RegexAcceptNotify | RegexUnionNotify
+export type Notify = RegexCompileNotify | RegexAcceptNotify | RegexUnionNotify | RegexSimplifyNotify
   | LexiconAddTokenNotify | LexiconAddStateNotify | LexiconAddTransferNotify | LexiconSetAcceptNotify
-  | ScannerSetSourceNotify | ScannerSetStateNotify | ScannerNextInputNotify | ScannerNextLineNotify | ScannerAcceptTokenNotify
\ No newline at end of file
+  | ScannerSetSourceNotify | ScannerSetStateNotify | ScannerNextInputNotify | ScannerNextLineNotify | ScannerAcceptTokenNotify
+  | ScannerEditSourceNotify
+
+/**
+ * 跟踪词法分析器当前的源码
+ * ScannerSetSource 替换整个源码，ScannerEditSource 是增量分析时的编辑，只拼接被编辑的部分
+ */
+export function applySource(source: string, notify: Notify): string {
+  switch (notify.$) {
+    case 'ScannerSetSource':
+      return notify.source
+    case 'ScannerEditSource':
+      return source.slice(0, notify.offset) + notify.inserted + source.slice(notify.offset + notify.removed)
+    default:
+      return source
+  }
+}
@@ -77,7 +77,9 @@ export type RegexType =
   | "union"
   | "kleene"
   | "positive"
-  | "optional";
+  | "optional"
+  | "intersect"
+  | "complement";
 export interface RegexProps extends RectProps {
   theme: SignalValue<ColorTheme>;
   type: SignalValue<RegexType>;
@@ -246,6 +248,14 @@ export abstract class Regex extends Rect {
         return (<PositiveRegex {...(props as PositiveRegexProps)} />) as Regex;
       case "optional":
         return (<OptionalRegex {...(props as OptionalRegexProps)} />) as Regex;
+      case "intersect":
+        return (
+          <IntersectRegex {...(props as IntersectRegexProps)} />
+        ) as Regex;
+      case "complement":
+        return (
+          <ComplementRegex {...(props as ComplementRegexProps)} />
+        ) as Regex;
     }
   }
 
@@ -581,5 +591,90 @@ export class OptionalRegex extends Regex {
   }
 }
 
+export interface IntersectRegexProps extends RegexProps {
+  type: SignalValue<"intersect">;
+  lhs: SignalValue<RegexProps>;
+  rhs: SignalValue<RegexProps>;
+}
+export class IntersectRegex extends Regex {
+  @signal()
+  public declare readonly lhs: SimpleSignal<RegexProps, this>;
+
+  @signal()
+  public declare readonly rhs: SimpleSignal<RegexProps, this>;
+
+  private readonly lhsRegex = createRef<Regex>();
+  private readonly rhsRegex = createRef<Regex>();
+  private readonly lhsLine = createRef<Line>();
+  private readonly rhsLine = createRef<Line>();
+
+  constructor(props?: IntersectRegexProps) {
+    super({ ...props });
+    this.add([
+      Regex.From({
+        ...this.lhs(),
+        ref: this.lhsRegex,
+        marginTop: MIN_REGEX_NODE_SIZE + REGEX_GAP,
+        theme: this.theme,
+      }),
+      <RegexNode ref={this.node} theme={this.theme} note="&" />,
+      Regex.From({
+        ...this.rhs(),
+        ref: this.rhsRegex,
+        marginTop: MIN_REGEX_NODE_SIZE + REGEX_GAP,
+        theme: this.theme,
+      }),
+    ]);
+
+    this.addLine(this, this.lhsRegex(), this.lhsLine);
+    this.addLine(this, this.rhsRegex(), this.rhsLine);
+  }
+
+  get subs(): Regex[] {
+    return [this.lhsRegex(), this.rhsRegex()];
+  }
+  get lines(): Line[] {
+    return [this.lhsLine(), this.rhsLine()];
+  }
+}
+
+export interface ComplementRegexProps extends RegexProps {
+  type: SignalValue<"complement">;
+  sub: SignalValue<RegexProps>;
+}
+export class ComplementRegex extends Regex {
+  @signal()
+  public declare readonly sub: SimpleSignal<RegexProps, this>;
+
+  private readonly subRegex = createRef<Regex>();
+  private readonly subLine = createRef<Line>();
+
+  constructor(props?: ComplementRegexProps) {
+    super({ ...props, direction: "column", alignItems: "center" });
+    this.add([
+      <RegexNode
+        ref={this.node}
+        marginBottom={REGEX_GAP}
+        theme={this.theme}
+        note="~"
+      />,
+      Regex.From({
+        ...this.sub(),
+        theme: this.theme,
+        ref: this.subRegex,
+      }),
+    ]);
+
+    this.addLine(this, this.subRegex(), this.subLine);
+  }
+
+  get subs(): Regex[] {
+    return [this.subRegex()];
+  }
+  get lines(): Line[] {
+    return [this.subLine()];
+  }
+}
+
 const REGEX_GAP = 64;
 const MIN_REGEX_NODE_SIZE = 128;
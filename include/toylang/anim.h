@@ -1,6 +1,11 @@
 #ifndef __TOYLANG_ANIM_H__
 #define __TOYLANG_ANIM_H__
 
+#include <chrono>
+#include <cstdint>
+#include <functional>
+#include <istream>
+#include <ostream>
 #include <string>
 
 #include "toylang/regex.h"
@@ -8,17 +13,171 @@
 
 namespace toylang {
 
+/**
+ * Anim
+ *
+ * 记录编译过程中的事件，供 compiler 中的动画工具展示
+ * 设置环境变量 TOYLANG_ANIM 时以 JSON 格式逐行写入标准错误，
+ * 同时设置 TOYLANG_ANIM_FILE 时改为以紧凑的二进制格式写入该文件，
+ * 二进制记录可以通过 Convert 转换回 JSON 格式
+ *
+ * 飞行记录器独立于上述格式，只在内存中保留最近的若干事件，
+ * 触发条件满足时才将其写入文件
+ */
 class Anim {
  public:
+  /**
+   * 事件类型
+   */
+  enum class Event : uint8_t {
+    kRegexCompile,
+    kRegexAccept,
+    kRegexUnion,
+    kRegexSimplify,
+    kLexiconAddToken,
+    kLexiconAddState,
+    kLexiconAddTransfer,
+    kLexiconSetAccept,
+    kScannerSetSource,
+    kScannerSetState,
+    kScannerNextInput,
+    kScannerNextLine,
+    kScannerAcceptToken,
+    kScannerEditSource,
+  };
+
+  /**
+   * 飞行记录器中的一条事件，只保留整数字段
+   */
+  struct Record {
+    Event event;
+
+    /**
+     * 事件序号，从0开始
+     */
+    uint64_t seq;
+
+    /**
+     * 事件字段，含义因事件类型而异，例如词法单元的ID、偏移量与长度
+     */
+    int64_t args[4];
+  };
+
+  /**
+   * 飞行记录器选项
+   */
+  struct FlightOptions {
+    /**
+     * 保留的事件数量，向上取整为2的幂
+     */
+    size_t capacity = 4096;
+
+    /**
+     * 记录的事件类型，第i位对应 Event 的第i个值
+     */
+    uint32_t events = ~uint32_t{0};
+
+    /**
+     * 触发时追加写入的文件
+     */
+    std::string path;
+
+    /**
+     * 提取到错误词法单元时触发
+     */
+    bool on_error = true;
+
+    /**
+     * 自定义触发条件，每条被记录的事件都会经过它
+     */
+    std::function<bool(Record const&)> trigger;
+
+    /**
+     * 两次触发写出的最小间隔，间隔内的触发合并为一次写出
+     * 大量错误词法单元不会导致每个都打开一次文件
+     */
+    std::chrono::milliseconds interval{1000};
+  };
+
+  enum class Format {
+    /** 不记录 */
+    kNone,
+
+    /** 以 JSON 格式写入标准错误 */
+    kJson,
+
+    /** 以二进制格式写入文件，由后台线程缓冲写出 */
+    kBinary,
+  };
+
+  /**
+   * 切换记录格式，之前的记录会被关闭
+   *
+   * @param format 记录格式
+   * @param path 二进制格式的记录文件
+   */
+  static void Open(Format format, std::string const& path = "");
+
+  /**
+   * 写出全部缓冲的事件并停止记录
+   * 若其他线程正在记录事件，由其在记录完成后写出，记录器不会在使用中被销毁
+   */
+  static void Close();
+
+  /**
+   * 是否正在记录事件
+   */
+  static bool Enabled();
+
+  /**
+   * 将二进制记录转换为 JSON 格式，每行一个以 "ANIM: " 开头的事件
+   *
+   * @param in 二进制记录
+   * @param out JSON 输出
+   */
+  static void Convert(std::istream& in, std::ostream& out);
+
+  /**
+   * 启动飞行记录器，之前的飞行记录器会被停止并释放
+   * 设置环境变量 TOYLANG_ANIM_FLIGHT 时以默认选项启动，触发时写入该文件
+   *
+   * @param options 选项
+   */
+  static void StartFlight(FlightOptions options);
+
+  /**
+   * 停止飞行记录器，只写出已触发但因间隔推迟的记录
+   * 可以与记录事件同时调用，等待正在记录的线程离开后释放记录器
+   */
+  static void StopFlight();
+
+  /**
+   * 立即将飞行记录器中的事件写出，之后清空记录
+   *
+   * @param reason 写出的原因，记录在输出中
+   */
+  static void DumpFlight(std::string const& reason);
+
+  /**
+   * 收到信号时写出飞行记录器中的事件
+   * 信号处理函数只设置标记，在记录下一条事件时写出
+   *
+   * @param signo 信号
+   */
+  static void DumpFlightOnSignal(int signo);
+
   static void RegexCompile(std::string const& pattern, Regex regex);
-  static void RegexAccept(Regex accept,
-                          toylang::regex::LeafNodes const& afters);
+  static void RegexAccept(Regex accept, Regex regex);
   static void RegexUnion(Regex unode);
+  static void RegexSimplify(Regex regex, Regex simplified);
   static void LexiconAddToken(int id, std::string const& name);
-  static void LexiconAddState(int id, regex::LeafNodes const& poses);
+  static void LexiconAddState(int id, regex::Arena const& arena,
+                              regex::Arena::Positions const& poses);
   static void LexiconAddTransfer(int from, int to, int input);
   static void LexiconSetAccept(int state, int token);
   static void ScannerSetSource(std::string const& source);
+  static void ScannerEditSource(size_t offset, size_t removed,
+                                std::string const& inserted);
   static void ScannerSetState(int state);
   static void ScannerNextInput();
   static void ScannerNextLine();
@@ -0,0 +1,95 @@
+#ifndef __TOYLANG_CACHE_H__
+#define __TOYLANG_CACHE_H__
+
+#include <cstddef>
+#include <cstdint>
+#include <memory>
+#include <optional>
+#include <string>
+#include <string_view>
+#include <vector>
+
+#include "toylang/lexical.h"
+
+namespace toylang {
+
+/**
+ * 词法单元缓存
+ *
+ * 以源码内容、词法规则指纹与上下文的哈希值为键，将完整的词法单元序列保存在目录中，
+ * 源码未改变时直接加载上次的分析结果而不再运行词法分析
+ * 序列以变长整数紧凑编码，每个词法单元依次记录：
+ *  1. 与前一个词法单元ID之差，以 zigzag 编码
+ *  2. 与前一个词法单元末尾的距离
+ *  3. 长度
+ *  4. 越过末尾检查的字符数
+ * 行号与列号不写入缓存，加载时由源码重新计算
+ * 命中时以只读方式映射缓存文件并解码，未命中时分析源码，
+ * 先写入临时文件再重命名，其他进程不会读到写了一半的缓存文件
+ * 缓存文件损坏或与源码不符时视为未命中并重新写入
+ * 加载的词法单元不记录动画事件，也不驻留符号
+ */
+class TokenCache {
+ public:
+  /**
+   * 命中统计
+   */
+  struct Stats {
+    size_t hits = 0;
+    size_t misses = 0;
+  };
+
+  /**
+   * @param directory 缓存目录，不存在时在首次写入时创建
+   */
+  explicit TokenCache(std::string directory);
+  TokenCache(TokenCache const&) = delete;
+  TokenCache& operator=(TokenCache const&) = delete;
+  ~TokenCache() = default;
+
+  /**
+   * 获取源码完整的词法单元序列，与以词法分析器逐个调用 NextToken 的结果相同
+   *
+   * @param lexicon 词法规则
+   * @param source 源码
+   * @param context 开始分析时的上下文名称
+   * @return 词法单元序列，不包含 EOF
+   */
+  std::vector<Token> Scan(std::shared_ptr<Lexicon const> const& lexicon,
+                          std::shared_ptr<Source const> const& source,
+                          std::string const& context = Lexicon::kDefaultContext);
+
+  /**
+   * 源码对应的缓存文件路径
+   *
+   * @param lexicon 词法规则
+   * @param source 源码
+   * @param context 上下文ID
+   */
+  std::string PathOf(Lexicon const& lexicon, Source const& source,
+                     int context) const;
+
+  Stats const& GetStats() const { return stats_; }
+
+ private:
+  /**
+   * 加载并解码缓存文件，文件不存在或不可用时返回空
+   */
+  std::optional<std::vector<Token>> Load(
+      std::string const& path, std::shared_ptr<Lexicon const> const& lexicon,
+      std::shared_ptr<Source const> const& source, int context) const;
+
+  /**
+   * 编码词法单元序列并原子地写入缓存文件，写入失败时忽略
+   */
+  void Store(std::string const& path, Lexicon const& lexicon,
+             Source const& source, int context,
+             std::vector<Token> const& tokens) const;
+
+  std::string directory_;
+  Stats stats_;
+};
+
+}  // namespace toylang
+
+#endif
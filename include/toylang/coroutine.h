@@ -0,0 +1,295 @@
+#ifndef __TOYLANG_COROUTINE_H__
+#define __TOYLANG_COROUTINE_H__
+
+/**
+ * 协程接口需要 C++20，使用 TOYLANG_CXX20 选项构建时可用
+ */
+#if __cplusplus >= 202002L
+
+#include <coroutine>
+#include <exception>
+#include <iterator>
+#include <memory>
+#include <optional>
+#include <string>
+#include <utility>
+
+#include "toylang/lexical.h"
+#include "toylang/source.h"
+#include "toylang/token.h"
+
+namespace toylang {
+
+/**
+ * Generator
+ *
+ * 惰性生成值序列的协程，只能遍历一次
+ */
+template <typename T>
+class Generator {
+ public:
+  struct promise_type {
+    std::optional<T> value_;
+    std::exception_ptr error_;
+
+    Generator get_return_object() {
+      return Generator{std::coroutine_handle<promise_type>::from_promise(*this)};
+    }
+    std::suspend_always initial_suspend() noexcept { return {}; }
+    std::suspend_always final_suspend() noexcept { return {}; }
+    std::suspend_always yield_value(T value) {
+      value_ = std::move(value);
+      return {};
+    }
+    void return_void() {}
+    void unhandled_exception() { error_ = std::current_exception(); }
+  };
+
+  using Handle = std::coroutine_handle<promise_type>;
+
+  class Iterator {
+   public:
+    using iterator_category = std::input_iterator_tag;
+    using value_type = T;
+    using difference_type = std::ptrdiff_t;
+
+    explicit Iterator(Handle handle) : handle_{handle} {}
+
+    Iterator& operator++() {
+      Resume(handle_);
+      return *this;
+    }
+    void operator++(int) { ++*this; }
+    T const& operator*() const { return *handle_.promise().value_; }
+    bool operator==(std::default_sentinel_t) const { return handle_.done(); }
+
+   private:
+    Handle handle_;
+  };
+
+  explicit Generator(Handle handle) : handle_{handle} {}
+  Generator(Generator&& other) noexcept
+      : handle_{std::exchange(other.handle_, nullptr)} {}
+  Generator(Generator const&) = delete;
+  Generator& operator=(Generator const&) = delete;
+  Generator& operator=(Generator&&) = delete;
+  ~Generator() {
+    if (handle_) handle_.destroy();
+  }
+
+  Iterator begin() {
+    Resume(handle_);
+    return Iterator{handle_};
+  }
+  std::default_sentinel_t end() { return {}; }
+
+ private:
+  static void Resume(Handle handle) {
+    handle.resume();
+    if (handle.promise().error_) std::rethrow_exception(handle.promise().error_);
+  }
+
+  Handle handle_;
+};
+
+/**
+ * Task
+ *
+ * 惰性启动的异步任务，可以被其它协程 co_await，完成后恢复等待者
+ * 顶层任务通过 Start 启动，完成后通过 Result 取得结果
+ */
+template <typename T>
+class Task {
+ public:
+  struct promise_type {
+    std::optional<T> value_;
+    std::exception_ptr error_;
+    std::coroutine_handle<> continuation_;
+
+    struct FinalAwaiter {
+      bool await_ready() noexcept { return false; }
+      std::coroutine_handle<> await_suspend(
+          std::coroutine_handle<promise_type> handle) noexcept {
+        auto const continuation = handle.promise().continuation_;
+        return continuation ? continuation : std::noop_coroutine();
+      }
+      void await_resume() noexcept {}
+    };
+
+    Task get_return_object() {
+      return Task{std::coroutine_handle<promise_type>::from_promise(*this)};
+    }
+    std::suspend_always initial_suspend() noexcept { return {}; }
+    FinalAwaiter final_suspend() noexcept { return {}; }
+    void return_value(T value) { value_ = std::move(value); }
+    void unhandled_exception() { error_ = std::current_exception(); }
+  };
+
+  using Handle = std::coroutine_handle<promise_type>;
+
+  explicit Task(Handle handle) : handle_{handle} {}
+  Task(Task&& other) noexcept : handle_{std::exchange(other.handle_, nullptr)} {}
+  Task(Task const&) = delete;
+  Task& operator=(Task const&) = delete;
+  Task& operator=(Task&&) = delete;
+  ~Task() {
+    if (handle_) handle_.destroy();
+  }
+
+  bool await_ready() const noexcept { return false; }
+  std::coroutine_handle<> await_suspend(std::coroutine_handle<> continuation) {
+    handle_.promise().continuation_ = continuation;
+    return handle_;
+  }
+  T await_resume() { return Result(); }
+
+  /**
+   * 启动顶层任务，任务在第一次挂起或完成时返回
+   */
+  void Start() { handle_.resume(); }
+
+  /**
+   * 任务是否已经完成
+   */
+  bool Done() const { return handle_.done(); }
+
+  /**
+   * 取得已完成任务的结果，任务抛出的异常在此重新抛出
+   */
+  T Result() {
+    if (handle_.promise().error_)
+      std::rethrow_exception(handle_.promise().error_);
+    return std::move(*handle_.promise().value_);
+  }
+
+ private:
+  Handle handle_;
+};
+
+class ReadPool;
+
+/**
+ * Poller
+ *
+ * 异步运行时的等待接口，文件描述符可读时恢复等待的协程
+ * 使用者可以将其接入自己的事件循环
+ */
+class Poller {
+ public:
+  Poller();
+  Poller(Poller const&) = delete;
+  Poller& operator=(Poller const&) = delete;
+  virtual ~Poller();
+
+  /**
+   * 等待文件描述符可读，可读后恢复协程
+   *
+   * @param fd 文件描述符
+   * @param handle 等待的协程
+   */
+  virtual void WatchReadable(int fd, std::coroutine_handle<> handle) = 0;
+
+  /**
+   * 线程池的线程数量上限
+   */
+  static constexpr size_t kMaxReadThreads = 4;
+
+  /**
+   * 读取普通文件的线程池，首次使用时创建，由这个 Poller 上的全部读取器共享
+   * 线程数有上限，完成的读取通过一个 eventfd 在 Poller 所在的线程中恢复
+   */
+  ReadPool& Reads();
+
+ private:
+  std::unique_ptr<ReadPool> reads_;
+};
+
+/**
+ * EpollPoller
+ *
+ * 基于 epoll 的简单事件循环
+ */
+class EpollPoller : public Poller {
+ public:
+  EpollPoller();
+  EpollPoller(EpollPoller const&) = delete;
+  EpollPoller& operator=(EpollPoller const&) = delete;
+  ~EpollPoller() override;
+
+  void WatchReadable(int fd, std::coroutine_handle<> handle) override;
+
+  /**
+   * 等待就绪的文件描述符并恢复对应的协程
+   *
+   * @param timeout 超时毫秒数，-1表示一直等待
+   * @return 恢复的协程数量，没有等待中的协程时立即返回0
+   */
+  size_t Poll(int timeout = -1);
+
+ private:
+  int epoll_;
+  size_t waiting_;
+};
+
+/**
+ * AsyncReader
+ *
+ * 以非阻塞方式分块读取文件描述符，数据尚未就绪时挂起协程
+ * 管道与套接字以非阻塞方式读取，普通文件与块设备无法以这种方式等待，
+ * 交给 Poller 的线程池读取，读取完成后通过 Poller 恢复协程
+ * 为非阻塞读取设置的 O_NONBLOCK 在析构时恢复
+ */
+class AsyncReader {
+ public:
+  /**
+   * @param poller 等待数据时使用的 Poller
+   * @param fd 文件描述符，由读取器持有并在析构时关闭
+   * @param chunk 每次读取的最大字节数
+   */
+  AsyncReader(Poller& poller, int fd, size_t chunk = 64 * 1024);
+  AsyncReader(AsyncReader const&) = delete;
+  AsyncReader& operator=(AsyncReader const&) = delete;
+  ~AsyncReader();
+
+  /**
+   * 读取下一块数据，到达结尾时返回空字符串
+   */
+  Task<std::string> Read();
+
+ private:
+  Poller& poller_;
+  int fd_;
+  size_t chunk_;
+
+  /**
+   * 文件描述符原来的状态标志
+   */
+  int flags_;
+
+  /**
+   * 是否交给 Poller 的线程池读取
+   */
+  bool pooled_ = false;
+};
+
+/**
+ * 提取词法分析器中剩余的全部词法单元，不包括 EOF
+ *
+ * @param scanner 已设置词法规则与源码的词法分析器
+ */
+Generator<Token> Tokens(Scanner& scanner);
+
+/**
+ * 异步加载源码文件，失败时返回空指针
+ *
+ * @param poller 等待数据时使用的 Poller
+ * @param path 源码路径
+ */
+Task<std::shared_ptr<Source const>> LoadAsync(Poller& poller,
+                                              std::string path);
+
+}  // namespace toylang
+
+#endif
+
+#endif
@@ -0,0 +1,124 @@
+#ifndef __TOYLANG_DERIVATIVE_H__
+#define __TOYLANG_DERIVATIVE_H__
+
+#include <cstdint>
+#include <map>
+#include <tuple>
+#include <unordered_map>
+#include <vector>
+
+#include "toylang/regex.h"
+
+namespace toylang::regex {
+
+/**
+ * Derivatives
+ *
+ * 以 Brzozowski 导数构造状态机所需的正则表达式项
+ * 项被哈希共享，结构相同的项只保存一次，以项的编号即可判断相等
+ * 构造项时按照结合律、交换律与幂等律规范化联合与交集，
+ * 保证任意正则表达式只有有限个不同的导数
+ * 与 followpos 构造不同，导数天然支持交集与补集
+ */
+class Derivatives {
+ public:
+  /**
+   * 项的编号
+   */
+  using Term = uint32_t;
+
+  /**
+   * 不匹配任何串的项
+   */
+  static constexpr Term kEmpty = 0;
+
+  /**
+   * 只匹配空串的项
+   */
+  static constexpr Term kEpsilon = 1;
+
+  Derivatives();
+
+  /**
+   * 将正则表达式树转换为项
+   *
+   * @param regex 正则表达式，不能包含接受节点
+   */
+  Term Of(Regex const& regex);
+
+  /**
+   * 计算项对输入字节的导数，结果被缓存
+   *
+   * @param term 项
+   * @param input 输入字节
+   */
+  Term Derive(Term term, unsigned char input);
+
+  /**
+   * 项是否匹配空串
+   */
+  bool NullableOf(Term term) const { return items_[term].nullable; }
+
+  /**
+   * 项中出现的全部字符集，划分等价类后同一等价类中的字节总有相同的导数
+   */
+  std::vector<Charset> const& Classes() const { return sets_; }
+
+  /**
+   * 不同项的数量
+   */
+  size_t CountTerms() const { return items_.size(); }
+
+ private:
+  enum Kind : uint8_t {
+    kNothing,
+    kEmptyString,
+    kSet,
+    kConcat,
+    kStar,
+    kOr,
+    kAnd,
+    kNot,
+  };
+
+  /**
+   * 字符集项的 lhs 为字符集下标，闭包与补集项只使用 lhs
+   */
+  struct Item {
+    Kind kind;
+    Term lhs;
+    Term rhs;
+    bool nullable;
+  };
+
+  Term Make(Item const& item);
+  Term Set(Charset const& set);
+  Term Concat(Term lhs, Term rhs);
+  Term Star(Term term);
+  Term Not(Term term);
+
+  /**
+   * 构造联合或交集，操作数被展平、排序并去重
+   */
+  Term Combine(Kind kind, Term lhs, Term rhs);
+
+  std::vector<Item> items_;
+  std::map<std::tuple<Kind, Term, Term>, Term> ids_;
+
+  std::vector<Charset> sets_;
+  std::unordered_map<Charset, uint32_t, Charset::Hash> set_ids_;
+
+  /**
+   * 导数缓存，键为 term * 256 + input
+   */
+  std::unordered_map<uint64_t, Term> derived_;
+
+  /**
+   * 匹配任意串的项，即 ~kEmpty
+   */
+  Term anything_;
+};
+
+}  // namespace toylang::regex
+
+#endif
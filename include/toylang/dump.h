@@ -0,0 +1,147 @@
+#ifndef __TOYLANG_DUMP_H__
+#define __TOYLANG_DUMP_H__
+
+#include <cstdint>
+#include <cstdio>
+#include <memory>
+#include <optional>
+#include <string>
+#include <string_view>
+#include <vector>
+
+#include "toylang/lexical.h"
+
+namespace toylang {
+
+/**
+ * TokenWriter
+ *
+ * 将词法单元流式写出，供外部工具读取
+ * 每个词法单元直接格式化到预先分配的缓冲区中，不构造 JSON 对象，
+ * 缓冲区写满后一次性写入文件，词法单元很多时也不会成为瓶颈
+ *
+ * JSON Lines 格式每行一个对象，只包含选择的字段：
+ *   {"id":1,"name":"ID","offset":0,"length":2,"line":1,"column":1,"text":"if"}
+ * 字符串中的引号、反斜杠与控制字符被转义，合法的 UTF-8 序列原样写出，
+ * 不属于合法序列的字节各替换为 \ufffd，非 UTF-8 的源码也总能得到合法的 JSON
+ *
+ * 二进制格式以 kMagic 开头，随后是字段位图与词法记号名称表，
+ * 名称表先写数量，再依次写每个名称的长度与内容
+ * 之后每个词法单元按字段顺序写出选择的字段，整数均为变长整数：
+ *  1. ID，以 zigzag 编码，选择 ID 或名称时写出
+ *  2. 偏移量与前一个词法单元偏移量之差
+ *  3. 长度
+ *  4. 起始行号与起始列号
+ *  5. 文本的长度与内容
+ */
+class TokenWriter {
+ public:
+  enum class Format {
+    kJsonLines,
+    kBinary,
+  };
+
+  /**
+   * 可选的字段，可以按位组合
+   */
+  enum Field : unsigned {
+    kId = 1 << 0,
+    kName = 1 << 1,
+    kOffset = 1 << 2,
+    kLength = 1 << 3,
+    kPosition = 1 << 4,
+    kText = 1 << 5,
+    kAllFields = (1 << 6) - 1,
+  };
+
+  static constexpr char kMagic[] = "TLTOKD1\n";
+
+  /**
+   * 默认的缓冲区大小
+   */
+  static constexpr size_t kDefaultCapacity = 1 << 20;
+
+  /**
+   * 解析以逗号分隔的字段列表，例如 "id,name,text"
+   * 行号与列号分别写作 line 与 column，二者总是一起输出
+   *
+   * @return 列表为空或包含未知字段时返回空
+   */
+  static std::optional<unsigned> ParseFields(std::string_view list);
+
+  /**
+   * @param lexicon 词法规则，用于输出词法记号名称
+   * @param file 输出文件，由调用者负责关闭
+   * @param format 输出格式
+   * @param fields 输出的字段
+   * @param capacity 缓冲区大小，缓冲的数据超过它时写入文件
+   */
+  TokenWriter(std::shared_ptr<Lexicon const> lexicon, std::FILE* file,
+              Format format, unsigned fields = kAllFields,
+              size_t capacity = kDefaultCapacity);
+  TokenWriter(TokenWriter const&) = delete;
+  TokenWriter& operator=(TokenWriter const&) = delete;
+
+  /**
+   * 写出缓冲区中剩余的数据
+   */
+  ~TokenWriter();
+
+  /**
+   * 写出一个词法单元
+   */
+  void Write(Token const& token);
+
+  /**
+   * 将缓冲区中的数据写入文件
+   * 任何一次写入失败后，之后的数据都不再写入
+   *
+   * @return 迄今为止的全部写入是否成功
+   */
+  bool Flush();
+
+  /**
+   * 已写出的词法单元数量
+   */
+  size_t Count() const { return count_; }
+
+ private:
+  void WriteJson(Token const& token);
+  void WriteBinary(Token const& token);
+
+  /**
+   * 写入 JSON 字符串，包括两侧的引号
+   */
+  static void Quote(std::string& out, std::string_view text);
+
+  void Varint(uint64_t value);
+
+  std::shared_ptr<Lexicon const> lexicon_;
+  std::FILE* file_;
+  Format format_;
+  unsigned fields_;
+  size_t capacity_;
+
+  std::string buffer_;
+
+  /**
+   * 已转义并加上引号的词法记号名称，下标为词法记号ID加一，首项为错误词法单元
+   */
+  std::vector<std::string> names_;
+
+  /**
+   * 前一个词法单元的偏移量，用于二进制格式的差分编码
+   */
+  size_t offset_ = 0;
+
+  size_t count_ = 0;
+
+  /**
+   * 是否发生过写入错误
+   */
+  bool failed_ = false;
+};
+
+}  // namespace toylang
+
+#endif
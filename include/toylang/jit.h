@@ -0,0 +1,99 @@
+#ifndef __TOYLANG_JIT_H__
+#define __TOYLANG_JIT_H__
+
+#include <cstddef>
+#include <cstdint>
+#include <functional>
+#include <memory>
+#include <vector>
+
+namespace toylang {
+
+/**
+ * Jit
+ *
+ * 将确定状态机编译为本机代码
+ * 每个状态对应一个基本块，转移较少的状态使用比较链，否则使用跳转表，
+ * 接受状态在基本块入口处直接记录接受位置
+ * 目前只支持 x86-64 上的类 Unix 平台，其余平台 Compile 返回空指针，
+ * 调用者应退回解释执行
+ */
+class Jit {
+ public:
+  /**
+   * 扫描结果，布局被生成的代码直接访问
+   */
+  struct Result {
+    /**
+     * 无法继续转移的位置
+     */
+    uint8_t const* stop;
+
+    /**
+     * 最后一次进入接受状态后的位置
+     */
+    uint8_t const* accept_end;
+
+    /**
+     * 最后一次进入的接受状态所接受的词法记号，0表示没有
+     */
+    int64_t accept;
+  };
+
+  /**
+   * 状态的转移函数，返回0表示没有转移
+   */
+  using Transfer = std::function<int(int state, uint8_t input)>;
+
+  Jit(Jit const&) = delete;
+  Jit& operator=(Jit const&) = delete;
+  ~Jit();
+
+  /**
+   * 当前平台是否支持本机代码
+   */
+  static bool Supported();
+
+  /**
+   * 编译状态机，状态0不会被编译
+   *
+   * @param accepts 每个状态接受的词法记号，0表示不接受
+   * @param transfer 转移函数
+   * @return 不支持的平台或分配可执行内存失败时返回空指针
+   */
+  static std::unique_ptr<Jit> Compile(std::vector<int> const& accepts,
+                                      Transfer const& transfer);
+
+  /**
+   * 从指定状态开始扫描，直到无法转移或到达末尾
+   * 与解释执行相同，起始状态本身是否接受不被记录
+   *
+   * @param state 起始状态
+   * @param begin 文本起始
+   * @param end 文本末尾
+   */
+  Result Run(int state, uint8_t const* begin, uint8_t const* end) const;
+
+  /**
+   * 生成的代码字节数
+   */
+  size_t SizeOfCode() const { return size_; }
+
+ private:
+  Jit() = default;
+
+  /**
+   * 可执行内存
+   */
+  void* code_ = nullptr;
+  size_t size_ = 0;
+
+  /**
+   * 每个状态的入口偏移量
+   */
+  std::vector<uint32_t> entries_;
+};
+
+}  // namespace toylang
+
+#endif
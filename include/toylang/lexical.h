@@ -1,14 +1,19 @@
 #ifndef __TOYLANG_LEXICAL_H__
 #define __TOYLANG_LEXICAL_H__
 
+#include <cstdint>
+#include <functional>
 #include <map>
 #include <memory>
 #include <optional>
 #include <set>
 #include <string>
+#include <string_view>
+#include <unordered_map>
 #include <vector>
 
 #include "toylang/regex.h"
+#include "toylang/symbol.h"
 #include "toylang/token.h"
 
 namespace toylang {
@@ -33,6 +38,11 @@ class Lexicon {
 
   static constexpr auto kDefaultContext = "default";
 
+  /**
+   * 默认的状态数量上限
+   */
+  static constexpr size_t kDefaultStateLimit = 1 << 16;
+
  public:
   Lexicon(std::unique_ptr<Impl>&& impl);
   Lexicon(Lexicon const&) = delete;
@@ -84,6 +94,11 @@ class Lexicon {
    */
   std::vector<std::string> ListContexts() const;
 
+  /**
+   * 状态机的状态数量，含起始状态0，模拟位置自动机时为0
+   */
+  size_t CountStates() const;
+
   /**
    * 获取指定状态可接受的词法记号
    *
@@ -99,10 +114,252 @@ class Lexicon {
    */
   std::optional<int> TransferOfState(int state, int input) const;
 
+  /**
+   * 根据词法单元的文本对词法记号重新分类
+   * 若词法记号定义了关键字且文本是其中之一，返回关键字的词法记号ID，
+   * 否则返回原词法记号ID
+   *
+   * @param token 词法记号ID
+   * @param text 词法单元的文本
+   */
+  int ClassifyToken(int token, std::string_view text) const;
+
+  /**
+   * 计算文本开头有多少个字节无法作为当前上下文中任何词法单元的首字节
+   * 用于在错误之后快速找到下一个可能的词法单元起点
+   *
+   * @param context 上下文ID
+   * @param text 文本
+   */
+  size_t SkipOfContext(int context, std::string_view text) const;
+
+  /**
+   * 从 offset 向前寻找最近的安全重启点
+   * 安全重启点是从文本开头在该上下文中分析时必然出现的词法单元边界，
+   * 从这里开始分析得到的词法单元与从文本开头分析得到的完全相同
+   * 判定时以逆向状态机从候选位置逐字节向前扫描，
+   * 证明没有任何词法单元的前缀能够跨越该位置后即可停止，
+   * 扫描距离通常只与局部的词法单元长度有关，而与偏移量无关
+   * 未构建逆向状态机时返回0
+   *
+   * @param context 上下文ID，文本从开头到 offset 都处于该上下文
+   * @param text 文本
+   * @param offset 偏移量
+   * @return 不大于 offset 的安全重启点
+   */
+  size_t RestartOfContext(int context, std::string_view text,
+                          size_t offset) const;
+
+  /**
+   * 状态机的一次扫描结果，偏移量相对于被扫描的文本
+   */
+  struct Scanned {
+    /**
+     * 无法继续转移的偏移量
+     */
+    size_t end;
+
+    /**
+     * 最后一次经过的接受状态所接受的词法记号，0表示没有经过接受状态
+     */
+    int accept;
+
+    /**
+     * 最后一次经过接受状态时的偏移量
+     */
+    size_t accept_end;
+  };
+
+  /**
+   * 从上下文的首状态开始在文本上运行状态机，直到无法转移为止
+   * 已编译为本机代码时执行本机代码，状态数较少时以字节重排指令执行，
+   * 否则解释执行转移表
+   *
+   * @param context 上下文ID
+   * @param text 文本
+   */
+  Scanned Scan(int context, std::string_view text) const;
+
+  /**
+   * 状态机是否已被编译为本机代码
+   */
+  bool Jitted() const;
+
+  /**
+   * 状态机是否足够小，可以由字节重排指令执行
+   */
+  bool Vectorized() const;
+
+  /**
+   * 状态数超出构造器的上限时，词法规则不构建状态机，
+   * 而是以位集模拟位置自动机，此时没有状态可供查询，
+   * AcceptOfState 与 TransferOfState 不可用
+   */
+  bool Simulated() const;
+
+  /**
+   * 是否构建了逆向状态机，见 Builder::EnableReverse
+   */
+  bool Reversible() const;
+
+  /**
+   * 词法规则的指纹，由词法记号、上下文、关键字表与状态机计算
+   * 指纹相同的词法规则对同一源码得到相同的词法单元序列，
+   * 可以用于判断缓存的分析结果是否仍然有效
+   */
+  uint64_t Fingerprint() const;
+
  private:
+  friend class Scanner;
+
   std::unique_ptr<Impl const> impl_;
 };
 
+/**
+ * 对源码的一次编辑
+ */
+struct Edit {
+  /**
+   * 编辑起始偏移量
+   */
+  size_t offset;
+
+  /**
+   * 删除的字符数
+   */
+  size_t removed;
+
+  /**
+   * 插入的文本
+   */
+  std::string inserted;
+};
+
+struct Relexed;
+
+/**
+ * 供增量词法分析反复编辑的词法单元序列
+ *
+ * 以间隙缓冲区保存，间隙之前的词法单元保存绝对位置，
+ * 间隙之后的词法单元保存相对源码末尾的偏移量与行号，
+ * 编辑只需把间隙移动到编辑位置，其后的词法单元不必逐个平移
+ * 词法单元的源码在读取时才填入，序列不会让旧的源码一直存活
+ */
+class TokenList {
+ public:
+  TokenList() = default;
+
+  /**
+   * @param tokens 源码完整的词法单元序列
+   * @param source 源码
+   */
+  TokenList(std::vector<Token> tokens, std::shared_ptr<Source const> source);
+
+  /**
+   * 词法单元数量
+   */
+  size_t Count() const { return front_.size() + back_.size(); }
+
+  /**
+   * 取得下标为 index 的词法单元，位置与源码均为当前值
+   */
+  Token At(size_t index) const;
+
+  /**
+   * 取得全部词法单元
+   */
+  std::vector<Token> List() const;
+
+ private:
+  friend struct Relexed;
+
+  /**
+   * 移动间隙，使其之前恰有 index 个词法单元
+   */
+  void MoveGap(size_t index);
+
+  /**
+   * 间隙之前的词法单元
+   */
+  std::vector<Token> front_;
+
+  /**
+   * 间隙之后的词法单元，逆序保存，
+   * offset 为到源码末尾的距离，行号为到最后一行的距离
+   */
+  std::vector<Token> back_;
+
+  std::shared_ptr<Source const> source_;
+
+  /**
+   * 源码的行数
+   */
+  size_t lines_ = 1;
+};
+
+/**
+ * 增量词法分析的结果
+ *
+ * 旧词法单元序列中下标为 [first, first + count) 的词法单元被 tokens 取代，
+ * 其余词法单元保持不变，但其后的词法单元位置需要按照编辑结果平移
+ */
+struct Relexed {
+  /**
+   * 被取代的第一个旧词法单元下标
+   */
+  size_t first;
+
+  /**
+   * 被取代的旧词法单元数量
+   */
+  size_t count;
+
+  /**
+   * 重新分析得到的词法单元
+   */
+  std::vector<Token> tokens;
+
+  /**
+   * 编辑后的源码
+   */
+  std::shared_ptr<Source const> source;
+
+  /**
+   * 后续词法单元的偏移量变化
+   */
+  ptrdiff_t offset_delta;
+
+  /**
+   * 后续词法单元的行号变化
+   */
+  ptrdiff_t line_delta;
+
+  /**
+   * 与同步点位于同一行的后续词法单元的列号变化
+   */
+  ptrdiff_t column_delta;
+
+  /**
+   * 同步点在旧源码中的行号
+   */
+  size_t sync_line;
+
+  /**
+   * 将结果应用到旧词法单元序列上，得到与完整分析新源码相同的序列
+   * 其后的每个词法单元都要平移，反复编辑大文件时应使用 TokenList
+   *
+   * @param tokens 旧词法单元序列
+   */
+  void Apply(std::vector<Token>& tokens) const;
+
+  /**
+   * 将结果应用到旧词法单元序列上，只移动编辑位置附近的词法单元
+   *
+   * @param tokens 旧词法单元序列
+   */
+  void Apply(TokenList& tokens) const;
+};
+
 /**
  * 词法分析器，加载词法规则和源码后，可以提取Token
  */
@@ -143,12 +400,86 @@ class Scanner {
    */
   void SetContext(std::string const& context);
 
+  /**
+   * 启用驻留，指定词法单元的文本将被驻留到符号池中，
+   * 其符号ID记录在 Token::symbol 中，多个词法分析器可以共享同一个符号池
+   *
+   * @param pool 符号池，为空则停用驻留
+   * @param tokens 需要驻留的词法单元ID
+   */
+  void SetSymbolPool(std::shared_ptr<SymbolPool> pool,
+                     std::set<int> const& tokens);
+
   /**
    * 提取下一个Token
+   * 采用最长匹配，扫描到无法转移时回退到最后一次经过的接受状态，
+   * 若没有经过任何接受状态，则提取一个错误词法单元，
+   * 它覆盖到下一个可能作为词法单元首字节的字节为止
+   * 词法规则已编译为本机代码或可以由字节重排指令执行时，
+   * 不需要回退的扫描由 Lexicon::Scan 完成，记录动画时总是解释执行
    */
   Token NextToken();
 
+  /**
+   * 增量词法分析
+   * 从编辑位置之前最后一个不受影响的词法单元边界处恢复分析，
+   * 当新的词法单元与旧序列重新对齐时停止，只返回发生变化的范围
+   * 恢复位置按前瞻范围二分查找，除拼接源码外，耗时只与变化的范围有关
+   * 分析完成后，词法分析器的源码被替换为编辑后的源码
+   *
+   * @param tokens 当前源码完整的词法单元序列
+   * @param edit 对当前源码的编辑
+   */
+  Relexed Relex(std::vector<Token> const& tokens, Edit const& edit);
+
+  /**
+   * 增量词法分析
+   *
+   * @param tokens 当前源码完整的词法单元序列
+   * @param edit 对当前源码的编辑
+   */
+  Relexed Relex(TokenList const& tokens, Edit const& edit);
+
+  /**
+   * 在同一线程中交错推进多个词法分析器，直到它们都到达源码末尾
+   * 每一轮让每个词法分析器各完成一次状态转移，
+   * 各自的查表互不依赖，缓存未命中的等待可以重叠
+   * 适合同时分析大量小文件，建议每批4到16个词法分析器
+   * 每个词法分析器得到的词法单元与逐个调用 NextToken 完全相同
+   *
+   * @param scanners 词法分析器，各自已设置词法规则与源码
+   * @return 每个词法分析器的词法单元序列，不包含 EOF
+   */
+  static std::vector<std::vector<Token>> ScanInterleaved(
+      std::vector<Scanner*> const& scanners);
+
  private:
+  /**
+   * 以当前位置创建词法单元，尚未确定ID与长度
+   */
+  Token StartToken() const;
+
+  /**
+   * 根据扫描结果确定词法单元的ID与长度，并将当前位置移动到词法单元之后
+   *
+   * @param token 由 StartToken 创建的词法单元
+   * @param accept 最后一次经过的接受状态所接受的词法记号
+   * @param accept_end 最后一次经过接受状态时的偏移量
+   * @param offset 扫描停止的偏移量
+   */
+  void FinishToken(Token& token, std::optional<int> accept, size_t accept_end,
+                   size_t offset);
+
+  /**
+   * 增量词法分析，通过 at 读取旧词法单元
+   *
+   * @param count 旧词法单元数量
+   * @param at 取得下标对应的旧词法单元
+   * @param edit 对当前源码的编辑
+   */
+  Relexed Relex(size_t count, std::function<Token(size_t)> const& at,
+                Edit const& edit);
+
   /**
    * 当前上下文
    */
@@ -166,6 +497,10 @@ class Scanner {
    * 当前偏移量
    */
   size_t offset_;
+  /**
+   * 此前扫描读取到的最远偏移量
+   */
+  size_t reach_;
 
   /**
    * 词法规则
@@ -175,6 +510,34 @@ class Scanner {
    * 源码
    */
   std::shared_ptr<Source const> source_;
+
+  /**
+   * 符号池
+   */
+  std::shared_ptr<SymbolPool> symbols_;
+
+  /**
+   * 需要驻留的词法单元，下标为词法单元ID
+   */
+  std::vector<bool> interned_;
+
+  /**
+   * 已知无法再到达任何接受状态的 (状态, 偏移量) 组合，
+   * 映射到得出该结论的扫描读取到的位置
+   * 最长匹配回退时记录，之后的扫描遇到这些组合立即停止，
+   * 保证整个源码的扫描时间与源码长度成线性关系
+   */
+  std::unordered_map<uint64_t, size_t> failures_;
+
+  /**
+   * 模拟位置自动机时的失败记录，键为偏移量与位置集合的字节，含义同 failures_
+   */
+  std::unordered_map<std::string, size_t> simulated_failures_;
+
+  /**
+   * failures_ 中记录的最大偏移量，当前位置超过它时所有记录都已失效
+   */
+  size_t failures_limit_;
 };
 
 /**
@@ -182,9 +545,20 @@ class Scanner {
  */
 class Lexicon::Builder {
   struct Building;
+  friend struct Lexicon::Impl;
 
  public:
   Builder();
+
+  /**
+   * 在已有的词法规则上继续定义词法单元
+   * 已有词法规则的状态与转移被直接复用，只对新增词法单元引入的状态做子集构造，
+   * 已有词法规则本身保持不变，正在使用它的词法分析器不受影响
+   * 新词法规则继承已有词法规则的全部构造选项
+   *
+   * @param base 已有的词法规则，必须以 EnableExtension 构造
+   */
+  explicit Builder(std::shared_ptr<Lexicon const> const& base);
   Builder(Builder const&) = delete;
   Builder(Builder&&) = delete;
   Builder& operator=(Builder const&) = delete;
@@ -194,6 +568,7 @@ class Lexicon::Builder {
   /**
    * 定义一个词法单元
    * 先添加的词法单元优先级更高
+   * 含有交集或补集的正则表达式只能以导数构造，见 UseDerivatives
    *
    * @param name 词法单元名称
    * @param pattern 正则表达式
@@ -203,6 +578,55 @@ class Lexicon::Builder {
       std::string const& name, Regex pattern,
       std::optional<std::set<std::string>> const& context = std::nullopt);
 
+  /**
+   * 为标识符定义一组关键字
+   * 关键字不进入状态机，而是在标识符被接受后，
+   * 通过构建时生成的完美哈希表将其重新分类为关键字
+   * 关键字的名称即为其文本，且必须能被标识符完整匹配
+   *
+   * @param identifier 标识符词法单元名称，必须已经定义
+   * @param keywords 关键字
+   */
+  Builder& DefineKeywords(std::string const& identifier,
+                          std::vector<std::string> const& keywords);
+
+  /**
+   * 限制状态机的状态数量，嵌套在闭包中的联合可能产生指数级的状态
+   * 超出上限时整个词法规则改为模拟位置自动机，扫描较慢但内存有界
+   *
+   * @param limit 状态数量上限，默认为 kDefaultStateLimit
+   */
+  Builder& LimitStates(size_t limit);
+
+  /**
+   * 构建时将状态机编译为本机代码，词法分析器随后优先执行本机代码
+   * 当前平台不支持时静默退回解释执行
+   */
+  Builder& EnableJit();
+
+  /**
+   * 以正则表达式的 Brzozowski 导数而非 followpos 构造状态机
+   * 每个状态是各正则模式的导数组成的向量，导数在构造时被规范化，
+   * 等价的导数通常得到同一个状态，状态机往往已经接近最小
+   * 导数构造支持交集与补集，定义了含有它们的词法单元时自动启用
+   * 导数构造不能退回位置自动机，状态数超出上限时 Build 抛出异常
+   */
+  Builder& UseDerivatives();
+
+  /**
+   * 构建时额外构造逆向状态机，供 Lexicon::RestartOfContext 使用
+   * 逆向状态机由各词法单元反转后的正则表达式构造，以任意位置为起点，
+   * 因此接受所有词法单元前缀的逆序，状态数超出上限时不构建
+   * 含有交集或补集的词法规则不支持逆向状态机
+   */
+  Builder& EnableReverse();
+
+  /**
+   * 构建后保留正则模式的中间表示与各状态的位置集合，
+   * 使词法规则可以作为 Builder(base) 的基础继续扩展，代价是额外占用内存
+   */
+  Builder& EnableExtension();
+
   /**
    * 完成词法规则构造
    */
@@ -1,10 +1,14 @@
 #ifndef __TOYLANG_REGEX_H__
 #define __TOYLANG_REGEX_H__
 
+#include <array>
+#include <cstdint>
 #include <memory>
 #include <set>
 #include <stdexcept>
 #include <string>
+#include <unordered_map>
+#include <vector>
 
 namespace toylang {
 
@@ -15,12 +19,132 @@ using Regex = std::shared_ptr<regex::Node>;
 
 namespace regex {
 
-struct LeafNode;
-using LeafNodes = std::set<std::shared_ptr<LeafNode>,
-                           std::owner_less<std::shared_ptr<LeafNode>>>;
+/**
+ * 256位字符集位图
+ *
+ * 以四个64位字为单位进行集合运算
+ */
+class Charset {
+ public:
+  Charset() = default;
+
+  /**
+   * 包含全部字符的字符集
+   */
+  static Charset All() {
+    Charset set;
+    for (auto& word : set.words_) word = ~uint64_t{0};
+    return set;
+  }
+
+  /**
+   * 包含闭区间 [lo, hi] 中全部字符的字符集
+   */
+  static Charset Range(unsigned char lo, unsigned char hi) {
+    Charset set;
+    for (auto ch = unsigned{lo}; ch <= hi; ch++) set.Set(ch);
+    return set;
+  }
+
+  /**
+   * 包含字符串中全部字符的字符集
+   */
+  static Charset Of(std::string const& chars) {
+    Charset set;
+    for (auto const ch : chars) set.Set(ch);
+    return set;
+  }
+
+  void Set(unsigned char ch) { words_[ch >> 6] |= uint64_t{1} << (ch & 63); }
+  void Reset(unsigned char ch) {
+    words_[ch >> 6] &= ~(uint64_t{1} << (ch & 63));
+  }
+  bool Test(unsigned char ch) const {
+    return (words_[ch >> 6] >> (ch & 63)) & 1;
+  }
+
+  bool Empty() const {
+    return (words_[0] | words_[1] | words_[2] | words_[3]) == 0;
+  }
+
+  size_t Count() const {
+    size_t count = 0;
+    for (auto const word : words_) count += __builtin_popcountll(word);
+    return count;
+  }
+
+  /**
+   * 最小的字符，字符集为空时返回256
+   */
+  unsigned Min() const {
+    for (unsigned i = 0; i < 4; i++) {
+      if (words_[i]) return i * 64 + __builtin_ctzll(words_[i]);
+    }
+    return 256;
+  }
+
+  /**
+   * 按从小到大的顺序遍历字符集中的全部字符
+   */
+  template <typename F>
+  void ForEach(F&& f) const {
+    for (unsigned i = 0; i < 4; i++) {
+      for (auto word = words_[i]; word; word &= word - 1) {
+        f(static_cast<unsigned char>(i * 64 + __builtin_ctzll(word)));
+      }
+    }
+  }
+
+  Charset operator~() const {
+    Charset set;
+    for (auto i = 0; i < 4; i++) set.words_[i] = ~words_[i];
+    return set;
+  }
+  Charset& operator|=(Charset const& rhs) {
+    for (auto i = 0; i < 4; i++) words_[i] |= rhs.words_[i];
+    return *this;
+  }
+  Charset& operator&=(Charset const& rhs) {
+    for (auto i = 0; i < 4; i++) words_[i] &= rhs.words_[i];
+    return *this;
+  }
+  Charset& operator-=(Charset const& rhs) {
+    for (auto i = 0; i < 4; i++) words_[i] &= ~rhs.words_[i];
+    return *this;
+  }
+  Charset operator|(Charset rhs) const { return rhs |= *this; }
+  Charset operator&(Charset rhs) const { return rhs &= *this; }
+  Charset operator-(Charset const& rhs) const {
+    auto set = *this;
+    return set -= rhs;
+  }
+  bool operator==(Charset const& rhs) const { return words_ == rhs.words_; }
+  bool operator!=(Charset const& rhs) const { return words_ != rhs.words_; }
+
+  struct Hash {
+    size_t operator()(Charset const& set) const {
+      size_t hash = 0;
+      for (auto const word : set.words_)
+        hash = hash * 0x9e3779b97f4a7c15ULL + word;
+      return hash;
+    }
+  };
+
+ private:
+  std::array<uint64_t, 4> words_{};
+};
+
+/**
+ * 将字符集划分为互不相交的等价类
+ * 任意两个字符属于同一等价类，当且仅当它们同时属于或同时不属于每个给定字符集
+ *
+ * @param sets 字符集
+ * @return 按最小字符排序的等价类，覆盖全部256个字符
+ */
+std::vector<Charset> Partition(std::vector<Charset> const& sets);
 
 /** 正则表达式节点 */
-struct Node : std::enable_shared_from_this<Node> {
+struct Node {
   enum Type {
     /** 接受 */
     kAccept,
@@ -45,26 +169,19 @@ struct Node : std::enable_shared_from_this<Node> {
 
     /** 可选 */
     kOptional,
+
+    /** 交集 */
+    kIntersect,
+
+    /** 补集 */
+    kComplement,
   };
 
   virtual ~Node() = default;
   virtual Type type() const = 0;
-
-  virtual bool GetNullable() = 0;
-  virtual LeafNodes GetFirstpos() = 0;
-  virtual LeafNodes GetLastpos() = 0;
-  virtual void CalcFollowpos() = 0;
 };
 
-struct LeafNode : public Node {
-  /**
-   * 后继位置集合
-   */
-  LeafNodes followpos_;
-
-  void CalcFollowpos() final;
-  virtual bool Match(char input) = 0;
-};
+struct LeafNode : public Node {};
 
 struct AcceptNode : public LeafNode {
   int token_id_;
@@ -72,10 +189,6 @@ struct AcceptNode : public LeafNode {
   Type type() const override { return kAccept; }
 
   AcceptNode(int token_id) : token_id_{token_id} {}
-  bool GetNullable() override;
-  LeafNodes GetFirstpos() override;
-  LeafNodes GetLastpos() override;
-  bool Match(char input) override;
 };
 
 /**
@@ -86,10 +199,12 @@ struct CharNode : public LeafNode {
 
   Type type() const override { return kChar; }
 
-  bool GetNullable() override;
-  LeafNodes GetFirstpos() override;
-  LeafNodes GetLastpos() override;
-  bool Match(char input) override;
+  bool Match(char input) const { return ch_ == input; }
+  Charset Bits() const {
+    Charset bits;
+    bits.Set(ch_);
+    return bits;
+  }
 };
 
 /**
@@ -114,15 +229,23 @@ struct RangeNode : public LeafNode {
   enum Direction { kNegative, kPositive };
 
   Direction dir_;
-  std::set<char> set_;
+
+  /**
+   * 字符类中列出的字符
+   */
+  Charset set_;
+
+  /**
+   * 字符类实际匹配的字符，编译时根据 dir_ 和 set_ 计算
+   */
+  Charset bits_;
+
   std::string writing_;
 
   Type type() const override { return kRange; }
 
-  bool GetNullable() override;
-  LeafNodes GetFirstpos() override;
-  LeafNodes GetLastpos() override;
-  bool Match(char input) override;
+  bool Match(char input) const { return bits_.Test(input); }
+  Charset const& Bits() const { return bits_; }
 };
 
 struct ConcatNode : public Node {
@@ -130,11 +253,6 @@ struct ConcatNode : public Node {
   Regex right_;
 
   Type type() const override { return kConcat; }
-
-  bool GetNullable() override;
-  LeafNodes GetFirstpos() override;
-  LeafNodes GetLastpos() override;
-  void CalcFollowpos() override;
 };
 
 struct UnionNode : public Node {
@@ -142,53 +260,216 @@ struct UnionNode : public Node {
   Regex right_;
 
   Type type() const override { return kUnion; }
-
-  bool GetNullable() override;
-  LeafNodes GetFirstpos() override;
-  LeafNodes GetLastpos() override;
-  void CalcFollowpos() override;
 };
 
 struct KleeneNode : public Node {
   Regex child_;
 
   Type type() const override { return kKleene; }
-
-  bool GetNullable() override;
-  LeafNodes GetFirstpos() override;
-  LeafNodes GetLastpos() override;
-  void CalcFollowpos() override;
 };
 
 struct PositiveNode : public Node {
   Regex child_;
 
   Type type() const override { return kPositive; }
-
-  bool GetNullable() override;
-  LeafNodes GetFirstpos() override;
-  LeafNodes GetLastpos() override;
-  void CalcFollowpos() override;
 };
 
 struct OptionalNode : public Node {
   Regex child_;
 
   Type type() const override { return kOptional; }
+};
+
+/**
+ * 交集节点，匹配同时被两个子表达式匹配的串
+ */
+struct IntersectNode : public Node {
+  Regex left_;
+  Regex right_;
+
+  Type type() const override { return kIntersect; }
+};
 
-  bool GetNullable() override;
-  LeafNodes GetFirstpos() override;
-  LeafNodes GetLastpos() override;
-  void CalcFollowpos() override;
+/**
+ * 补集节点，匹配不被子表达式匹配的任意字节串
+ */
+struct ComplementNode : public Node {
+  Regex child_;
+
+  Type type() const override { return kComplement; }
+};
+
+/**
+ * 正则表达式的紧凑中间表示
+ *
+ * 节点连续存放在 Arena 中，使用下标相互引用，子节点总是先于父节点存放，
+ * 因此按下标顺序遍历即为后序遍历，无需递归或虚函数分派
+ * Arena 析构时一次性释放全部节点
+ */
+class Arena {
+ public:
+  /**
+   * 节点下标
+   */
+  using Index = uint32_t;
+
+  /**
+   * 位置集合，即叶节点下标的有序集合
+   */
+  using Positions = std::vector<Index>;
+
+  static constexpr Index kNil = ~Index{0};
+
+  /**
+   * 将正则表达式树转换为中间表示
+   *
+   * @param regex 正则表达式，不能包含交集或补集
+   * @return 根节点下标
+   */
+  Index Lower(Regex const& regex);
+
+  /**
+   * 在正则表达式之后添加接受节点
+   *
+   * @param regex 被接受的正则表达式根节点下标
+   * @param accept 接受节点
+   * @return 接受节点下标
+   */
+  Index Accept(Index regex, std::shared_ptr<AcceptNode> const& accept);
+
+  /**
+   * 计算尚未分析的节点的 nullable, firstpos, lastpos 和 followpos
+   */
+  void Analyze();
+
+  Node::Type TypeOf(Index node) const { return items_[node].type; }
+  int TokenOf(Index node) const { return items_[node].token_id; }
+  Node const* OriginOf(Index node) const { return items_[node].origin; }
+  bool NullableOf(Index node) const { return nullable_[node]; }
+  Positions const& FirstposOf(Index node) const { return firstpos_[node]; }
+  Positions const& LastposOf(Index node) const { return lastpos_[node]; }
+  Positions const& FollowposOf(Index node) const { return followpos_[node]; }
+
+  /**
+   * 判断叶节点能否接受输入字符
+   *
+   * @param node 叶节点下标
+   * @param input 输入字符
+   */
+  bool Match(Index node, char input) const;
+
+  /**
+   * 获取叶节点的字符类下标，相同的字符类共享同一个下标
+   * 接受节点没有字符类，返回 kNil
+   *
+   * @param node 叶节点下标
+   */
+  Index ClassOf(Index node) const { return items_[node].cls; }
+
+  /**
+   * 获取全部不同的字符类
+   */
+  std::vector<Charset> const& Classes() const { return classes_; }
+
+ private:
+  struct Item {
+    Node::Type type;
+
+    /**
+     * 左子节点或唯一的子节点
+     */
+    Index lhs;
+
+    /**
+     * 右子节点
+     */
+    Index rhs;
+
+    /**
+     * 字符节点和字符类节点的字符类下标
+     */
+    Index cls;
+
+    /**
+     * 接受节点的词法记号ID
+     */
+    int token_id;
+
+    /**
+     * 对应的正则表达式树节点
+     */
+    Node const* origin;
+  };
+
+  Index Add(Item const& item);
+  Index LowerNode(Node const& node);
+  Index Intern(Charset const& cls);
+
+  std::vector<Item> items_;
+  std::vector<bool> nullable_;
+  std::vector<Positions> firstpos_;
+  std::vector<Positions> lastpos_;
+  std::vector<Positions> followpos_;
+
+  /**
+   * 字符类表，每个字符类只保存一次
+   */
+  std::vector<Charset> classes_;
+  std::unordered_map<Charset, Index, Charset::Hash> class_ids_;
+
+  /**
+   * 持有被转换的正则表达式树，保证 origin 有效
+   */
+  std::vector<Regex> owners_;
 };
 
 /**
  * 编译正则表达式
+ * \u{...} 表示一个Unicode码点，多字节字符与码点都被编译为UTF-8字节序列
+ * 包含码点的字符类按码点匹配，否则字符类与 . 仍按字节匹配
+ * 前缀运算符 ~ 表示补集，结合得比串更紧，& 表示交集，结合得比 | 更紧，
+ * 例如 \/\*~(.*\*\/.*)\*\/ 匹配不包含 *\/ 的块注释
  *
  * @param expr 正则表达式
  */
 Regex Compile(std::string const& expr);
 
+/**
+ * 按从左到右的顺序获取节点的子节点
+ * 遍历正则表达式时以显式栈代替递归，节点层数不受调用栈大小限制
+ *
+ * @param node 正则表达式节点
+ * @return 不存在的子节点为空指针，叶节点的两个子节点都为空
+ */
+std::array<Regex const*, 2> ChildrenOf(Node const& node);
+
+/**
+ * 判断正则表达式是否包含交集或补集
+ * 这类正则表达式无法转换为 Arena，只能通过导数构造状态机
+ *
+ * @param regex 正则表达式
+ */
+bool NeedsDerivatives(Regex const& regex);
+
+/**
+ * 化简正则表达式
+ *  1. 展平嵌套的联合与串
+ *  2. 将单字符的候选项合并为一个字符类，去除重复的候选项
+ *  3. 合并嵌套的闭包，例如 (x*)* 化简为 x*
+ * 化简不会修改原正则表达式，未发生变化的子树会被复用
+ *
+ * @param regex 正则表达式
+ */
+Regex Simplify(Regex const& regex);
+
+/**
+ * 反转正则表达式，结果匹配原正则表达式所匹配的串的逆序
+ * 字符与字符类节点被复用，多字节字符按字节逆序匹配
+ *
+ * @param regex 正则表达式，不能包含接受节点
+ */
+Regex Reverse(Regex const& regex);
+
 /**
  * 将两个正则表达式使用或运算连接
  *
@@ -198,7 +479,9 @@ Regex Compile(std::string const& expr);
 Regex Union(Regex const& lhs, Regex const& rhs);
 
 /**
- * 为正则表达式标记接受节点
+ * 为正则表达式创建接受节点
+ * 接受节点位于正则表达式之后，在 Arena 中与正则表达式相连
+ *
  * @param regex 正则表达式
  * @param token_id 接受的token id
  */
@@ -0,0 +1,290 @@
+#ifndef __TOYLANG_SEARCH_H__
+#define __TOYLANG_SEARCH_H__
+
+#include <array>
+#include <cstddef>
+#include <cstdint>
+#include <memory>
+#include <optional>
+#include <string>
+#include <string_view>
+#include <vector>
+
+#include "toylang/regex.h"
+
+namespace toylang::regex {
+
+/**
+ * 文字预过滤器
+ *
+ * 若正则表达式的每个匹配都必然包含某个文字串，
+ * 不包含任何一个这类文字串的文本就不可能匹配，可以不运行状态机而直接跳过
+ * 文字串以 memchr 定位首字节后比较，比逐字节查表快得多
+ */
+class Prefilter {
+ public:
+  /**
+   * 同时检查的文字串过多时，逐个查找反而比运行状态机慢
+   */
+  static constexpr size_t kMaxLiterals = 8;
+
+  /**
+   * 提取正则表达式的每个匹配都必然包含的最长文字串
+   * 只分析串、联合与闭包的结构，结果可能比实际能提取的更短，但总是正确的
+   *
+   * @param regex 正则表达式，不能包含接受节点、交集或补集
+   * @return 没有必然包含的文字串时返回空串
+   */
+  static std::string RequiredOf(Regex const& regex);
+
+  /**
+   * 提取正则表达式的每个匹配都必然以之开头的最长文字串
+   *
+   * @param regex 正则表达式，要求同 RequiredOf
+   */
+  static std::string PrefixOf(Regex const& regex);
+
+  /**
+   * 构造预过滤器
+   *
+   * @param literals 每个正则表达式必然包含的文字串
+   * @return 任一文字串为空或去重后文字串过多时返回空指针，此时无法过滤
+   */
+  static std::unique_ptr<Prefilter> Create(
+      std::vector<std::string> const& literals);
+
+  /**
+   * 文本是否可能匹配，即是否包含至少一个文字串
+   */
+  bool MayMatch(std::string_view text) const;
+
+  std::vector<std::string> const& Literals() const { return literals_; }
+
+ private:
+  Prefilter() = default;
+
+  std::vector<std::string> literals_;
+};
+
+/**
+ * 搜索使用的确定状态机
+ *
+ * 以 followpos 构造，状态0是没有任何转移的死状态，状态1是起始状态
+ * 每个状态以位图记录其包含的接受节点所接受的ID
+ */
+class Automaton {
+ public:
+  /**
+   * 构造状态机
+   *
+   * @param arena 已分析的中间表示
+   * @param starts 起始状态包含的位置
+   * @param unanchored 是否在每个状态中并入起始位置，使匹配可以从任意偏移量开始
+   * @param ids 接受节点ID的上限，ID必须在 [0, ids) 之间
+   * @param state_limit 状态数量上限，超出时抛出异常
+   */
+  static Automaton Build(Arena const& arena, Arena::Positions const& starts,
+                         bool unanchored, size_t ids, size_t state_limit);
+
+  /**
+   * 构造寻找最左最长匹配终点的状态机
+   *
+   * 状态是按起点先后排列的位置集合的列表，每个集合对应一个起点，
+   * 同一位置只保留在起点最靠前的集合中；尚未匹配时每步都追加起始位置的集合
+   * 某个集合包含接受节点时，丢弃其后的全部集合，并不再追加起始位置，
+   * 因此接受状态总是最左的候选匹配的一个终点，最后经过的接受状态即为最长匹配的终点
+   * 状态1是只有起始位置的状态，扫描停在这个状态时可以直接跳到下一个候选起点
+   * 结果只有ID 0
+   *
+   * @param arena 已分析的中间表示
+   * @param starts 起始位置
+   * @param state_limit 状态数量上限，超出时抛出异常
+   */
+  static Automaton BuildLeftmost(Arena const& arena,
+                                 Arena::Positions const& starts,
+                                 size_t state_limit);
+
+  static constexpr uint32_t kDead = 0;
+  static constexpr uint32_t kStart = 1;
+
+  uint32_t Next(uint32_t state, char input) const {
+    return transfers_[state * class_count_ +
+                      byte_classes_[static_cast<unsigned char>(input)]];
+  }
+
+  /**
+   * 状态是否接受任何ID
+   */
+  bool Accepting(uint32_t state) const { return flags_[state] != 0; }
+
+  /**
+   * 状态接受的ID位图，共 Words() 个64位字
+   */
+  uint64_t const* AcceptsOf(uint32_t state) const {
+    return accepts_.data() + state * words_;
+  }
+
+  size_t Words() const { return words_; }
+  size_t CountStates() const { return flags_.size(); }
+
+ private:
+  size_t words_ = 0;
+
+  std::array<uint8_t, 256> byte_classes_;
+  size_t class_count_ = 0;
+
+  /**
+   * 转移表，第 state * class_count_ + class 项为转移目标
+   */
+  std::vector<uint32_t> transfers_;
+
+  std::vector<uint64_t> accepts_;
+
+  /**
+   * 状态是否接受任何ID，用于跳过位图合并
+   */
+  std::vector<uint8_t> flags_;
+};
+
+/**
+ * 多模式匹配集合
+ *
+ * 将一组正则表达式编译为同一个确定状态机，一遍扫描即可得到文本中出现的全部模式
+ * 正则表达式可以匹配文本中的任意子串，每个状态都包含全部正则表达式的首位置，
+ * 因此状态机从不停止，每个状态以位图记录其接受的模式
+ * 所有模式都有必然包含的文字串时，先以文字预过滤器跳过不可能匹配的文本
+ */
+class Set {
+ public:
+  /**
+   * 编译模式集合
+   *
+   * @param patterns 正则表达式，模式ID为其下标，不能包含交集或补集
+   * @param state_limit 状态数量上限，超出时抛出异常
+   */
+  static std::unique_ptr<Set> Compile(std::vector<Regex> const& patterns,
+                                      size_t state_limit = 1 << 16);
+
+  Set(Set const&) = delete;
+  Set& operator=(Set const&) = delete;
+  ~Set() = default;
+
+  /**
+   * 找出在文本中出现的全部模式
+   *
+   * @param text 文本，例如日志中的一行
+   * @return 按升序排列的模式ID
+   */
+  std::vector<int> Match(std::string_view text) const;
+
+  size_t CountPatterns() const { return patterns_; }
+  size_t CountStates() const { return dfa_.CountStates(); }
+
+  /**
+   * 预过滤器，无法过滤时为空
+   */
+  Prefilter const* GetPrefilter() const { return prefilter_.get(); }
+
+ private:
+  Set() = default;
+
+  size_t patterns_ = 0;
+  Automaton dfa_;
+  std::unique_ptr<Prefilter> prefilter_;
+};
+
+/**
+ * 单个正则表达式的匹配器
+ *
+ * 匹配遵循最左最长规则：从最靠前的起点开始，取该起点处最长的匹配
+ * 搜索先以一遍正向扫描找到最左最长匹配的终点，再从终点运行逆向状态机找回起点，
+ * 不会从每个候选起点重新运行状态机，搜索时间与文本长度成线性
+ * 编译时提取每个匹配必然的文字前缀与必然包含的文字串，
+ * 没有候选匹配时以 memchr 直接跳到前缀出现的位置，没有前缀时跳过不能作为匹配首字节的字节，
+ * 必然包含的文字串不出现时立即结束搜索
+ */
+class Matcher {
+ public:
+  /**
+   * 一次匹配在文本中的位置
+   */
+  struct Found {
+    size_t offset;
+    size_t length;
+
+    bool operator==(Found const& other) const {
+      return offset == other.offset && length == other.length;
+    }
+  };
+
+  /**
+   * 编译匹配器
+   *
+   * @param regex 正则表达式，不能包含交集或补集
+   * @param state_limit 状态数量上限，超出时抛出异常
+   */
+  static std::unique_ptr<Matcher> Compile(Regex const& regex,
+                                          size_t state_limit = 1 << 16);
+
+  Matcher(Matcher const&) = delete;
+  Matcher& operator=(Matcher const&) = delete;
+  ~Matcher() = default;
+
+  /**
+   * 整个文本是否匹配
+   */
+  bool Match(std::string_view text) const;
+
+  /**
+   * 从 from 开始搜索第一个匹配
+   *
+   * @param text 文本
+   * @param from 搜索起点
+   */
+  std::optional<Found> Search(std::string_view text, size_t from = 0) const;
+
+  /**
+   * 找出全部互不重叠的匹配，空匹配之后从下一个字节继续搜索
+   */
+  std::vector<Found> FindAll(std::string_view text) const;
+
+  std::string const& Prefix() const { return prefix_; }
+  std::string const& Required() const { return required_; }
+
+ private:
+  Matcher() = default;
+
+  /**
+   * 寻找最左最长匹配终点的状态机，见 Automaton::BuildLeftmost
+   */
+  Automaton dfa_;
+
+  /**
+   * 逆向正则表达式的锚定状态机，从匹配终点向前运行，最远的接受位置即为起点
+   */
+  Automaton reverse_;
+
+  /**
+   * 每个匹配的文字前缀，可能为空
+   */
+  std::string prefix_;
+
+  /**
+   * 每个匹配都包含的文字串，可能为空
+   */
+  std::string required_;
+
+  /**
+   * 能作为匹配首字节的字节
+   */
+  std::array<bool, 256> leaders_;
+
+  /**
+   * 是否能匹配空串
+   */
+  bool nullable_ = false;
+};
+
+}  // namespace toylang::regex
+
+#endif
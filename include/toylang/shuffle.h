@@ -0,0 +1,88 @@
+#ifndef __TOYLANG_SHUFFLE_H__
+#define __TOYLANG_SHUFFLE_H__
+
+#include <array>
+#include <cstddef>
+#include <cstdint>
+#include <memory>
+#include <vector>
+
+#include "toylang/jit.h"
+
+namespace toylang {
+
+/**
+ * Shuffle
+ *
+ * 以字节重排指令执行状态数较少的确定状态机
+ * 每个输入字节的转移被看作一个状态到状态的映射，
+ * 一个块中各字节的映射以树形顺序两两复合，没有逐字节的串行依赖，
+ * 复合结果直接给出块末尾的状态
+ * 映射的定义域附带一个标记位，记录块内是否离开过接受状态，
+ * 未离开过时块内最后一次接受的位置可以由块末尾的状态确定，
+ * 否则以及状态机在块内停止时，该块退回逐字节执行
+ * 状态数（含无转移状态0）不超过16且处理器支持 SSSE3 时可用
+ */
+class Shuffle {
+ public:
+  /**
+   * 扫描结果，与本机代码的结果含义相同
+   */
+  using Result = Jit::Result;
+
+  static constexpr size_t kMaxStates = 16;
+
+  Shuffle(Shuffle const&) = delete;
+  Shuffle& operator=(Shuffle const&) = delete;
+  ~Shuffle() = default;
+
+  /**
+   * 当前处理器是否支持
+   */
+  static bool Supported();
+
+  /**
+   * 构造重排表，状态0必须是没有任何转移的状态
+   *
+   * @param accepts 每个状态接受的词法记号，0表示不接受
+   * @param transfer 转移函数
+   * @return 状态过多或处理器不支持时返回空指针
+   */
+  static std::unique_ptr<Shuffle> Compile(std::vector<int> const& accepts,
+                                          Jit::Transfer const& transfer);
+
+  /**
+   * 从指定状态开始扫描，直到无法转移或到达末尾
+   *
+   * @param state 起始状态
+   * @param begin 文本起始
+   * @param end 文本末尾
+   */
+  Result Run(int state, uint8_t const* begin, uint8_t const* end) const;
+
+ private:
+  Shuffle() = default;
+
+  /**
+   * 逐字节执行，直到无法转移或到达 end
+   */
+  uint8_t const* Step(int& state, uint8_t const* begin, uint8_t const* end,
+                      Result& result) const;
+
+  /**
+   * 每个字节的映射，前16项是未离开过接受状态时的目标，后16项是离开过时的目标
+   * 目标的低4位是状态，第4位是标记
+   */
+  std::array<std::array<uint8_t, 2 * kMaxStates>, 256> maps_;
+
+  /**
+   * 逐字节执行使用的转移表，第 state * 256 + input 项为转移目标
+   */
+  std::vector<uint8_t> transfers_;
+
+  std::vector<int> accepts_;
+};
+
+}  // namespace toylang
+
+#endif
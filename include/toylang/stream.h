@@ -0,0 +1,187 @@
+#ifndef __TOYLANG_STREAM_H__
+#define __TOYLANG_STREAM_H__
+
+#include <atomic>
+#include <exception>
+#include <memory>
+#include <optional>
+#include <set>
+#include <thread>
+#include <vector>
+
+#include "toylang/lexical.h"
+#include "toylang/token.h"
+
+namespace toylang {
+
+/**
+ * SpscQueue
+ *
+ * 单生产者单消费者的无锁环形队列，容量向上取整为2的幂
+ * 只能由一个线程调用 TryPush，另一个线程调用 TryPop
+ */
+template <typename T>
+class SpscQueue {
+ public:
+  explicit SpscQueue(size_t capacity) {
+    size_t size = 1;
+    while (size < capacity) size <<= 1;
+    slots_.resize(size);
+  }
+
+  /**
+   * 尝试放入元素，队列已满时返回 false 且不移动元素
+   */
+  bool TryPush(T&& value) {
+    auto const tail = tail_.load(std::memory_order_relaxed);
+    if (tail - head_.load(std::memory_order_acquire) == slots_.size())
+      return false;
+
+    slots_[tail & (slots_.size() - 1)] = std::move(value);
+    tail_.store(tail + 1, std::memory_order_release);
+    return true;
+  }
+
+  /**
+   * 尝试取出元素，队列为空时返回 false
+   */
+  bool TryPop(T& value) {
+    auto const head = head_.load(std::memory_order_relaxed);
+    if (head == tail_.load(std::memory_order_acquire)) return false;
+
+    value = std::move(slots_[head & (slots_.size() - 1)]);
+    head_.store(head + 1, std::memory_order_release);
+    return true;
+  }
+
+ private:
+  std::vector<T> slots_;
+
+  /**
+   * 读写位置单调递增，分别位于不同的缓存行以避免伪共享
+   */
+  alignas(64) std::atomic<size_t> head_{0};
+  alignas(64) std::atomic<size_t> tail_{0};
+};
+
+/**
+ * TokenStream
+ *
+ * 为语法分析器提供向前查看与回溯的词法单元流
+ * 词法单元保存在固定容量的环形缓冲区中，位置从0开始单调递增
+ * 当前位置与尚未释放的标记之后的词法单元都保留在缓冲区中，
+ * 回溯到标记处不需要重新进行词法分析
+ *
+ * 流水线模式下，后台线程提前运行词法分析器并通过无锁队列交付词法单元，
+ * 此时语法分析器不能再修改词法分析器的上下文
+ */
+class TokenStream {
+ public:
+  /**
+   * @param scanner 已设置词法规则与源码的词法分析器，流存续期间不能直接使用
+   * @param capacity 环形缓冲区容量，向上取整为2的幂
+   * @param pipelined 是否使用后台线程提前进行词法分析
+   */
+  explicit TokenStream(Scanner& scanner, size_t capacity = 64,
+                       bool pipelined = false);
+  TokenStream(TokenStream const&) = delete;
+  TokenStream(TokenStream&&) = delete;
+  TokenStream& operator=(TokenStream const&) = delete;
+  TokenStream& operator=(TokenStream&&) = delete;
+  ~TokenStream();
+
+  /**
+   * 查看当前位置之后第k个词法单元，到达结尾后总是返回 EOF
+   * 若需要保留的词法单元超过缓冲区容量，则抛出异常
+   *
+   * @param k 相对当前位置的偏移
+   */
+  Token const& Peek(size_t k = 0);
+
+  /**
+   * 取出当前词法单元，并前进到下一个位置
+   */
+  Token Advance();
+
+  /**
+   * 标记当前位置，标记释放之前其后的词法单元不会被丢弃
+   *
+   * @return 标记的位置
+   */
+  size_t Mark();
+
+  /**
+   * 回到标记的位置，标记仍然有效
+   *
+   * @param mark 尚未释放的标记
+   */
+  void Rewind(size_t mark);
+
+  /**
+   * 释放标记
+   *
+   * @param mark 尚未释放的标记
+   */
+  void Release(size_t mark);
+
+  /**
+   * 当前位置
+   */
+  size_t Position() const { return position_; }
+
+ private:
+  /**
+   * 从词法分析器或后台线程取得下一个词法单元
+   */
+  Token Produce();
+
+  /**
+   * 将词法单元读入缓冲区，直到缓冲区包含位置 end 之前的全部词法单元
+   */
+  void Fill(size_t end);
+
+  /**
+   * 最早需要保留的位置
+   */
+  size_t Base() const;
+
+  Scanner& scanner_;
+
+  /**
+   * 环形缓冲区，位置 pos 的词法单元存放在 pos & (ring_.size() - 1) 处
+   */
+  std::vector<Token> ring_;
+
+  /**
+   * 当前位置
+   */
+  size_t position_;
+
+  /**
+   * 已读入缓冲区的词法单元的结束位置
+   */
+  size_t end_;
+
+  /**
+   * 尚未释放的标记
+   */
+  std::multiset<size_t> marks_;
+
+  /**
+   * 已经取得的 EOF，之后不再请求词法分析器
+   */
+  std::optional<Token> eof_;
+
+  /**
+   * 流水线模式下的后台线程与队列
+   */
+  std::unique_ptr<SpscQueue<Token>> queue_;
+  std::thread producer_;
+  std::atomic<bool> stopping_;
+  std::atomic<bool> finished_;
+  std::exception_ptr error_;
+};
+
+}  // namespace toylang
+
+#endif
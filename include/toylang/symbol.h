@@ -0,0 +1,88 @@
+#ifndef __TOYLANG_SYMBOL_H__
+#define __TOYLANG_SYMBOL_H__
+
+#include <array>
+#include <cstdint>
+#include <memory>
+#include <mutex>
+#include <string_view>
+#include <unordered_map>
+#include <vector>
+
+namespace toylang {
+
+/**
+ * SymbolPool
+ *
+ * 线程安全的字符串驻留池，相同的文本总是得到相同的符号ID
+ * 文本按哈希值分布到多个分片中，每个分片拥有独立的锁与内存区，
+ * 文本被复制到分片的内存区中，在池的整个生命周期内保持有效
+ */
+class SymbolPool {
+ public:
+  /**
+   * 符号ID，0表示没有符号
+   */
+  using Symbol = uint32_t;
+
+  static constexpr Symbol kNone = 0;
+
+  SymbolPool() = default;
+  SymbolPool(SymbolPool const&) = delete;
+  SymbolPool& operator=(SymbolPool const&) = delete;
+
+  /**
+   * 驻留文本，返回其符号ID
+   *
+   * @param text 文本
+   */
+  Symbol Intern(std::string_view text);
+
+  /**
+   * 获取符号的文本，返回的文本在池的生命周期内有效
+   *
+   * @param symbol 符号ID
+   */
+  std::string_view TextOf(Symbol symbol) const;
+
+  /**
+   * 不同符号的数量
+   */
+  size_t CountSymbols() const;
+
+ private:
+  static constexpr size_t kShardBits = 4;
+  static constexpr size_t kShardCount = size_t{1} << kShardBits;
+  static constexpr size_t kBlockSize = 64 * 1024;
+
+  struct Shard {
+    mutable std::mutex mutex;
+
+    /**
+     * 文本到分片内序号的映射，键指向内存区
+     */
+    std::unordered_map<std::string_view, uint32_t> ids;
+
+    /**
+     * 按序号排列的文本
+     */
+    std::vector<std::string_view> texts;
+
+    /**
+     * 内存区，每个块一旦分配就不再移动
+     */
+    std::vector<std::unique_ptr<char[]>> blocks;
+    size_t used = kBlockSize;
+
+    /**
+     * 将文本复制到内存区
+     */
+    std::string_view Store(std::string_view text);
+  };
+
+  std::array<Shard, kShardCount> shards_;
+};
+
+}  // namespace toylang
+
+#endif
@@ -1,6 +1,7 @@
 #ifndef __TOYLANG_TOKEN_H__
 #define __TOYLANG_TOKEN_H__
 
+#include <cstdint>
 #include <memory>
 #include <string>
 #include <vector>
@@ -65,6 +66,24 @@ struct Token {
    */
   std::shared_ptr<Lexicon const> lexicon;
 
+  /**
+   * 提取词法单元时所处的上下文
+   */
+  int context;
+
+  /**
+   * 提取词法单元时越过其末尾检查的字符数，输入结束也计为一个字符
+   * 包括之前的词法单元越过此处检查的字符，因此末尾加上前瞻长度随词法单元单调不减
+   * 编辑只要不触及这一范围，这个词法单元及之前的词法单元就不会改变
+   */
+  size_t lookahead;
+
+  /**
+   * 词法单元文本的符号ID，仅当词法分析器为该词法单元启用驻留时有效，
+   * 否则为0
+   */
+  uint32_t symbol;
+
   /**
    * 获取词法单元的文本
    */
@@ -1,6 +1,22 @@
 #include "toylang/anim.h"
 
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <condition_variable>
+#include <csignal>
+#include <cstdio>
+#include <cstdlib>
 #include <iostream>
+#include <iterator>
+#include <memory>
+#include <mutex>
+#include <optional>
+#include <string_view>
+#include <thread>
+#include <unordered_map>
+#include <unordered_set>
+#include <vector>
 
 #include "nlohmann/json.hpp"
 #include "spdlog/fmt/fmt.h"
@@ -9,23 +25,26 @@
 
 namespace toylang {
 
-template <typename _to, typename _from>
-std::shared_ptr<_to> to(std::shared_ptr<_from> const& ptr) {
-  return std::dynamic_pointer_cast<_to>(ptr);
-}
-
 template <typename T, std::enable_if_t<std::is_arithmetic_v<T>>* = nullptr>
 std::string hex(T const& value) {
   return fmt::format("{:#x}", value);
 }
 
+template <typename T>
+std::string hex(T const* ptr) {
+  return hex((uint64_t)ptr);
+}
+
 template <typename T>
 std::string hex(std::shared_ptr<T> const& ptr) {
-  return hex((uint64_t)ptr.get());
+  return hex(ptr.get());
 }
 
 void anim(nlohmann::json const& json) {
-  fmt::print(stderr, "ANIM: {}\n", json.dump());
+  // 源码与字符类可能包含不完整的UTF-8序列，以替换字符输出
+  fmt::print(stderr, "ANIM: {}\n",
+             json.dump(-1, ' ', false,
+                       nlohmann::json::error_handler_t::replace));
 }
 
 nlohmann::json jsonify(regex::RangeNode::Direction dir) {
@@ -38,61 +57,82 @@ nlohmann::json jsonify(regex::RangeNode::Direction dir) {
   throw std::runtime_error{"jsonify: unknown direction"};
 }
 
+/** 正则表达式节点类型的名称 */
+char const* NameOf(regex::Node::Type type) {
+  switch (type) {
+    case regex::Node::kAccept:
+      return "accept";
+    case regex::Node::kChar:
+      return "char";
+    case regex::Node::kRange:
+      return "range";
+    case regex::Node::kConcat:
+      return "concat";
+    case regex::Node::kUnion:
+      return "union";
+    case regex::Node::kKleene:
+      return "kleene";
+    case regex::Node::kPositive:
+      return "positive";
+    case regex::Node::kOptional:
+      return "optional";
+    case regex::Node::kIntersect:
+      return "intersect";
+    case regex::Node::kComplement:
+      return "complement";
+  }
+  throw std::runtime_error{"jsonify: unknown regex"};
+}
+
 nlohmann::json jsonify(Regex regex) {
-  if (auto node = to<regex::AcceptNode>(regex); node) {
-    return nlohmann::json{
-        {"id", hex(node)},
-        {"type", "accept"},
-        {"tokenId", node->token_id_},
-    };
-  } else if (auto node = to<regex::CharNode>(regex); node) {
-    return nlohmann::json{
-        {"id", hex(node)},
-        {"type", "char"},
-        {"char", std::string(1, node->ch_)},
-    };
-  } else if (auto node = to<regex::RangeNode>(regex); node) {
-    return nlohmann::json{
-        {"id", hex(node)},
-        {"type", "range"},
-        {"dir", jsonify(node->dir_)},
-        {"set", node->writing_},
-    };
-  } else if (auto node = to<regex::ConcatNode>(regex); node) {
-    return nlohmann::json{
-        {"id", hex(node)},
-        {"type", "concat"},
-        {"lhs", jsonify(node->left_)},
-        {"rhs", jsonify(node->right_)},
-    };
-  } else if (auto node = to<regex::UnionNode>(regex); node) {
-    return nlohmann::json{
-        {"id", hex(node)},
-        {"type", "union"},
-        {"lhs", jsonify(node->left_)},
-        {"rhs", jsonify(node->right_)},
-    };
-  } else if (auto node = to<regex::KleeneNode>(regex); node) {
-    return nlohmann::json{
-        {"id", hex(node)},
-        {"type", "kleene"},
-        {"sub", jsonify(node->child_)},
-    };
-  } else if (auto node = to<regex::PositiveNode>(regex); node) {
-    return nlohmann::json{
-        {"id", hex(node)},
-        {"type", "positive"},
-        {"sub", jsonify(node->child_)},
-    };
-  } else if (auto node = to<regex::OptionalNode>(regex); node) {
-    return nlohmann::json{
-        {"id", hex(node)},
-        {"type", "optional"},
-        {"sub", jsonify(node->child_)},
-    };
-  } else {
-    throw std::runtime_error{"jsonify: unknown regex"};
+  // 以显式栈后序遍历，子节点转换完毕后再转换父节点
+  std::vector<std::pair<Regex, bool>> stack{{regex, false}};
+  std::vector<nlohmann::json> converted;
+  while (!stack.empty()) {
+    auto const [node, expanded] = stack.back();
+    stack.pop_back();
+    auto const [left, right] = regex::ChildrenOf(*node);
+    if (left && !expanded) {
+      stack.push_back({node, true});
+      if (right) stack.push_back({*right, false});
+      stack.push_back({*left, false});
+      continue;
+    }
+
+    nlohmann::json json{{"id", hex(node)}, {"type", NameOf(node->type())}};
+    switch (node->type()) {
+      case regex::Node::kAccept:
+        json["tokenId"] = static_cast<regex::AcceptNode&>(*node).token_id_;
+        break;
+      case regex::Node::kChar:
+        json["char"] = std::string(1, static_cast<regex::CharNode&>(*node).ch_);
+        break;
+      case regex::Node::kRange: {
+        auto const& range = static_cast<regex::RangeNode&>(*node);
+        json["dir"] = jsonify(range.dir_);
+        json["set"] = range.writing_;
+      } break;
+      default:
+        if (right) {
+          json["rhs"] = std::move(converted.back());
+          converted.pop_back();
+          json["lhs"] = std::move(converted.back());
+        } else {
+          json["sub"] = std::move(converted.back());
+        }
+        converted.pop_back();
+        break;
+    }
+    converted.push_back(std::move(json));
   }
+  return converted.back();
+}
+
+nlohmann::json jsonify(regex::Arena const& arena,
+                       regex::Arena::Positions const& poses) {
+  auto json = nlohmann::json::array();
+  for (auto const pos : poses) json.push_back(hex(arena.OriginOf(pos)));
+  return json;
 }
 
 nlohmann::json jsonify(Token const& token) {
@@ -109,98 +149,1142 @@ nlohmann::json jsonify(Token const& token) {
   };
 }
 
-void Anim::RegexCompile(std::string const& pattern, Regex regex) {
-  anim({
-      {"$", "RegexCompile"},
-      {"pattern", pattern},
-      {"regex", jsonify(regex)},
-  });
+namespace {
+
+/**
+ * 二进制记录的事件类型
+ */
+enum Tag : uint8_t {
+  kTagRegexCompile = 1,
+  kTagRegexAccept,
+  kTagRegexUnion,
+  kTagRegexSimplify,
+  kTagLexiconAddToken,
+  kTagLexiconAddState,
+  kTagLexiconAddTransfer,
+  kTagLexiconSetAccept,
+  kTagScannerSetSource,
+  kTagScannerSetState,
+  kTagScannerNextInput,
+  kTagScannerNextLine,
+  kTagScannerAcceptToken,
+
+  /** 源码内容，每份源码只记录一次，之后通过哈希值引用 */
+  kTagSource,
+
+  /** 增量分析时对当前源码的编辑，只记录插入的文本 */
+  kTagScannerEditSource,
+};
+
+/**
+ * 二进制记录的文件头
+ */
+constexpr char kMagic[] = "TLANIM1\n";
+
+/**
+ * 源码的哈希值
+ */
+uint64_t HashOf(std::string const& content) {
+  uint64_t hash = 14695981039346656037ULL;
+  for (auto const ch : content) {
+    hash ^= static_cast<unsigned char>(ch);
+    hash *= 1099511628211ULL;
+  }
+  return hash;
+}
+
+/**
+ * 二进制记录器
+ *
+ * 事件以变长整数编码，字符串与正则表达式节点首次出现时记录其内容，
+ * 之后只记录其编号，源码只记录一次，之后通过哈希值引用
+ * 编码后的事件先写入缓冲区，缓冲区满后交给后台线程写出
+ */
+class BinaryRecorder {
+ public:
+  explicit BinaryRecorder(std::string const& path)
+      : file_{std::fopen(path.c_str(), "wb")} {
+    if (!file_) throw std::runtime_error{"failed to open " + path};
+    std::string_view const magic{kMagic, sizeof(kMagic) - 1};
+    buffer_.reserve(kBufferSize);
+    for (auto const ch : magic) buffer_.push_back(static_cast<uint8_t>(ch));
+    thread_ = std::thread([this] { Run(); });
+  }
+
+  ~BinaryRecorder() {
+    {
+      std::unique_lock<std::mutex> lock{mutex_};
+      cv_.wait(lock, [&] { return pending_.empty(); });
+      pending_.swap(buffer_);
+      stopping_ = true;
+    }
+    cv_.notify_all();
+    thread_.join();
+    std::fclose(file_);
+  }
+
+  /**
+   * 记录一个事件，encode 负责编码事件的字段
+   */
+  template <typename F>
+  void Emit(Tag tag, F&& encode) {
+    std::unique_lock<std::mutex> lock{mutex_};
+    Varint(tag);
+    encode(*this);
+    Flush(lock);
+  }
+
+  void Varint(uint64_t value) {
+    while (value >= 0x80) {
+      buffer_.push_back(static_cast<uint8_t>(value | 0x80));
+      value >>= 7;
+    }
+    buffer_.push_back(static_cast<uint8_t>(value));
+  }
+
+  void Signed(int64_t value) {
+    Varint((static_cast<uint64_t>(value) << 1) ^ (value < 0 ? ~0ULL : 0ULL));
+  }
+
+  void Bytes(std::string const& bytes) {
+    Varint(bytes.size());
+    buffer_.insert(buffer_.end(), bytes.begin(), bytes.end());
+  }
+
+  void String(std::string const& string) {
+    auto const [it, created] = strings_.emplace(string, strings_.size());
+    Varint(it->second << 1 | created);
+    if (created) Bytes(string);
+  }
+
+  uint64_t Ref(void const* ptr) {
+    auto const [it, created] = refs_.emplace(ptr, next_ref_);
+    if (created) next_ref_++;
+    return it->second;
+  }
+
+  void Node(Regex const& regex) {
+    // 以显式栈先序遍历，与解码顺序一致
+    std::vector<Regex> stack{regex};
+    while (!stack.empty()) {
+      auto const node = std::move(stack.back());
+      stack.pop_back();
+
+      auto const it = defined_.find(node.get());
+      if (it != defined_.end() && it->second.lock() == node) {
+        Varint(Ref(node.get()) << 1);
+        continue;
+      }
+
+      // 节点被释放后其地址可能被新节点复用，此时需要重新编号
+      if (it != defined_.end()) refs_[node.get()] = next_ref_++;
+      defined_[node.get()] = node;
+
+      Varint(Ref(node.get()) << 1 | 1);
+      Varint(node->type());
+      switch (node->type()) {
+        case regex::Node::kAccept:
+          Signed(static_cast<regex::AcceptNode&>(*node).token_id_);
+          break;
+        case regex::Node::kChar:
+          Varint(static_cast<unsigned char>(
+              static_cast<regex::CharNode&>(*node).ch_));
+          break;
+        case regex::Node::kRange: {
+          auto const& range = static_cast<regex::RangeNode&>(*node);
+          Varint(range.dir_);
+          String(range.writing_);
+        } break;
+        default: {
+          auto const [left, right] = regex::ChildrenOf(*node);
+          if (right) stack.push_back(*right);
+          stack.push_back(*left);
+        } break;
+      }
+    }
+  }
+
+  /**
+   * 记录源码内容并返回其哈希值，每份源码只记录一次
+   */
+  uint64_t DefineSource(std::string const& content) {
+    auto const hash = HashOf(content);
+    std::unique_lock<std::mutex> lock{mutex_};
+    if (sources_.insert(hash).second) {
+      Varint(kTagSource);
+      Varint(hash);
+      Bytes(content);
+      Flush(lock);
+    }
+    return hash;
+  }
+
+ private:
+  static constexpr size_t kBufferSize = 1 << 16;
+
+  /**
+   * 缓冲区满后等待后台线程写完上一个缓冲区，然后交换缓冲区
+   */
+  void Flush(std::unique_lock<std::mutex>& lock) {
+    if (buffer_.size() < kBufferSize) return;
+
+    cv_.wait(lock, [&] { return pending_.empty(); });
+    pending_.swap(buffer_);
+    cv_.notify_all();
+  }
+
+  void Run() {
+    std::unique_lock<std::mutex> lock{mutex_};
+    while (true) {
+      cv_.wait(lock, [&] { return !pending_.empty() || stopping_; });
+      if (!pending_.empty()) {
+        std::vector<uint8_t> data;
+        data.swap(pending_);
+        cv_.notify_all();
+
+        lock.unlock();
+        std::fwrite(data.data(), 1, data.size(), file_);
+        lock.lock();
+      } else {
+        break;
+      }
+    }
+    std::fflush(file_);
+  }
+
+  std::FILE* file_;
+  std::thread thread_;
+  std::mutex mutex_;
+  std::condition_variable cv_;
+  bool stopping_ = false;
+
+  /**
+   * 正在编码的缓冲区与等待后台线程写出的缓冲区
+   */
+  std::vector<uint8_t> buffer_;
+  std::vector<uint8_t> pending_;
+
+  std::unordered_map<std::string, uint64_t> strings_;
+  std::unordered_map<void const*, uint64_t> refs_;
+  std::unordered_map<void const*, std::weak_ptr<regex::Node>> defined_;
+  uint64_t next_ref_ = 1;
+  std::unordered_set<uint64_t> sources_;
+};
+
+/**
+ * 二进制记录的解码器
+ */
+class BinaryDecoder {
+ public:
+  explicit BinaryDecoder(std::istream& in) : in_{in} {}
+
+  uint64_t Varint() {
+    uint64_t value = 0;
+    for (auto shift = 0; shift < 64; shift += 7) {
+      auto const ch = Byte();
+      value |= static_cast<uint64_t>(ch & 0x7f) << shift;
+      if (!(ch & 0x80)) return value;
+    }
+    throw std::runtime_error{"Convert: invalid varint"};
+  }
+
+  int64_t Signed() {
+    auto const value = Varint();
+    return static_cast<int64_t>(value >> 1) ^ -static_cast<int64_t>(value & 1);
+  }
+
+  std::string Bytes() {
+    std::string bytes(Varint(), '\0');
+    if (!in_.read(bytes.data(), bytes.size())) {
+      throw std::runtime_error{"Convert: unexpected end of record"};
+    }
+    return bytes;
+  }
+
+  std::string String() {
+    auto const value = Varint();
+    if (value & 1) strings_.push_back(Bytes());
+    return strings_.at(value >> 1);
+  }
+
+  nlohmann::json Node() {
+    // 以显式栈先序解码，节点的子节点全部解码后节点才完整
+    struct Pending {
+      uint64_t id;
+      nlohmann::json json;
+      std::vector<char const*> slots;
+      size_t filled = 0;
+    };
+    std::vector<Pending> stack;
+
+    for (;;) {
+      auto const value = Varint();
+      auto const id = value >> 1;
+      nlohmann::json json;
+      if (!(value & 1)) {
+        json = nodes_.at(id);
+      } else {
+        auto const type = Varint();
+        if (type > regex::Node::kComplement) {
+          throw std::runtime_error{"Convert: unknown regex"};
+        }
+        json = {{"id", hex(id)},
+                {"type", NameOf(static_cast<regex::Node::Type>(type))}};
+        switch (type) {
+          case regex::Node::kAccept:
+            json["tokenId"] = Signed();
+            break;
+          case regex::Node::kChar:
+            json["char"] = std::string(1, static_cast<char>(Varint()));
+            break;
+          case regex::Node::kRange:
+            json["dir"] =
+                jsonify(static_cast<regex::RangeNode::Direction>(Varint()));
+            json["set"] = String();
+            break;
+          case regex::Node::kConcat:
+          case regex::Node::kUnion:
+          case regex::Node::kIntersect:
+            stack.push_back({id, std::move(json), {"lhs", "rhs"}});
+            continue;
+          default:
+            stack.push_back({id, std::move(json), {"sub"}});
+            continue;
+        }
+        nodes_[id] = json;
+      }
+
+      // 逐层填入父节点，直到某个父节点仍有未解码的子节点
+      for (;;) {
+        if (stack.empty()) return json;
+        auto& parent = stack.back();
+        parent.json[parent.slots[parent.filled++]] = std::move(json);
+        if (parent.filled < parent.slots.size()) break;
+        json = nodes_[parent.id] = std::move(parent.json);
+        stack.pop_back();
+      }
+    }
+  }
+
+ private:
+  uint8_t Byte() {
+    auto const ch = in_.get();
+    if (ch == std::char_traits<char>::eof()) {
+      throw std::runtime_error{"Convert: unexpected end of record"};
+    }
+    return static_cast<uint8_t>(ch);
+  }
+
+  std::istream& in_;
+  std::vector<std::string> strings_;
+  std::unordered_map<uint64_t, nlohmann::json> nodes_;
+};
+
+/**
+ * 飞行记录器中事件字段的名称，pointer 表示字段是节点地址
+ */
+struct FieldInfo {
+  char const* name;
+  bool pointer;
+};
+
+struct EventInfo {
+  char const* name;
+  FieldInfo fields[4];
+};
+
+/** 下标为 Anim::Event */
+EventInfo const event_infos[] = {
+    {"RegexCompile", {{"regex", true}}},
+    {"RegexAccept", {{"accept", true}, {"tokenId", false}}},
+    {"RegexUnion", {{"union", true}, {"lhs", true}, {"rhs", true}}},
+    {"RegexSimplify", {{"origin", true}, {"regex", true}}},
+    {"LexiconAddToken", {{"id", false}}},
+    {"LexiconAddState", {{"id", false}, {"poses", false}}},
+    {"LexiconAddTransfer", {{"from", false}, {"to", false}, {"input", false}}},
+    {"LexiconSetAccept", {{"id", false}, {"token", false}}},
+    {"ScannerSetSource", {{"size", false}}},
+    {"ScannerSetState", {{"state", false}}},
+    {"ScannerNextInput", {}},
+    {"ScannerNextLine", {}},
+    {"ScannerAcceptToken",
+     {{"id", false}, {"offset", false}, {"length", false}, {"line", false}}},
+    {"ScannerEditSource",
+     {{"offset", false}, {"removed", false}, {"inserted", false}}},
+};
+
+/**
+ * 收到信号后由信号处理函数设置
+ */
+volatile std::sig_atomic_t flight_signaled = 0;
+
+/**
+ * 飞行记录器
+ *
+ * 以固定大小的环形缓冲区保存最近的事件，事件只包含整数字段，记录时不分配内存
+ * 记录不加锁：以 fetch_add 领取序号，写入对应槽位后以序号盖章，
+ * 写出时只采用盖章序号与期望序号一致且读取前后未变的槽位，
+ * 正在写入或已被覆盖的槽位计为丢弃
+ * 触发条件满足时将缓冲区中的事件以 JSON 格式追加写入文件，写出过程加锁
+ * 写出有最小间隔，间隔内的触发合并为一次推迟的写出，
+ * 由间隔结束后记录的第一条事件、DumpFlight 或停止记录器时写出
+ */
+class FlightRecorder {
+ public:
+  explicit FlightRecorder(Anim::FlightOptions options)
+      : options_{std::move(options)} {
+    size_t size = 1;
+    while (size < options_.capacity) size <<= 1;
+    ring_ = std::make_unique<Slot[]>(size);
+    mask_ = size - 1;
+  }
+
+  void Record(Anim::Event event, int64_t a, int64_t b, int64_t c, int64_t d) {
+    if (!(options_.events >> static_cast<unsigned>(event) & 1)) return;
+
+    auto const seq = seq_.fetch_add(1, std::memory_order_relaxed);
+    auto& slot = ring_[seq & mask_];
+    // 写入期间的盖章为奇数，读取者据此跳过正在写入的槽位
+    slot.stamp.store(seq * 2 + 1, std::memory_order_relaxed);
+    std::atomic_thread_fence(std::memory_order_release);
+    slot.event.store(event, std::memory_order_relaxed);
+    slot.args[0].store(a, std::memory_order_relaxed);
+    slot.args[1].store(b, std::memory_order_relaxed);
+    slot.args[2].store(c, std::memory_order_relaxed);
+    slot.args[3].store(d, std::memory_order_relaxed);
+    slot.stamp.store(seq * 2 + 2, std::memory_order_release);
+
+    char const* reason = nullptr;
+    if (flight_signaled) {
+      flight_signaled = 0;
+      reason = "signal";
+    } else if (options_.on_error && event == Anim::Event::kScannerAcceptToken &&
+               a == Token::kError) {
+      reason = "error";
+    } else if (options_.trigger &&
+               options_.trigger(Anim::Record{event, seq, {a, b, c, d}})) {
+      reason = "trigger";
+    }
+    if (reason) {
+      pending_reason_.store(reason, std::memory_order_relaxed);
+      triggers_.fetch_add(1, std::memory_order_relaxed);
+      pending_.store(true, std::memory_order_release);
+    }
+    // 只有存在推迟的写出时才读取时钟
+    if (pending_.load(std::memory_order_acquire)) DumpPending(false);
+  }
+
+  void DumpNow(std::string const& reason) {
+    std::lock_guard<std::mutex> lock{dump_mutex_};
+    pending_.store(false, std::memory_order_relaxed);
+    Dump(reason);
+  }
+
+  /**
+   * 写出推迟的写出，force 为假时只在间隔结束后写出，且不等待正在进行的写出
+   */
+  void DumpPending(bool force) {
+    auto const now = std::chrono::steady_clock::now().time_since_epoch();
+    if (!force && now < next_dump_.load(std::memory_order_relaxed)) return;
+
+    std::unique_lock<std::mutex> lock{dump_mutex_, std::defer_lock};
+    if (force) {
+      lock.lock();
+    } else if (!lock.try_lock()) {
+      return;
+    }
+    if (!pending_.exchange(false, std::memory_order_acquire)) return;
+    next_dump_.store(
+        now + std::chrono::duration_cast<std::chrono::steady_clock::duration>(
+                  options_.interval),
+        std::memory_order_relaxed);
+    Dump(pending_reason_.load(std::memory_order_relaxed));
+  }
+
+ private:
+  struct Slot {
+    /**
+     * 序号的两倍加二，写入期间为序号的两倍加一
+     */
+    std::atomic<uint64_t> stamp{0};
+    std::atomic<Anim::Event> event{};
+    std::atomic<int64_t> args[4] = {};
+  };
+
+  /**
+   * 读取序号为 seq 的事件，槽位正在写入或已被覆盖时返回空
+   */
+  std::optional<Anim::Record> Read(uint64_t seq) const {
+    auto const& slot = ring_[seq & mask_];
+    if (slot.stamp.load(std::memory_order_acquire) != seq * 2 + 2)
+      return std::nullopt;
+
+    Anim::Record record{slot.event.load(std::memory_order_relaxed),
+                        seq,
+                        {slot.args[0].load(std::memory_order_relaxed),
+                         slot.args[1].load(std::memory_order_relaxed),
+                         slot.args[2].load(std::memory_order_relaxed),
+                         slot.args[3].load(std::memory_order_relaxed)}};
+    std::atomic_thread_fence(std::memory_order_acquire);
+    if (slot.stamp.load(std::memory_order_relaxed) != seq * 2 + 2)
+      return std::nullopt;
+    return record;
+  }
+
+  /**
+   * 写出尚未写出的事件，调用者必须持有 dump_mutex_
+   */
+  void Dump(std::string const& reason) {
+    auto const end = seq_.load(std::memory_order_acquire);
+    auto const size = mask_ + 1;
+    auto const first = std::max(start_, end > size ? end - size : 0);
+    auto const file = std::fopen(options_.path.c_str(), "a");
+    if (!file) return;
+
+    std::vector<Anim::Record> records;
+    for (auto seq = first; seq < end; seq++) {
+      if (auto const record = Read(seq)) records.push_back(*record);
+    }
+    fmt::print(file, "FLIGHT: {}\n",
+               nlohmann::json{
+                   {"$", "FlightDump"},
+                   {"reason", reason},
+                   {"triggers", triggers_.exchange(0, std::memory_order_relaxed)},
+                   {"dropped", end - start_ - records.size()},
+               }
+                   .dump());
+    for (auto const& record : records) {
+      auto const& info = event_infos[static_cast<unsigned>(record.event)];
+      nlohmann::json json{{"$", info.name}, {"seq", record.seq}};
+      for (auto i = 0; i < 4 && info.fields[i].name; i++) {
+        if (info.fields[i].pointer) {
+          json[info.fields[i].name] = hex(record.args[i]);
+        } else {
+          json[info.fields[i].name] = record.args[i];
+        }
+      }
+      fmt::print(file, "FLIGHT: {}\n", json.dump());
+    }
+    std::fclose(file);
+    start_ = end;
+  }
+
+  Anim::FlightOptions options_;
+  std::unique_ptr<Slot[]> ring_;
+  uint64_t mask_ = 0;
+
+  /**
+   * 下一条事件的序号
+   */
+  std::atomic<uint64_t> seq_{0};
+
+  /**
+   * 写出时持有，保护 start_
+   */
+  std::mutex dump_mutex_;
+
+  /**
+   * 尚未写出的第一条事件的序号
+   */
+  uint64_t start_ = 0;
+
+  /**
+   * 是否有推迟的写出，及其中最后一次触发的原因
+   */
+  std::atomic<bool> pending_{false};
+  std::atomic<char const*> pending_reason_{nullptr};
+
+  /**
+   * 上次写出以来的触发次数
+   */
+  std::atomic<uint64_t> triggers_{0};
+
+  /**
+   * 下一次允许写出的时刻
+   */
+  std::atomic<std::chrono::steady_clock::duration> next_dump_{
+      std::chrono::steady_clock::duration::zero()};
+};
+
+/**
+ * 可以被多个线程同时读取与替换的共享指针
+ * 读取者持有的副本使对象在替换后仍然有效，最后一个副本释放时才销毁对象
+ */
+template <typename T>
+class SharedSlot {
+ public:
+  std::shared_ptr<T> Load() const {
+#if __cpp_lib_atomic_shared_ptr
+    return ptr_.load(std::memory_order_acquire);
+#else
+    return std::atomic_load_explicit(&ptr_, std::memory_order_acquire);
+#endif
+  }
+
+  std::shared_ptr<T> Exchange(std::shared_ptr<T> ptr) {
+#if __cpp_lib_atomic_shared_ptr
+    return ptr_.exchange(std::move(ptr), std::memory_order_acq_rel);
+#else
+    return std::atomic_exchange_explicit(&ptr_, std::move(ptr),
+                                         std::memory_order_acq_rel);
+#endif
+  }
+
+ private:
+#if __cpp_lib_atomic_shared_ptr
+  std::atomic<std::shared_ptr<T>> ptr_;
+#else
+  std::shared_ptr<T> ptr_;
+#endif
+};
+
+/**
+ * 当前的记录状态
+ * 流水线化的词法单元流在后台线程中分析，记录事件与 Open、Close 可能同时发生，
+ * 因此记录格式与记录器都以原子方式读取和替换
+ */
+struct Recording {
+  Recording() {
+    if (auto const path = std::getenv("TOYLANG_ANIM_FLIGHT"); path != nullptr) {
+      Anim::FlightOptions options;
+      options.path = path;
+      SwapFlight(std::make_unique<FlightRecorder>(std::move(options)));
+    }
+    if (std::getenv("TOYLANG_ANIM") == nullptr) return;
+
+    if (auto const path = std::getenv("TOYLANG_ANIM_FILE"); path != nullptr) {
+      recorder.Exchange(std::make_shared<BinaryRecorder>(path));
+      format = Anim::Format::kBinary;
+    } else {
+      format = Anim::Format::kJson;
+    }
+  }
+
+  ~Recording() { SwapFlight(nullptr); }
+
+  /**
+   * 替换飞行记录器，等待正在向旧记录器记录事件的线程离开后将其销毁
+   *
+   * 读取者按 epoch 的奇偶登记在两组计数器之一，替换者发布新的记录器后，
+   * 先等待另一组清零，再翻转 epoch 并等待原来的一组清零，
+   * 此后不会再有线程持有旧记录器，与 left-right 同步的做法相同
+   */
+  void SwapFlight(std::unique_ptr<FlightRecorder> recorder) {
+    std::lock_guard<std::mutex> lock{flight_mutex};
+    std::unique_ptr<FlightRecorder> old{flight.exchange(recorder.release())};
+    if (!old) return;
+
+    auto const parity = epoch.load();
+    auto const drain = [&](unsigned parity) {
+      for (auto& stripe : readers) {
+        while (stripe.count[parity].load() != 0) std::this_thread::yield();
+      }
+    };
+    drain(parity ^ 1);
+    epoch.store(parity ^ 1);
+    drain(parity);
+
+    // 推迟的写出已经被触发，停止前写出
+    old->DumpPending(true);
+  }
+
+  std::atomic<Anim::Format> format{Anim::Format::kNone};
+  SharedSlot<BinaryRecorder> recorder;
+
+  /**
+   * 当前的飞行记录器，由 SwapFlight 销毁
+   */
+  std::atomic<FlightRecorder*> flight{nullptr};
+  std::mutex flight_mutex;
+
+  /**
+   * 正在使用飞行记录器的线程数，分散在多个缓存行上以减少争用
+   */
+  struct alignas(64) Stripe {
+    std::atomic<uint32_t> count[2] = {};
+  };
+  Stripe readers[16];
+  std::atomic<unsigned> epoch{0};
+};
+
+Recording& recording() {
+  static Recording recording;
+  return recording;
 }
 
-void Anim::RegexAccept(Regex accept, toylang::regex::LeafNodes const& afters) {
-  auto jaccept = jsonify(accept);
-  jaccept["afters"] =
-      std::accumulate(afters.begin(), afters.end(), nlohmann::json::array(),
-                      [](nlohmann::json& acc, auto const& it) {
-                        acc.push_back(hex(it));
-                        return acc;
-                      });
-  anim({
-      {"$", "RegexAccept"},
-      {"accept", jaccept},
+/**
+ * 二进制格式的记录器，未以二进制格式记录时为空
+ * 返回的副本保证记录期间记录器不会被 Close 销毁
+ */
+std::shared_ptr<BinaryRecorder> binary() {
+  if (recording().format != Anim::Format::kBinary) return nullptr;
+  return recording().recorder.Load();
+}
+
+/**
+ * 是否以 JSON 格式记录
+ */
+bool json() { return recording().format == Anim::Format::kJson; }
+
+/**
+ * 向飞行记录器记录事件
+ */
+template <typename F>
+void with_flight(F&& use) {
+  auto& r = recording();
+  if (r.flight.load(std::memory_order_relaxed) == nullptr) return;
+
+  // 每个线程固定使用一组计数器
+  static std::atomic<unsigned> next{0};
+  thread_local auto const index =
+      next.fetch_add(1, std::memory_order_relaxed) % std::size(r.readers);
+  auto& stripe = r.readers[index];
+  auto const parity = r.epoch.load();
+  stripe.count[parity].fetch_add(1);
+  if (auto const recorder = r.flight.load()) use(*recorder);
+  stripe.count[parity].fetch_sub(1, std::memory_order_release);
+}
+
+void flight(Anim::Event event, int64_t a = 0, int64_t b = 0, int64_t c = 0,
+            int64_t d = 0) {
+  with_flight([&](FlightRecorder& recorder) {
+    recorder.Record(event, a, b, c, d);
   });
 }
 
+/**
+ * 节点地址作为飞行记录器的字段
+ */
+int64_t address(void const* ptr) { return reinterpret_cast<intptr_t>(ptr); }
+
+}  // namespace
+
+void Anim::Open(Format format, std::string const& path) {
+  Close();
+  if (format == Format::kBinary) {
+    recording().recorder.Exchange(std::make_shared<BinaryRecorder>(path));
+  }
+  recording().format = format;
+}
+
+void Anim::Close() {
+  recording().format = Format::kNone;
+  // 其他线程仍持有记录器时，由最后一个持有者写出剩余的事件
+  recording().recorder.Exchange(nullptr);
+}
+
+bool Anim::Enabled() { return recording().format != Format::kNone; }
+
+void Anim::StartFlight(FlightOptions options) {
+  recording().SwapFlight(std::make_unique<FlightRecorder>(std::move(options)));
+}
+
+void Anim::StopFlight() { recording().SwapFlight(nullptr); }
+
+void Anim::DumpFlight(std::string const& reason) {
+  with_flight([&](FlightRecorder& recorder) { recorder.DumpNow(reason); });
+}
+
+void Anim::DumpFlightOnSignal(int signo) {
+  std::signal(signo, [](int) { flight_signaled = 1; });
+}
+
+void Anim::RegexCompile(std::string const& pattern, Regex regex) {
+  flight(Event::kRegexCompile, address(regex.get()));
+  if (auto recorder = binary()) {
+    recorder->Emit(kTagRegexCompile, [&](BinaryRecorder& r) {
+      r.String(pattern);
+      r.Node(regex);
+    });
+  } else if (json()) {
+    anim({
+        {"$", "RegexCompile"},
+        {"pattern", pattern},
+        {"regex", jsonify(regex)},
+    });
+  }
+}
+
+void Anim::RegexAccept(Regex accept, Regex regex) {
+  flight(Event::kRegexAccept, address(accept.get()),
+         static_cast<regex::AcceptNode&>(*accept).token_id_);
+  if (!Enabled()) return;
+
+  regex::Arena arena;
+  auto const root = arena.Lower(regex);
+  arena.Analyze();
+  auto const& afters = arena.LastposOf(root);
+
+  if (auto recorder = binary()) {
+    recorder->Emit(kTagRegexAccept, [&](BinaryRecorder& r) {
+      r.Node(accept);
+      r.Varint(afters.size());
+      for (auto const pos : afters) r.Varint(r.Ref(arena.OriginOf(pos)));
+    });
+  } else {
+    auto jaccept = jsonify(accept);
+    jaccept["afters"] = jsonify(arena, afters);
+    anim({
+        {"$", "RegexAccept"},
+        {"accept", jaccept},
+    });
+  }
+}
+
 void Anim::RegexUnion(Regex unode) {
-  anim({
-      {"$", "RegexUnion"},
-      {"union", hex(unode)},
-      {"lhs", hex(to<regex::UnionNode>(unode)->left_)},
-      {"rhs", hex(to<regex::UnionNode>(unode)->right_)},
-  });
+  auto const& node = static_cast<regex::UnionNode&>(*unode);
+  flight(Event::kRegexUnion, address(unode.get()), address(node.left_.get()),
+         address(node.right_.get()));
+  if (auto recorder = binary()) {
+    recorder->Emit(kTagRegexUnion, [&](BinaryRecorder& r) {
+      r.Varint(r.Ref(unode.get()));
+      r.Varint(r.Ref(node.left_.get()));
+      r.Varint(r.Ref(node.right_.get()));
+    });
+  } else if (json()) {
+    anim({
+        {"$", "RegexUnion"},
+        {"union", hex(unode)},
+        {"lhs", hex(node.left_)},
+        {"rhs", hex(node.right_)},
+    });
+  }
+}
+
+void Anim::RegexSimplify(Regex regex, Regex simplified) {
+  flight(Event::kRegexSimplify, address(regex.get()),
+         address(simplified.get()));
+  if (auto recorder = binary()) {
+    recorder->Emit(kTagRegexSimplify, [&](BinaryRecorder& r) {
+      r.Varint(r.Ref(regex.get()));
+      r.Node(simplified);
+    });
+  } else if (json()) {
+    anim({
+        {"$", "RegexSimplify"},
+        {"origin", hex(regex)},
+        {"regex", jsonify(simplified)},
+    });
+  }
 }
 
 void Anim::LexiconAddToken(int id, std::string const& name) {
-  anim({
-      {"$", "LexiconAddToken"},
-      {"id", id},
-      {"name", name},
-  });
+  flight(Event::kLexiconAddToken, id);
+  if (auto recorder = binary()) {
+    recorder->Emit(kTagLexiconAddToken, [&](BinaryRecorder& r) {
+      r.Signed(id);
+      r.String(name);
+    });
+  } else if (json()) {
+    anim({
+        {"$", "LexiconAddToken"},
+        {"id", id},
+        {"name", name},
+    });
+  }
 }
-void Anim::LexiconAddState(int id, regex::LeafNodes const& poses) {
-  anim({
-      {"$", "LexiconAddState"},
-      {"id", id},
-      {"poses",
-       std::accumulate(poses.begin(), poses.end(), nlohmann::json::array(),
-                       [](nlohmann::json& acc, auto const& it) {
-                         acc.push_back(hex(it));
-                         return acc;
-                       })},
-  });
+void Anim::LexiconAddState(int id, regex::Arena const& arena,
+                           regex::Arena::Positions const& poses) {
+  flight(Event::kLexiconAddState, id, poses.size());
+  if (auto recorder = binary()) {
+    recorder->Emit(kTagLexiconAddState, [&](BinaryRecorder& r) {
+      r.Signed(id);
+      r.Varint(poses.size());
+      for (auto const pos : poses) r.Varint(r.Ref(arena.OriginOf(pos)));
+    });
+  } else if (json()) {
+    anim({
+        {"$", "LexiconAddState"},
+        {"id", id},
+        {"poses", jsonify(arena, poses)},
+    });
+  }
 }
 void Anim::LexiconAddTransfer(int from, int to, int input) {
-  anim({
-      {"$", "LexiconAddTransfer"},
-      {"from", from},
-      {"to", to},
-      {"input", input},
-  });
+  flight(Event::kLexiconAddTransfer, from, to, input);
+  if (auto recorder = binary()) {
+    recorder->Emit(kTagLexiconAddTransfer, [&](BinaryRecorder& r) {
+      r.Signed(from);
+      r.Signed(to);
+      r.Signed(input);
+    });
+  } else if (json()) {
+    anim({
+        {"$", "LexiconAddTransfer"},
+        {"from", from},
+        {"to", to},
+        {"input", input},
+    });
+  }
 }
 void Anim::LexiconSetAccept(int id, int token) {
-  anim({
-      {"$", "LexiconSetAccept"},
-      {"id", id},
-      {"token", token},
-  });
+  flight(Event::kLexiconSetAccept, id, token);
+  if (auto recorder = binary()) {
+    recorder->Emit(kTagLexiconSetAccept, [&](BinaryRecorder& r) {
+      r.Signed(id);
+      r.Signed(token);
+    });
+  } else if (json()) {
+    anim({
+        {"$", "LexiconSetAccept"},
+        {"id", id},
+        {"token", token},
+    });
+  }
 }
 void Anim::ScannerSetSource(std::string const& source) {
-  anim({
-      {"$", "ScannerSetSource"},
-      {"source", source},
-  });
+  flight(Event::kScannerSetSource, source.size());
+  if (auto recorder = binary()) {
+    auto const hash = recorder->DefineSource(source);
+    recorder->Emit(kTagScannerSetSource,
+                   [&](BinaryRecorder& r) { r.Varint(hash); });
+  } else if (json()) {
+    anim({
+        {"$", "ScannerSetSource"},
+        {"source", source},
+    });
+  }
+}
+void Anim::ScannerEditSource(size_t offset, size_t removed,
+                             std::string const& inserted) {
+  flight(Event::kScannerEditSource, offset, removed, inserted.size());
+  if (auto recorder = binary()) {
+    recorder->Emit(kTagScannerEditSource, [&](BinaryRecorder& r) {
+      r.Varint(offset);
+      r.Varint(removed);
+      r.Bytes(inserted);
+    });
+  } else if (json()) {
+    anim({
+        {"$", "ScannerEditSource"},
+        {"offset", offset},
+        {"removed", removed},
+        {"inserted", inserted},
+    });
+  }
 }
 void Anim::ScannerSetState(int state) {
-  anim({
-      {"$", "ScannerSetState"},
-      {"state", state},
-  });
+  flight(Event::kScannerSetState, state);
+  if (auto recorder = binary()) {
+    recorder->Emit(kTagScannerSetState,
+                   [&](BinaryRecorder& r) { r.Signed(state); });
+  } else if (json()) {
+    anim({
+        {"$", "ScannerSetState"},
+        {"state", state},
+    });
+  }
 }
 void Anim::ScannerNextInput() {
-  anim({
-      {"$", "ScannerNextInput"},
-  });
+  flight(Event::kScannerNextInput);
+  if (auto recorder = binary()) {
+    recorder->Emit(kTagScannerNextInput, [](BinaryRecorder&) {});
+  } else if (json()) {
+    anim({
+        {"$", "ScannerNextInput"},
+    });
+  }
 }
 void Anim::ScannerNextLine() {
-  anim({
-      {"$", "ScannerNextLine"},
-  });
+  flight(Event::kScannerNextLine);
+  if (auto recorder = binary()) {
+    recorder->Emit(kTagScannerNextLine, [](BinaryRecorder&) {});
+  } else if (json()) {
+    anim({
+        {"$", "ScannerNextLine"},
+    });
+  }
 }
 void Anim::ScannerAcceptToken(Token const& token) {
-  anim({
-      {"$", "ScannerAcceptToken"},
-      {"token", jsonify(token)},
-  });
+  flight(Event::kScannerAcceptToken, token.id, token.offset, token.length,
+         token.start_line);
+  if (auto recorder = binary()) {
+    // 词法单元的文本可以从源码中取得，不必记录
+    recorder->Emit(kTagScannerAcceptToken, [&](BinaryRecorder& r) {
+      r.Signed(token.id);
+      r.String(token.NameOf());
+      r.Varint(token.offset);
+      r.Varint(token.length);
+      r.Varint(token.start_line);
+      r.Varint(token.start_column);
+      r.Varint(token.end_line);
+      r.Varint(token.end_column);
+    });
+  } else if (json()) {
+    anim({
+        {"$", "ScannerAcceptToken"},
+        {"token", jsonify(token)},
+    });
+  }
+}
+
+void Anim::Convert(std::istream& in, std::ostream& out) {
+  std::string magic(sizeof(kMagic) - 1, '\0');
+  if (!in.read(magic.data(), magic.size()) || magic != kMagic) {
+    throw std::runtime_error{"Convert: not an anim record"};
+  }
+
+  BinaryDecoder decoder{in};
+  std::string source;
+  std::unordered_map<uint64_t, std::string> sources;
+  auto const emit = [&](nlohmann::json const& json) {
+    out << "ANIM: "
+        << json.dump(-1, ' ', false, nlohmann::json::error_handler_t::replace)
+        << '\n';
+  };
+  auto const refs = [&]() {
+    auto json = nlohmann::json::array();
+    for (auto count = decoder.Varint(); count > 0; count--) {
+      json.push_back(hex(decoder.Varint()));
+    }
+    return json;
+  };
+
+  while (in.peek() != std::char_traits<char>::eof()) {
+    switch (decoder.Varint()) {
+      case kTagSource: {
+        auto const hash = decoder.Varint();
+        sources[hash] = decoder.Bytes();
+      } break;
+      case kTagRegexCompile: {
+        auto const pattern = decoder.String();
+        emit({
+            {"$", "RegexCompile"},
+            {"pattern", pattern},
+            {"regex", decoder.Node()},
+        });
+      } break;
+      case kTagRegexAccept: {
+        auto accept = decoder.Node();
+        accept["afters"] = refs();
+        emit({
+            {"$", "RegexAccept"},
+            {"accept", accept},
+        });
+      } break;
+      case kTagRegexUnion: {
+        auto const unode = hex(decoder.Varint());
+        auto const lhs = hex(decoder.Varint());
+        auto const rhs = hex(decoder.Varint());
+        emit({
+            {"$", "RegexUnion"},
+            {"union", unode},
+            {"lhs", lhs},
+            {"rhs", rhs},
+        });
+      } break;
+      case kTagRegexSimplify: {
+        auto const origin = hex(decoder.Varint());
+        emit({
+            {"$", "RegexSimplify"},
+            {"origin", origin},
+            {"regex", decoder.Node()},
+        });
+      } break;
+      case kTagLexiconAddToken: {
+        auto const id = decoder.Signed();
+        emit({
+            {"$", "LexiconAddToken"},
+            {"id", id},
+            {"name", decoder.String()},
+        });
+      } break;
+      case kTagLexiconAddState: {
+        auto const id = decoder.Signed();
+        emit({
+            {"$", "LexiconAddState"},
+            {"id", id},
+            {"poses", refs()},
+        });
+      } break;
+      case kTagLexiconAddTransfer: {
+        auto const from = decoder.Signed();
+        auto const to = decoder.Signed();
+        auto const input = decoder.Signed();
+        emit({
+            {"$", "LexiconAddTransfer"},
+            {"from", from},
+            {"to", to},
+            {"input", input},
+        });
+      } break;
+      case kTagLexiconSetAccept: {
+        auto const id = decoder.Signed();
+        auto const token = decoder.Signed();
+        emit({
+            {"$", "LexiconSetAccept"},
+            {"id", id},
+            {"token", token},
+        });
+      } break;
+      case kTagScannerSetSource:
+        source = sources.at(decoder.Varint());
+        emit({
+            {"$", "ScannerSetSource"},
+            {"source", source},
+        });
+        break;
+      case kTagScannerEditSource: {
+        auto const offset = decoder.Varint();
+        auto const removed = decoder.Varint();
+        auto const inserted = decoder.Bytes();
+        if (offset > source.size()) {
+          throw std::runtime_error{"Convert: edit out of range"};
+        }
+        source.replace(offset, removed, inserted);
+        emit({
+            {"$", "ScannerEditSource"},
+            {"offset", offset},
+            {"removed", removed},
+            {"inserted", inserted},
+        });
+      } break;
+      case kTagScannerSetState: {
+        auto const state = decoder.Signed();
+        emit({
+            {"$", "ScannerSetState"},
+            {"state", state},
+        });
+      } break;
+      case kTagScannerNextInput:
+        emit({
+            {"$", "ScannerNextInput"},
+        });
+        break;
+      case kTagScannerNextLine:
+        emit({
+            {"$", "ScannerNextLine"},
+        });
+        break;
+      case kTagScannerAcceptToken: {
+        auto const id = decoder.Signed();
+        auto const name = decoder.String();
+        auto const offset = decoder.Varint();
+        auto const length = decoder.Varint();
+        auto const start_line = decoder.Varint();
+        auto const start_column = decoder.Varint();
+        auto const end_line = decoder.Varint();
+        auto const end_column = decoder.Varint();
+        emit({
+            {"$", "ScannerAcceptToken"},
+            {"token",
+             {
+                 {"id", id},
+                 {"name", name},
+                 {"offset", offset},
+                 {"length", length},
+                 {"start_line", start_line},
+                 {"start_column", start_column},
+                 {"end_line", end_line},
+                 {"end_column", end_column},
+                 {"text", source.substr(offset, length)},
+             }},
+        });
+      } break;
+      default:
+        throw std::runtime_error{"Convert: unknown event"};
+    }
+  }
 }
 
 int Anim::main(int, char**) {
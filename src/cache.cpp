@@ -0,0 +1,303 @@
+#include "toylang/cache.h"
+
+#include <cstring>
+#include <filesystem>
+#include <fstream>
+#include <random>
+#include <stdexcept>
+#include <system_error>
+
+#include "spdlog/fmt/fmt.h"
+
+#if defined(__unix__)
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#define TOYLANG_CACHE_MMAP 1
+#endif
+
+namespace toylang {
+
+namespace {
+
+/**
+ * 缓存文件的文件头
+ */
+constexpr char kMagic[] = "TLTOKS2\n";
+constexpr size_t kMagicSize = sizeof(kMagic) - 1;
+
+/**
+ * 源码内容的哈希值，每次处理8个字节
+ */
+uint64_t HashOf(std::string_view content, uint64_t seed) {
+  constexpr uint64_t kMultiplier = 0x9e3779b97f4a7c15ULL;
+  auto hash = seed ^ (content.size() * kMultiplier);
+  size_t i = 0;
+  for (; i + 8 <= content.size(); i += 8) {
+    uint64_t word;
+    std::memcpy(&word, content.data() + i, sizeof(word));
+    hash = (hash ^ word) * kMultiplier;
+    hash ^= hash >> 32;
+  }
+  for (; i < content.size(); i++) {
+    hash = (hash ^ static_cast<unsigned char>(content[i])) * kMultiplier;
+  }
+  return hash ^ (hash >> 29);
+}
+
+void PutVarint(std::string& out, uint64_t value) {
+  while (value >= 0x80) {
+    out.push_back(static_cast<char>(value | 0x80));
+    value >>= 7;
+  }
+  out.push_back(static_cast<char>(value));
+}
+
+/**
+ * 从缓存文件中依次读取变长整数，越界时抛出异常
+ */
+class Reader {
+ public:
+  explicit Reader(std::string_view data) : data_{data} {}
+
+  uint64_t Varint() {
+    uint64_t value = 0;
+    for (int shift = 0; shift < 64; shift += 7) {
+      if (pos_ >= data_.size()) {
+        throw std::runtime_error{"TokenCache: unexpected end of file"};
+      }
+      auto const byte = static_cast<uint8_t>(data_[pos_++]);
+      value |= static_cast<uint64_t>(byte & 0x7f) << shift;
+      if (!(byte & 0x80)) return value;
+    }
+    throw std::runtime_error{"TokenCache: varint too long"};
+  }
+
+  int64_t Signed() {
+    auto const value = Varint();
+    return static_cast<int64_t>(value >> 1) ^ -static_cast<int64_t>(value & 1);
+  }
+
+  bool Done() const { return pos_ == data_.size(); }
+
+ private:
+  std::string_view data_;
+  size_t pos_ = 0;
+};
+
+/**
+ * 源码中的位置，行号与列号的计算方式与 Scanner 相同
+ */
+struct Cursor {
+  std::string_view content;
+  size_t offset = 0;
+  size_t line = 1;
+  size_t column = 1;
+
+  /**
+   * 前进到 end，只查找换行符而不逐字节计数
+   */
+  void AdvanceTo(size_t end) {
+    auto const begin = offset;
+    char const* last = nullptr;
+    auto it = content.data() + begin;
+    auto const stop = content.data() + end;
+    while (it < stop) {
+      auto const found =
+          static_cast<char const*>(std::memchr(it, '\n', stop - it));
+      if (!found) break;
+      line++;
+      last = found;
+      it = found + 1;
+    }
+    column = last ? stop - last : column + (end - begin);
+    offset = end;
+  }
+};
+
+/**
+ * 解码缓存文件，文件与源码不符时抛出异常
+ */
+std::vector<Token> Decode(std::string_view data,
+                          std::shared_ptr<Lexicon const> const& lexicon,
+                          std::shared_ptr<Source const> const& source,
+                          int context) {
+  if (data.substr(0, kMagicSize) != std::string_view{kMagic, kMagicSize}) {
+    throw std::runtime_error{"TokenCache: bad magic"};
+  }
+  Reader reader{data.substr(kMagicSize)};
+  auto const& content = source->content;
+  if (reader.Varint() != lexicon->Fingerprint() ||
+      reader.Varint() != content.size() ||
+      reader.Varint() != HashOf(content, 0) ||
+      reader.Varint() != static_cast<uint64_t>(context)) {
+    throw std::runtime_error{"TokenCache: stale entry"};
+  }
+
+  auto const count = reader.Varint();
+  if (count > content.size()) {
+    throw std::runtime_error{"TokenCache: too many tokens"};
+  }
+
+  std::vector<Token> tokens;
+  tokens.reserve(count);
+  Cursor cursor{.content = content};
+  int64_t id = 0;
+  for (uint64_t i = 0; i < count; i++) {
+    id += reader.Signed();
+    auto const gap = reader.Varint();
+    auto const length = reader.Varint();
+    auto const lookahead = reader.Varint();
+    if (id < Token::kError || id == Token::kEOF ||
+        id > lexicon->CountTokens()) {
+      throw std::runtime_error{"TokenCache: invalid token id"};
+    }
+    if (gap > content.size() - cursor.offset ||
+        length == 0 || length > content.size() - cursor.offset - gap) {
+      throw std::runtime_error{"TokenCache: token out of range"};
+    }
+    cursor.AdvanceTo(cursor.offset + gap);
+
+    auto& token = tokens.emplace_back(Token{
+        .id = static_cast<int>(id),
+        .start_line = cursor.line,
+        .start_column = cursor.column,
+        .end_line = 0,
+        .end_column = 0,
+        .offset = cursor.offset,
+        .length = length,
+        .source = source,
+        .lexicon = lexicon,
+        .context = context,
+        .lookahead = lookahead,
+        .symbol = SymbolPool::kNone,
+    });
+    // 结束位置是最后一个字节的位置
+    cursor.AdvanceTo(cursor.offset + length - 1);
+    token.end_line = cursor.line;
+    token.end_column = cursor.column;
+    cursor.AdvanceTo(cursor.offset + 1);
+  }
+  if (!reader.Done()) throw std::runtime_error{"TokenCache: trailing data"};
+  return tokens;
+}
+
+}  // namespace
+
+TokenCache::TokenCache(std::string directory)
+    : directory_{std::move(directory)} {}
+
+std::vector<Token> TokenCache::Scan(
+    std::shared_ptr<Lexicon const> const& lexicon,
+    std::shared_ptr<Source const> const& source, std::string const& context) {
+  auto const context_id = lexicon->IdOfContext(context);
+  auto const path = PathOf(*lexicon, *source, context_id);
+  if (auto loaded = Load(path, lexicon, source, context_id)) {
+    stats_.hits++;
+    return std::move(*loaded);
+  }
+  stats_.misses++;
+
+  Scanner scanner;
+  scanner.SetLexicon(lexicon);
+  scanner.SetSource(source);
+  scanner.SetContext(context_id);
+  std::vector<Token> tokens;
+  for (auto token = scanner.NextToken(); token.id != Token::kEOF;
+       token = scanner.NextToken()) {
+    tokens.push_back(std::move(token));
+  }
+
+  Store(path, *lexicon, *source, context_id, tokens);
+  return tokens;
+}
+
+std::string TokenCache::PathOf(Lexicon const& lexicon, Source const& source,
+                               int context) const {
+  auto const seed =
+      lexicon.Fingerprint() ^ (static_cast<uint64_t>(context) << 48);
+  auto const name = fmt::format("{:016x}.tok", HashOf(source.content, seed));
+  return (std::filesystem::path{directory_} / name).string();
+}
+
+std::optional<std::vector<Token>> TokenCache::Load(
+    std::string const& path, std::shared_ptr<Lexicon const> const& lexicon,
+    std::shared_ptr<Source const> const& source, int context) const {
+#ifdef TOYLANG_CACHE_MMAP
+  auto const fd = open(path.c_str(), O_RDONLY);
+  if (fd < 0) return std::nullopt;
+  struct stat info;
+  if (fstat(fd, &info) != 0 || info.st_size == 0) {
+    close(fd);
+    return std::nullopt;
+  }
+  auto const size = static_cast<size_t>(info.st_size);
+  auto const memory = mmap(nullptr, size, PROT_READ, MAP_PRIVATE, fd, 0);
+  close(fd);
+  if (memory == MAP_FAILED) return std::nullopt;
+
+  std::optional<std::vector<Token>> tokens;
+  try {
+    tokens = Decode({static_cast<char const*>(memory), size}, lexicon, source,
+                    context);
+  } catch (std::runtime_error const&) {
+  }
+  munmap(memory, size);
+  return tokens;
+#else
+  std::ifstream file{path, std::ios::binary};
+  if (!file.is_open()) return std::nullopt;
+  std::string data{std::istreambuf_iterator<char>{file},
+                   std::istreambuf_iterator<char>{}};
+  try {
+    return Decode(data, lexicon, source, context);
+  } catch (std::runtime_error const&) {
+    return std::nullopt;
+  }
+#endif
+}
+
+void TokenCache::Store(std::string const& path, Lexicon const& lexicon,
+                       Source const& source, int context,
+                       std::vector<Token> const& tokens) const {
+  std::string data{kMagic, kMagicSize};
+  PutVarint(data, lexicon.Fingerprint());
+  PutVarint(data, source.content.size());
+  PutVarint(data, HashOf(source.content, 0));
+  PutVarint(data, context);
+  PutVarint(data, tokens.size());
+
+  int64_t id = 0;
+  size_t end = 0;
+  for (auto const& token : tokens) {
+    auto const delta = static_cast<int64_t>(token.id) - id;
+    PutVarint(data, (static_cast<uint64_t>(delta) << 1) ^
+                        (delta < 0 ? ~0ULL : 0ULL));
+    PutVarint(data, token.offset - end);
+    PutVarint(data, token.length);
+    PutVarint(data, token.lookahead);
+    id = token.id;
+    end = token.offset + token.length;
+  }
+
+  // 先写入同一目录下的临时文件，再以重命名原子地替换
+  std::error_code error;
+  std::filesystem::create_directories(directory_, error);
+  if (error) return;
+  auto const temp = fmt::format("{}.{:x}.tmp", path,
+                                std::random_device{}() ^
+                                    reinterpret_cast<uintptr_t>(&data));
+  {
+    std::ofstream file{temp, std::ios::binary | std::ios::trunc};
+    if (!file.write(data.data(), data.size()) || !file.flush()) {
+      file.close();
+      std::filesystem::remove(temp, error);
+      return;
+    }
+  }
+  std::filesystem::rename(temp, path, error);
+  if (error) std::filesystem::remove(temp, error);
+}
+
+}  // namespace toylang
@@ -0,0 +1,298 @@
+#include "toylang/coroutine.h"
+
+#if __cplusplus >= 202002L
+
+#include <fcntl.h>
+#include <sys/epoll.h>
+#include <sys/eventfd.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+#include <cerrno>
+#include <condition_variable>
+#include <deque>
+#include <mutex>
+#include <stdexcept>
+#include <system_error>
+#include <thread>
+#include <vector>
+
+namespace toylang {
+
+namespace {
+
+/**
+ * 等待文件描述符可读
+ */
+struct Readable {
+  Poller& poller;
+  int fd;
+
+  bool await_ready() const noexcept { return false; }
+  void await_suspend(std::coroutine_handle<> handle) {
+    poller.WatchReadable(fd, handle);
+  }
+  void await_resume() const noexcept {}
+};
+
+}  // namespace
+
+EpollPoller::EpollPoller() : epoll_{epoll_create1(EPOLL_CLOEXEC)}, waiting_{0} {
+  if (epoll_ < 0) throw std::system_error(errno, std::system_category());
+}
+
+EpollPoller::~EpollPoller() { close(epoll_); }
+
+void EpollPoller::WatchReadable(int fd, std::coroutine_handle<> handle) {
+  epoll_event event{};
+  event.events = EPOLLIN | EPOLLONESHOT;
+  event.data.ptr = handle.address();
+
+  // 单次触发的文件描述符需要重新激活，首次等待时才需要添加
+  if (epoll_ctl(epoll_, EPOLL_CTL_MOD, fd, &event) < 0) {
+    if (errno != ENOENT || epoll_ctl(epoll_, EPOLL_CTL_ADD, fd, &event) < 0)
+      throw std::system_error(errno, std::system_category());
+  }
+  waiting_++;
+}
+
+size_t EpollPoller::Poll(int timeout) {
+  if (waiting_ == 0) return 0;
+
+  epoll_event events[16];
+  auto count = epoll_wait(epoll_, events, 16, timeout);
+  if (count < 0) {
+    if (errno == EINTR) return 0;
+    throw std::system_error(errno, std::system_category());
+  }
+
+  for (auto i = 0; i < count; i++) {
+    waiting_--;
+    std::coroutine_handle<>::from_address(events[i].data.ptr).resume();
+  }
+  return count;
+}
+
+/**
+ * ReadPool
+ *
+ * 在少量后台线程中读取不支持非阻塞读取的文件描述符，由同一 Poller 上的读取器共享
+ * 读取完成后写入唯一的 eventfd，由一个等待该 eventfd 的协程在 Poller 所在的线程中
+ * 恢复完成读取的协程
+ */
+class ReadPool {
+ public:
+  /**
+   * 一次读取请求，由线程池与等待者共同持有，等待者被销毁时缓冲区仍然有效
+   */
+  struct Request {
+    int fd = -1;
+    std::string buffer;
+    std::coroutine_handle<> handle;
+    ssize_t result = 0;
+    int error = 0;
+  };
+
+  /**
+   * 等待一次读取完成
+   */
+  struct Awaiter {
+    ReadPool& pool;
+    std::shared_ptr<Request> request;
+
+    bool await_ready() const noexcept { return false; }
+    void await_suspend(std::coroutine_handle<> handle) {
+      request->handle = handle;
+      pool.Submit(request);
+    }
+    std::string await_resume() {
+      if (request->result < 0)
+        throw std::system_error(request->error, std::system_category());
+      request->buffer.resize(request->result);
+      return std::move(request->buffer);
+    }
+  };
+
+  explicit ReadPool(Poller& poller)
+      : poller_{poller}, event_{eventfd(0, EFD_CLOEXEC | EFD_NONBLOCK)} {
+    if (event_ < 0) throw std::system_error(errno, std::system_category());
+  }
+
+  ~ReadPool() {
+    {
+      std::lock_guard<std::mutex> lock{mutex_};
+      stop_ = true;
+    }
+    cv_.notify_all();
+    for (auto& thread : threads_) thread.join();
+    close(event_);
+  }
+
+  /**
+   * 读取至多 size 个字节
+   */
+  Awaiter Read(int fd, size_t size) {
+    auto request = std::make_shared<Request>();
+    request->fd = fd;
+    request->buffer.resize(size);
+    return {*this, std::move(request)};
+  }
+
+ private:
+  void Submit(std::shared_ptr<Request> request) {
+    {
+      std::lock_guard<std::mutex> lock{mutex_};
+      queue_.push_back(std::move(request));
+      // 没有空闲线程时才增加线程，总数不超过上限
+      if (idle_ == 0 && threads_.size() < Poller::kMaxReadThreads)
+        threads_.emplace_back([this] { Run(); });
+    }
+    cv_.notify_one();
+
+    outstanding_++;
+    if (!draining_) {
+      draining_ = true;
+      drain_.emplace(Drain());
+      drain_->Start();
+    }
+  }
+
+  /**
+   * 等待 eventfd 并恢复完成读取的协程，直到没有未完成的读取
+   */
+  Task<int> Drain() {
+    while (outstanding_ > 0) {
+      co_await Readable{poller_, event_};
+      uint64_t count;
+      while (::read(event_, &count, sizeof(count)) < 0 && errno == EINTR) {
+      }
+
+      std::vector<std::shared_ptr<Request>> completed;
+      {
+        std::lock_guard<std::mutex> lock{mutex_};
+        completed.swap(completed_);
+      }
+      // 恢复的协程可能提交新的读取，outstanding_ 随之增加
+      for (auto const& request : completed) {
+        outstanding_--;
+        request->handle.resume();
+      }
+    }
+    draining_ = false;
+    co_return 0;
+  }
+
+  void Run() {
+    std::unique_lock<std::mutex> lock{mutex_};
+    while (true) {
+      idle_++;
+      cv_.wait(lock, [this] { return stop_ || !queue_.empty(); });
+      idle_--;
+      if (stop_) return;
+      auto const request = std::move(queue_.front());
+      queue_.pop_front();
+
+      lock.unlock();
+      ssize_t size;
+      do {
+        size = ::read(request->fd, request->buffer.data(),
+                      request->buffer.size());
+      } while (size < 0 && errno == EINTR);
+      request->result = size;
+      request->error = errno;
+      lock.lock();
+
+      completed_.push_back(request);
+      uint64_t const one = 1;
+      while (::write(event_, &one, sizeof(one)) < 0 && errno == EINTR) {
+      }
+    }
+  }
+
+  Poller& poller_;
+  int event_;
+
+  std::mutex mutex_;
+  std::condition_variable cv_;
+  std::vector<std::thread> threads_;
+  std::deque<std::shared_ptr<Request>> queue_;
+  std::vector<std::shared_ptr<Request>> completed_;
+  size_t idle_ = 0;
+  bool stop_ = false;
+
+  /**
+   * 以下成员只在 Poller 所在的线程中访问
+   */
+  size_t outstanding_ = 0;
+  bool draining_ = false;
+  std::optional<Task<int>> drain_;
+};
+
+Poller::Poller() = default;
+
+Poller::~Poller() = default;
+
+ReadPool& Poller::Reads() {
+  if (!reads_) reads_ = std::make_unique<ReadPool>(*this);
+  return *reads_;
+}
+
+AsyncReader::AsyncReader(Poller& poller, int fd, size_t chunk)
+    : poller_{poller}, fd_{fd}, chunk_{chunk}, flags_{fcntl(fd, F_GETFL)} {
+  // 普通文件总是可读，read 不会返回 EAGAIN，epoll 也不接受它们，
+  // 只能交给 Poller 的线程池读取
+  struct stat info;
+  pooled_ = fstat(fd_, &info) == 0 &&
+            (S_ISREG(info.st_mode) || S_ISBLK(info.st_mode));
+  if (!pooled_ && flags_ >= 0) fcntl(fd_, F_SETFL, flags_ | O_NONBLOCK);
+}
+
+AsyncReader::~AsyncReader() {
+  // 文件描述可能被复制后由其它持有者共享，关闭前恢复原来的标志
+  if (!pooled_ && flags_ >= 0) fcntl(fd_, F_SETFL, flags_);
+  close(fd_);
+}
+
+Task<std::string> AsyncReader::Read() {
+  if (pooled_) co_return co_await poller_.Reads().Read(fd_, chunk_);
+
+  std::string chunk(chunk_, '\0');
+  while (true) {
+    auto const size = read(fd_, chunk.data(), chunk.size());
+    if (size >= 0) {
+      chunk.resize(size);
+      co_return chunk;
+    }
+
+    if (errno == EAGAIN || errno == EWOULDBLOCK) {
+      co_await Readable{poller_, fd_};
+    } else if (errno != EINTR) {
+      throw std::system_error(errno, std::system_category());
+    }
+  }
+}
+
+Generator<Token> Tokens(Scanner& scanner) {
+  for (auto token = scanner.NextToken(); token.id != Token::kEOF;
+       token = scanner.NextToken()) {
+    co_yield token;
+  }
+}
+
+Task<std::shared_ptr<Source const>> LoadAsync(Poller& poller,
+                                              std::string path) {
+  auto const fd = open(path.c_str(), O_RDONLY | O_NONBLOCK | O_CLOEXEC);
+  if (fd < 0) co_return nullptr;
+
+  AsyncReader reader{poller, fd};
+  std::string content;
+  for (auto chunk = co_await reader.Read(); !chunk.empty();
+       chunk = co_await reader.Read()) {
+    content += chunk;
+  }
+  co_return Source::Create(content, path);
+}
+
+}  // namespace toylang
+
+#endif
@@ -0,0 +1,184 @@
+#include "toylang/derivative.h"
+
+#include <algorithm>
+
+namespace toylang::regex {
+
+Derivatives::Derivatives() {
+  Make({kNothing, 0, 0, false});
+  Make({kEmptyString, 0, 0, true});
+  anything_ = Not(kEmpty);
+}
+
+Derivatives::Term Derivatives::Of(Regex const& regex) {
+  switch (regex->type()) {
+    case Node::kAccept:
+      throw std::logic_error("Derivatives: unexpected accept node");
+    case Node::kChar:
+      return Set(static_cast<CharNode&>(*regex).Bits());
+    case Node::kRange:
+      return Set(static_cast<RangeNode&>(*regex).Bits());
+    case Node::kConcat: {
+      auto const& node = static_cast<ConcatNode&>(*regex);
+      return Concat(Of(node.left_), Of(node.right_));
+    }
+    case Node::kUnion: {
+      auto const& node = static_cast<UnionNode&>(*regex);
+      return Combine(kOr, Of(node.left_), Of(node.right_));
+    }
+    case Node::kIntersect: {
+      auto const& node = static_cast<IntersectNode&>(*regex);
+      return Combine(kAnd, Of(node.left_), Of(node.right_));
+    }
+    case Node::kKleene:
+      return Star(Of(static_cast<KleeneNode&>(*regex).child_));
+    case Node::kPositive: {
+      auto const child = Of(static_cast<PositiveNode&>(*regex).child_);
+      return Concat(child, Star(child));
+    }
+    case Node::kOptional:
+      return Combine(kOr, Of(static_cast<OptionalNode&>(*regex).child_),
+                     kEpsilon);
+    case Node::kComplement:
+      return Not(Of(static_cast<ComplementNode&>(*regex).child_));
+  }
+  throw std::logic_error("Derivatives: unknown regex");
+}
+
+Derivatives::Term Derivatives::Derive(Term term, unsigned char input) {
+  auto const key = static_cast<uint64_t>(term) << 8 | input;
+  if (auto it = derived_.find(key); it != derived_.end()) return it->second;
+
+  // items_ 可能在递归中扩容，先复制当前项
+  auto const item = items_[term];
+  Term derived = kEmpty;
+  switch (item.kind) {
+    case kNothing:
+    case kEmptyString:
+      break;
+    case kSet:
+      derived = sets_[item.lhs].Test(input) ? kEpsilon : kEmpty;
+      break;
+    case kConcat:
+      derived = Concat(Derive(item.lhs, input), item.rhs);
+      if (items_[item.lhs].nullable) {
+        derived = Combine(kOr, derived, Derive(item.rhs, input));
+      }
+      break;
+    case kStar:
+      derived = Concat(Derive(item.lhs, input), term);
+      break;
+    case kOr:
+    case kAnd:
+      derived =
+          Combine(item.kind, Derive(item.lhs, input), Derive(item.rhs, input));
+      break;
+    case kNot:
+      derived = Not(Derive(item.lhs, input));
+      break;
+  }
+  derived_.emplace(key, derived);
+  return derived;
+}
+
+Derivatives::Term Derivatives::Make(Item const& item) {
+  auto const [it, created] = ids_.emplace(
+      std::make_tuple(item.kind, item.lhs, item.rhs), items_.size());
+  if (created) items_.push_back(item);
+  return it->second;
+}
+
+Derivatives::Term Derivatives::Set(Charset const& set) {
+  if (set.Empty()) return kEmpty;
+
+  auto const [it, created] = set_ids_.emplace(set, sets_.size());
+  if (created) sets_.push_back(set);
+  return Make({kSet, it->second, 0, false});
+}
+
+Derivatives::Term Derivatives::Concat(Term lhs, Term rhs) {
+  if (lhs == kEmpty || rhs == kEmpty) return kEmpty;
+  if (lhs == kEpsilon) return rhs;
+  if (rhs == kEpsilon) return lhs;
+  if (lhs == anything_ && rhs == anything_) return anything_;
+
+  // 串总是右结合，保证 (r s) t 与 r (s t) 得到同一个项
+  auto const item = items_[lhs];
+  if (item.kind == kConcat) return Concat(item.lhs, Concat(item.rhs, rhs));
+  return Make({kConcat, lhs, rhs,
+               items_[lhs].nullable && items_[rhs].nullable});
+}
+
+Derivatives::Term Derivatives::Star(Term term) {
+  if (term == kEmpty || term == kEpsilon) return kEpsilon;
+  if (items_[term].kind == kStar || term == anything_) return term;
+
+  // 全集的闭包匹配任意串，规范化为 ~kEmpty 以便补集与交集化简
+  auto const& item = items_[term];
+  if (item.kind == kSet && sets_[item.lhs].Count() == 256) return anything_;
+  return Make({kStar, term, 0, true});
+}
+
+Derivatives::Term Derivatives::Not(Term term) {
+  if (items_[term].kind == kNot) return items_[term].lhs;
+  return Make({kNot, term, 0, !items_[term].nullable});
+}
+
+Derivatives::Term Derivatives::Combine(Kind kind, Term lhs, Term rhs) {
+  // 对联合来说 kEmpty 是单位元、anything_ 是零元，对交集来说恰好相反
+  auto const unit = kind == kOr ? kEmpty : anything_;
+  auto const zero = kind == kOr ? anything_ : kEmpty;
+
+  std::vector<Term> operands;
+  std::vector<Term> stack{rhs, lhs};
+  Charset merged;
+  auto has_set = false;
+  while (!stack.empty()) {
+    auto const term = stack.back();
+    stack.pop_back();
+    auto const& item = items_[term];
+    if (item.kind == kind) {
+      stack.push_back(item.rhs);
+      stack.push_back(item.lhs);
+    } else if (term == zero) {
+      return zero;
+    } else if (term != unit) {
+      // 字符集之间直接求并或求交
+      if (item.kind == kSet) {
+        if (!has_set) {
+          merged = sets_[item.lhs];
+        } else if (kind == kOr) {
+          merged |= sets_[item.lhs];
+        } else {
+          merged &= sets_[item.lhs];
+        }
+        has_set = true;
+      } else {
+        operands.push_back(term);
+      }
+    }
+  }
+  if (has_set) {
+    auto const set = Set(merged);
+    if (set == zero) return zero;
+    if (set != unit) operands.push_back(set);
+  }
+
+  std::sort(operands.begin(), operands.end());
+  operands.erase(std::unique(operands.begin(), operands.end()),
+                 operands.end());
+  if (operands.empty()) return unit;
+
+  // 按编号排序后折叠为右深树
+  auto result = operands.back();
+  for (auto i = operands.size() - 1; i-- > 0;) {
+    auto const nullable = kind == kOr ? items_[operands[i]].nullable ||
+                                            items_[result].nullable
+                                      : items_[operands[i]].nullable &&
+                                            items_[result].nullable;
+    result = Make({kind, operands[i], result, nullable});
+  }
+  return result;
+}
+
+}  // namespace toylang::regex
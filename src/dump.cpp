@@ -0,0 +1,252 @@
+#include "toylang/dump.h"
+
+#include <iterator>
+
+#include "spdlog/fmt/fmt.h"
+
+namespace toylang {
+
+std::optional<unsigned> TokenWriter::ParseFields(std::string_view list) {
+  unsigned fields = 0;
+  while (!list.empty()) {
+    auto const comma = list.find(',');
+    auto const name = list.substr(0, comma);
+    if (name == "id") {
+      fields |= kId;
+    } else if (name == "name") {
+      fields |= kName;
+    } else if (name == "offset") {
+      fields |= kOffset;
+    } else if (name == "length") {
+      fields |= kLength;
+    } else if (name == "line" || name == "column") {
+      fields |= kPosition;
+    } else if (name == "text") {
+      fields |= kText;
+    } else {
+      return std::nullopt;
+    }
+    if (comma == std::string_view::npos) break;
+    list.remove_prefix(comma + 1);
+  }
+  if (fields == 0) return std::nullopt;
+  return fields;
+}
+
+TokenWriter::TokenWriter(std::shared_ptr<Lexicon const> lexicon,
+                         std::FILE* file, Format format, unsigned fields,
+                         size_t capacity)
+    : lexicon_{std::move(lexicon)},
+      file_{file},
+      format_{format},
+      fields_{fields},
+      capacity_{capacity} {
+  // 预留余量，单个词法单元写入后才检查是否需要写入文件
+  buffer_.reserve(capacity_ + 4096);
+
+  auto const tokens = lexicon_->ListTokens();
+  if (format_ == Format::kJsonLines) {
+    // 名称只转义一次，写出词法单元时直接复制
+    names_.reserve(tokens.size() + 2);
+    for (int id = Token::kError; id <= static_cast<int>(tokens.size()); id++) {
+      Quote(names_.emplace_back(), lexicon_->NameOfToken(id));
+    }
+  } else {
+    buffer_.append(kMagic, sizeof(kMagic) - 1);
+    Varint(fields_);
+    Varint(tokens.size());
+    for (auto const& name : tokens) {
+      Varint(name.size());
+      buffer_.append(name);
+    }
+  }
+}
+
+TokenWriter::~TokenWriter() { Flush(); }
+
+void TokenWriter::Write(Token const& token) {
+  if (format_ == Format::kJsonLines) {
+    WriteJson(token);
+  } else {
+    WriteBinary(token);
+  }
+  count_++;
+  if (buffer_.size() >= capacity_) Flush();
+}
+
+bool TokenWriter::Flush() {
+  if (!buffer_.empty()) {
+    // 写入失败后丢弃剩余数据，错误一直保留到最后一次 Flush
+    if (!failed_) {
+      auto const written =
+          std::fwrite(buffer_.data(), 1, buffer_.size(), file_);
+      failed_ = written != buffer_.size() || std::fflush(file_) != 0;
+    }
+    buffer_.clear();
+  }
+  return !failed_;
+}
+
+void TokenWriter::WriteJson(Token const& token) {
+  auto separator = '{';
+  auto const key = [&](std::string_view name) {
+    buffer_.push_back(separator);
+    separator = ',';
+    buffer_.push_back('"');
+    buffer_.append(name);
+    buffer_.append("\":");
+  };
+  auto const number = [&](auto value) {
+    fmt::format_int const formatted{value};
+    buffer_.append(formatted.data(), formatted.size());
+  };
+
+  if (fields_ & kId) {
+    key("id");
+    number(token.id);
+  }
+  if (fields_ & kName) {
+    key("name");
+    auto const index = static_cast<size_t>(token.id - Token::kError);
+    if (index < names_.size()) {
+      buffer_.append(names_[index]);
+    } else {
+      Quote(buffer_, lexicon_->NameOfToken(token.id));
+    }
+  }
+  if (fields_ & kOffset) {
+    key("offset");
+    number(token.offset);
+  }
+  if (fields_ & kLength) {
+    key("length");
+    number(token.length);
+  }
+  if (fields_ & kPosition) {
+    key("line");
+    number(token.start_line);
+    key("column");
+    number(token.start_column);
+  }
+  if (fields_ & kText) {
+    key("text");
+    Quote(buffer_, std::string_view{token.source->content}.substr(
+                       token.offset, token.length));
+  }
+  if (separator == '{') buffer_.push_back('{');
+  buffer_.append("}\n");
+}
+
+void TokenWriter::WriteBinary(Token const& token) {
+  if (fields_ & (kId | kName)) {
+    auto const id = static_cast<int64_t>(token.id);
+    Varint((static_cast<uint64_t>(id) << 1) ^ (id < 0 ? ~0ULL : 0ULL));
+  }
+  if (fields_ & kOffset) {
+    Varint(token.offset - offset_);
+    offset_ = token.offset;
+  }
+  if (fields_ & kLength) Varint(token.length);
+  if (fields_ & kPosition) {
+    Varint(token.start_line);
+    Varint(token.start_column);
+  }
+  if (fields_ & kText) {
+    Varint(token.length);
+    buffer_.append(token.source->content, token.offset, token.length);
+  }
+}
+
+namespace {
+
+/**
+ * 以 text[i] 开头的合法 UTF-8 编码序列的长度，不合法时返回0
+ * 过长编码、代理项与超出 U+10FFFF 的码点都不合法
+ */
+size_t Utf8Length(std::string_view text, size_t i) {
+  auto const byte = [&](size_t k) {
+    return static_cast<unsigned char>(text[i + k]);
+  };
+  auto const ch = byte(0);
+  size_t length;
+  unsigned char low = 0x80, high = 0xbf;
+  if (ch >= 0xc2 && ch <= 0xdf) {
+    length = 2;
+  } else if (ch >= 0xe0 && ch <= 0xef) {
+    length = 3;
+    if (ch == 0xe0) low = 0xa0;
+    if (ch == 0xed) high = 0x9f;
+  } else if (ch >= 0xf0 && ch <= 0xf4) {
+    length = 4;
+    if (ch == 0xf0) low = 0x90;
+    if (ch == 0xf4) high = 0x8f;
+  } else {
+    return 0;
+  }
+  if (text.size() - i < length) return 0;
+  if (byte(1) < low || byte(1) > high) return 0;
+  for (size_t k = 2; k < length; k++) {
+    if (byte(k) < 0x80 || byte(k) > 0xbf) return 0;
+  }
+  return length;
+}
+
+}  // namespace
+
+void TokenWriter::Quote(std::string& out, std::string_view text) {
+  out.push_back('"');
+  auto begin = text.data();
+  auto const end = text.data() + text.size();
+  for (auto it = begin; it != end; ++it) {
+    auto const ch = static_cast<unsigned char>(*it);
+    if (ch >= 0x20 && ch < 0x80 && ch != '"' && ch != '\\') continue;
+    if (ch >= 0x80) {
+      // 合法的多字节序列原样写出，不合法的字节替换为 U+FFFD
+      auto const length = Utf8Length(text, it - text.data());
+      if (length != 0) {
+        it += length - 1;
+        continue;
+      }
+      out.append(begin, it);
+      begin = it + 1;
+      out.append("\\ufffd");
+      continue;
+    }
+
+    // 连续的普通字节一次复制
+    out.append(begin, it);
+    begin = it + 1;
+    switch (ch) {
+      case '"':
+        out.append("\\\"");
+        break;
+      case '\\':
+        out.append("\\\\");
+        break;
+      case '\n':
+        out.append("\\n");
+        break;
+      case '\r':
+        out.append("\\r");
+        break;
+      case '\t':
+        out.append("\\t");
+        break;
+      default:
+        fmt::format_to(std::back_inserter(out), "\\u{:04x}", ch);
+        break;
+    }
+  }
+  out.append(begin, end);
+  out.push_back('"');
+}
+
+void TokenWriter::Varint(uint64_t value) {
+  while (value >= 0x80) {
+    buffer_.push_back(static_cast<char>(value | 0x80));
+    value >>= 7;
+  }
+  buffer_.push_back(static_cast<char>(value));
+}
+
+}  // namespace toylang
@@ -0,0 +1,228 @@
+#include "toylang/jit.h"
+
+#include <algorithm>
+#include <cstddef>
+#include <cstring>
+
+#if defined(__x86_64__) && defined(__unix__)
+#include <sys/mman.h>
+#define TOYLANG_JIT_X86_64 1
+#endif
+
+namespace toylang {
+
+namespace {
+
+#ifdef TOYLANG_JIT_X86_64
+
+static_assert(offsetof(Jit::Result, stop) == 0);
+static_assert(offsetof(Jit::Result, accept_end) == 8);
+static_assert(offsetof(Jit::Result, accept) == 16);
+
+/**
+ * 转移较多的状态改用跳转表
+ */
+constexpr size_t kMaxCompares = 6;
+
+/**
+ * x86-64 代码生成器
+ *
+ * 生成的代码遵循 System V 调用约定：
+ * rdi 为当前位置，rsi 为文本末尾，rdx 指向 Jit::Result
+ * 每个状态包含两个标签：advance 消耗当前字节后进入状态并记录接受，
+ * entry 只用于从该状态开始扫描
+ */
+class Emitter {
+ public:
+  explicit Emitter(size_t states) : advances_(states), entries_(states) {}
+
+  std::vector<uint8_t> const& code() const { return code_; }
+  std::vector<uint32_t> const& entries() const { return entries_; }
+
+  /**
+   * 所有状态共享的出口：mov [rdx], rdi; ret
+   */
+  void EmitStop() {
+    stop_ = code_.size();
+    Bytes({0x48, 0x89, 0x3A, 0xC3});
+  }
+
+  void EmitState(int state, int accept, Jit::Transfer const& transfer) {
+    advances_[state] = code_.size();
+    Bytes({0x48, 0xFF, 0xC7});  // inc rdi
+    if (accept != 0) {
+      Bytes({0x48, 0x89, 0x7A, 0x08});  // mov [rdx+8], rdi
+      Bytes({0x48, 0xC7, 0x42, 0x10});  // mov qword [rdx+16], imm32
+      Int32(accept);
+    }
+
+    entries_[state] = code_.size();
+    Bytes({0x48, 0x39, 0xF7});  // cmp rdi, rsi
+    Bytes({0x0F, 0x83});        // jae stop
+    Jump(-1);
+    Bytes({0x0F, 0xB6, 0x07});  // movzx eax, byte [rdi]
+
+    // 按字节值划分为转移目标相同的连续区间
+    struct Range {
+      int lo;
+      int hi;
+      int target;
+    };
+    std::vector<Range> ranges;
+    int targets[256];
+    for (auto ch = 0; ch < 256; ch++) {
+      targets[ch] = transfer(state, static_cast<uint8_t>(ch));
+      if (!ranges.empty() && ranges.back().target == targets[ch]) {
+        ranges.back().hi = ch;
+      } else {
+        ranges.push_back({ch, ch, targets[ch]});
+      }
+    }
+    ranges.erase(
+        std::remove_if(ranges.begin(), ranges.end(),
+                       [](Range const& range) { return range.target == 0; }),
+        ranges.end());
+
+    if (ranges.size() <= kMaxCompares) {
+      for (auto const& range : ranges) {
+        if (range.lo == range.hi) {
+          Bytes({0x3D});  // cmp eax, imm32
+          Int32(range.lo);
+          Bytes({0x0F, 0x84});  // je
+        } else {
+          Bytes({0x8D, 0x88});  // lea ecx, [rax - lo]
+          Int32(-range.lo);
+          Bytes({0x81, 0xF9});  // cmp ecx, imm32
+          Int32(range.hi - range.lo);
+          Bytes({0x0F, 0x86});  // jbe
+        }
+        Jump(range.target);
+      }
+      Bytes({0xE9});  // jmp stop
+      Jump(-1);
+      return;
+    }
+
+    // lea r9, [rip+9]; movsxd rax, [r9+rax*4]; add rax, r9; jmp rax
+    Bytes({0x4C, 0x8D, 0x0D});
+    Int32(9);
+    Bytes({0x49, 0x63, 0x04, 0x81});
+    Bytes({0x4C, 0x01, 0xC8});
+    Bytes({0xFF, 0xE0});
+    auto const table = code_.size();
+    for (auto ch = 0; ch < 256; ch++) {
+      fixups_.push_back({code_.size(), table, targets[ch] ? targets[ch] : -1});
+      Int32(0);
+    }
+  }
+
+  /**
+   * 所有状态生成后回填跳转目标
+   */
+  void Resolve() {
+    for (auto const& fixup : fixups_) {
+      auto const target = fixup.state < 0 ? stop_ : advances_[fixup.state];
+      auto const value = static_cast<int32_t>(static_cast<int64_t>(target) -
+                                              static_cast<int64_t>(fixup.base));
+      std::memcpy(code_.data() + fixup.pos, &value, sizeof(value));
+    }
+  }
+
+ private:
+  /**
+   * 在 pos 处写入 state 的 advance 标签相对 base 的偏移量，state 为-1表示出口
+   */
+  struct Fixup {
+    size_t pos;
+    size_t base;
+    int state;
+  };
+
+  void Bytes(std::initializer_list<uint8_t> bytes) {
+    code_.insert(code_.end(), bytes);
+  }
+
+  void Int32(int32_t value) {
+    uint8_t bytes[4];
+    std::memcpy(bytes, &value, sizeof(value));
+    code_.insert(code_.end(), bytes, bytes + 4);
+  }
+
+  /**
+   * 写入相对跳转的 rel32
+   */
+  void Jump(int state) {
+    fixups_.push_back({code_.size(), code_.size() + 4, state});
+    Int32(0);
+  }
+
+  std::vector<uint8_t> code_;
+  size_t stop_ = 0;
+  std::vector<size_t> advances_;
+  std::vector<uint32_t> entries_;
+  std::vector<Fixup> fixups_;
+};
+
+#endif
+
+}  // namespace
+
+Jit::~Jit() {
+#ifdef TOYLANG_JIT_X86_64
+  if (code_) munmap(code_, size_);
+#endif
+}
+
+bool Jit::Supported() {
+#ifdef TOYLANG_JIT_X86_64
+  return true;
+#else
+  return false;
+#endif
+}
+
+std::unique_ptr<Jit> Jit::Compile(std::vector<int> const& accepts,
+                                  Transfer const& transfer) {
+#ifdef TOYLANG_JIT_X86_64
+  Emitter emitter{accepts.size()};
+  emitter.EmitStop();
+  for (size_t state = 1; state < accepts.size(); state++) {
+    emitter.EmitState(state, accepts[state], transfer);
+  }
+  emitter.Resolve();
+
+  // 先以可写方式填充，再切换为只读可执行
+  auto const& code = emitter.code();
+  auto const size = code.size();
+  auto const memory = mmap(nullptr, size, PROT_READ | PROT_WRITE,
+                           MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+  if (memory == MAP_FAILED) return nullptr;
+  std::memcpy(memory, code.data(), size);
+  if (mprotect(memory, size, PROT_READ | PROT_EXEC) != 0) {
+    munmap(memory, size);
+    return nullptr;
+  }
+
+  std::unique_ptr<Jit> jit{new Jit};
+  jit->code_ = memory;
+  jit->size_ = size;
+  jit->entries_ = emitter.entries();
+  return jit;
+#else
+  (void)accepts;
+  (void)transfer;
+  return nullptr;
+#endif
+}
+
+Jit::Result Jit::Run(int state, uint8_t const* begin,
+                     uint8_t const* end) const {
+  Result result{begin, begin, 0};
+  using Entry = void (*)(uint8_t const*, uint8_t const*, Result*);
+  auto const entry = reinterpret_cast<Entry>(static_cast<uint8_t*>(code_) +
+                                             entries_.at(state));
+  entry(begin, end, &result);
+  return result;
+}
+
+}  // namespace toylang
@@ -1,21 +1,83 @@
 #include "toylang/lexical.h"
 
+#include <algorithm>
+#include <array>
+#include <cstdint>
+#include <cstring>
 #include <stdexcept>
+#include <unordered_map>
 
 #include "toylang/anim.h"
+#include "toylang/derivative.h"
+#include "toylang/jit.h"
+#include "toylang/shuffle.h"
 
 namespace toylang {
 
 namespace {
 
-struct State {
-  std::optional<int> accept;
-  std::map<int, int> transfer;
-};
+/**
+ * 带种子的FNV-1a哈希，用于构建关键字的完美哈希表
+ */
+uint32_t HashOf(std::string_view text, uint32_t seed) {
+  uint32_t hash = 2166136261U ^ (seed * 0x9e3779b9U);
+  for (auto const ch : text) {
+    hash ^= static_cast<unsigned char>(ch);
+    hash *= 16777619U;
+  }
+  return hash ^ (hash >> 15);
+}
+
+/**
+ * 以 FNV-1a 将一段内存并入64位哈希值
+ */
+uint64_t Mix(uint64_t hash, void const* data, size_t size) {
+  auto const bytes = static_cast<unsigned char const*>(data);
+  for (size_t i = 0; i < size; i++) {
+    hash ^= bytes[i];
+    hash *= 1099511628211ULL;
+  }
+  return hash;
+}
+
+template <typename T>
+uint64_t Mix(uint64_t hash, std::vector<T> const& values) {
+  auto const size = values.size();
+  hash = Mix(hash, &size, sizeof(size));
+  return Mix(hash, values.data(), values.size() * sizeof(T));
+}
+
+uint64_t Mix(uint64_t hash, std::vector<std::string> const& strings) {
+  auto const size = strings.size();
+  hash = Mix(hash, &size, sizeof(size));
+  for (auto const& string : strings) {
+    auto const length = string.size();
+    hash = Mix(hash, &length, sizeof(length));
+    hash = Mix(hash, string.data(), length);
+  }
+  return hash;
+}
 
 }  // namespace
 
 struct Lexicon::Impl {
+  /**
+   * 关键字的完美哈希表
+   * 关键字先按 HashOf(text, 0) 分入桶，再以桶的位移种子计算槽位，
+   * 任意两个关键字不会落入同一个槽位
+   */
+  struct Keywords {
+    /**
+     * 每个桶的位移种子
+     */
+    std::vector<uint32_t> seeds;
+
+    /**
+     * 每个槽位的关键字词法记号ID，0表示空槽位，槽位数量总是2的幂
+     */
+    std::vector<int> slots;
+  };
+
   /**
    * 词法记号表，第一个元素ID为1
    */
@@ -27,9 +89,161 @@ struct Lexicon::Impl {
   std::vector<std::string> contexts_;
 
   /**
-   * 状态表
+   * 字节到字节等价类的映射，同一等价类中的字节总是具有相同的转移
+   */
+  std::array<uint8_t, 256> byte_classes_;
+
+  /**
+   * 字节等价类的数量
+   */
+  size_t class_count_;
+
+  /**
+   * 每个上下文的首状态，下标为上下文ID
+   */
+  std::vector<int> starts_;
+
+  /**
+   * 每个状态接受的词法记号，0表示不接受
+   */
+  std::vector<int> accepts_;
+
+  /**
+   * 转移表，第 state * class_count_ + class 项为转移目标，0表示没有转移
+   * 状态0是起始状态，它只以上下文ID为输入转移到各上下文的首状态
    */
-  std::vector<State> states_;
+  std::vector<int> transfers_;
+
+  /**
+   * 每个词法记号的关键字表，下标为词法记号ID减一，没有关键字的表为空
+   */
+  std::vector<Keywords> keywords_;
+
+  /**
+   * 每个上下文中能作为词法单元首字节的字节，下标为上下文ID
+   */
+  std::vector<std::array<uint8_t, 256>> leaders_;
+
+  /**
+   * 本机代码，未启用或平台不支持时为空
+   */
+  std::unique_ptr<Jit> jit_;
+
+  /**
+   * 状态数足够少时构造的重排表，否则为空
+   */
+  std::unique_ptr<Shuffle> shuffle_;
+
+  /**
+   * 位置自动机，以位集表示当前可能处于的位置集合
+   * 位集中的第i位对应第i个位置，与正则表达式中间表示的节点下标无关
+   */
+  struct Nfa {
+    /**
+     * 每个位集的64位字数
+     */
+    size_t words;
+
+    /**
+     * 每个上下文的首位置集合，下标为上下文ID
+     */
+    std::vector<std::vector<uint64_t>> starts;
+
+    /**
+     * 第 class * words 起的位集为能接受该字节等价类的位置
+     */
+    std::vector<uint64_t> matches;
+
+    /**
+     * 第 position * words 起的位集为该位置的followpos
+     */
+    std::vector<uint64_t> follows;
+
+    /**
+     * 接受位置的集合
+     */
+    std::vector<uint64_t> accepts;
+
+    /**
+     * 每个接受位置接受的词法记号
+     */
+    std::vector<int> tokens;
+  };
+
+  /**
+   * 逆向状态机，接受词法单元前缀的逆序，与正向状态机共用字节等价类
+   */
+  struct Reverse {
+    /**
+     * 每个上下文的首状态，包含该上下文中全部词法单元的全部位置
+     */
+    std::vector<int> starts;
+
+    /**
+     * 状态是否接受，即已读入的字节逆序后是某个词法单元的前缀
+     */
+    std::vector<bool> accepts;
+
+    /**
+     * 转移表，含义与 transfers_ 相同
+     */
+    std::vector<int> transfers;
+  };
+
+  /**
+   * 未启用时为空
+   */
+  std::unique_ptr<Reverse> reverse_;
+
+  /**
+   * 见 Lexicon::Fingerprint，构建完成时计算
+   */
+  uint64_t fingerprint_ = 0;
+
+  /**
+   * 构造本词法规则时的中间状态，供扩展时复用，未启用扩展时为空
+   */
+  std::shared_ptr<Lexicon::Builder::Building const> origin_;
+
+  /**
+   * 状态数超出限制时不构建状态机，改为模拟位置自动机，否则为空
+   * 此时 starts_、accepts_ 与 transfers_ 均为空
+   */
+  std::unique_ptr<Nfa> nfa_;
+
+  /**
+   * 见 Lexicon::Scan
+   */
+  Scanned Scan(int context, std::string_view text) const;
+
+  /**
+   * 模拟位置自动机时的失败记录
+   * 与确定状态机的失败记录相同，只是以位置集合代替状态
+   */
+  struct Failures {
+    /**
+     * 键为偏移量与位置集合的字节，值为得出该结论的扫描读取到的位置
+     */
+    std::unordered_map<std::string, size_t>& memo;
+
+    /**
+     * 被扫描的文本在源码中的偏移量
+     */
+    size_t base;
+
+    /**
+     * 扫描读取到的位置，遇到失败记录时延伸到记录时的位置
+     */
+    size_t reach = 0;
+  };
+
+  /**
+   * 模拟位置自动机，含义与 Scan 相同
+   * 给出失败记录时，遇到记录过的组合立即停止，
+   * 并记录最后一次接受之后经过的组合，保证最长匹配的总耗时是线性的
+   */
+  Scanned Simulate(int context, std::string_view text,
+                   Failures* failures = nullptr) const;
 };
 
 Lexicon::Lexicon(std::unique_ptr<Impl>&& impl) : impl_(std::move(impl)) {}
@@ -69,30 +283,414 @@ std::vector<std::string> Lexicon::ListContexts() const {
   return impl_->contexts_;
 }
 
+size_t Lexicon::CountStates() const { return impl_->accepts_.size(); }
+
 std::optional<int> Lexicon::AcceptOfState(int state) const {
-  return impl_->states_.at(state).accept;
+  auto const accept = impl_->accepts_.at(state);
+  if (accept == 0) return std::nullopt;
+  return accept;
 }
 
 std::optional<int> Lexicon::TransferOfState(int state, int input) const {
-  auto& transfer = impl_->states_.at(state).transfer;
-  auto it = transfer.find(input);
-  if (it == transfer.end()) return std::nullopt;
-  return it->second;
+  if (state == 0) return impl_->starts_.at(input);
+
+  auto const next = impl_->transfers_.at(
+      state * impl_->class_count_ +
+      impl_->byte_classes_[static_cast<unsigned char>(input)]);
+  if (next == 0) return std::nullopt;
+  return next;
+}
+
+int Lexicon::ClassifyToken(int token, std::string_view text) const {
+  if (token <= 0 || static_cast<size_t>(token) > impl_->keywords_.size())
+    return token;
+
+  auto const& keywords = impl_->keywords_[token - 1];
+  if (keywords.slots.empty()) return token;
+
+  auto const bucket = HashOf(text, 0) % keywords.seeds.size();
+  auto const slot =
+      HashOf(text, keywords.seeds[bucket]) & (keywords.slots.size() - 1);
+  auto const keyword = keywords.slots[slot];
+  if (keyword != 0 && impl_->tokens_[keyword - 1] == text) return keyword;
+  return token;
+}
+
+size_t Lexicon::SkipOfContext(int context, std::string_view text) const {
+  auto const& leaders = impl_->leaders_.at(context);
+  auto const* const data = reinterpret_cast<unsigned char const*>(text.data());
+  auto const size = text.size();
+
+  // 一次检查八个字节，只有遇到首字节时才逐个定位
+  size_t skip = 0;
+  for (; skip + 8 <= size; skip += 8) {
+    auto const* const p = data + skip;
+    if (leaders[p[0]] | leaders[p[1]] | leaders[p[2]] | leaders[p[3]] |
+        leaders[p[4]] | leaders[p[5]] | leaders[p[6]] | leaders[p[7]])
+      break;
+  }
+  while (skip < size && !leaders[data[skip]]) skip++;
+  return skip;
+}
+
+size_t Lexicon::RestartOfContext(int context, std::string_view text,
+                                 size_t offset) const {
+  auto const& impl = *impl_;
+  if (offset >= text.size()) return text.size();
+  if (!impl.reverse_) return 0;
+
+  auto const& reverse = *impl.reverse_;
+  auto const& leaders = impl.leaders_.at(context);
+  auto const* const data = reinterpret_cast<unsigned char const*>(text.data());
+  auto const step = [&](int state, unsigned char input) {
+    return reverse.transfers[state * impl.class_count_ +
+                             impl.byte_classes_[input]];
+  };
+
+  // 候选位置 q 必须能作为词法单元的首字节，否则错误词法单元可能跨越它
+  // 其余情况下，只要不存在 s < q 使 [s, q] 是某个词法单元的前缀，
+  // 覆盖 q - 1 的词法单元就必然在 q 处结束
+  for (auto q = offset; q > 0; q--) {
+    if (!leaders[data[q]]) continue;
+
+    auto state = step(reverse.starts.at(context), data[q]);
+    auto crossed = false;
+    for (auto s = q; state != 0 && s-- > 0;) {
+      state = step(state, data[s]);
+      if (state != 0 && reverse.accepts[state]) {
+        crossed = true;
+        break;
+      }
+    }
+    if (!crossed) return q;
+  }
+  return 0;
 }
 
+Lexicon::Scanned Lexicon::Scan(int context, std::string_view text) const {
+  return impl_->Scan(context, text);
+}
+
+Lexicon::Scanned Lexicon::Impl::Scan(int context,
+                                     std::string_view text) const {
+  if (nfa_) return Simulate(context, text);
+
+  auto const start = starts_.at(context);
+  auto const* const begin = reinterpret_cast<uint8_t const*>(text.data());
+  if (jit_) {
+    auto const result = jit_->Run(start, begin, begin + text.size());
+    return {static_cast<size_t>(result.stop - begin),
+            static_cast<int>(result.accept),
+            static_cast<size_t>(result.accept_end - begin)};
+  }
+
+  if (shuffle_) {
+    auto const result = shuffle_->Run(start, begin, begin + text.size());
+    return {static_cast<size_t>(result.stop - begin),
+            static_cast<int>(result.accept),
+            static_cast<size_t>(result.accept_end - begin)};
+  }
+
+  Scanned scanned{0, 0, 0};
+  for (auto state = start; scanned.end < text.size();) {
+    state = transfers_[state * class_count_ + byte_classes_[begin[scanned.end]]];
+    if (state == 0) break;
+
+    scanned.end++;
+    if (accepts_[state] != 0) {
+      scanned.accept = accepts_[state];
+      scanned.accept_end = scanned.end;
+    }
+  }
+  return scanned;
+}
+
+Lexicon::Scanned Lexicon::Impl::Simulate(int context, std::string_view text,
+                                         Failures* failures) const {
+  auto const words = nfa_->words;
+  auto current = nfa_->starts.at(context);
+  std::vector<uint64_t> next(words);
+
+  // 键为绝对偏移量与位置集合，trail 记录最后一次接受之后经过的组合
+  std::vector<std::string> trail;
+  std::optional<size_t> reach;
+  auto const key = [&](size_t end) {
+    std::string key(sizeof(uint64_t) * (words + 1), '\0');
+    uint64_t const offset = failures->base + end;
+    std::memcpy(key.data(), &offset, sizeof(offset));
+    std::memcpy(key.data() + sizeof(offset), current.data(),
+                sizeof(uint64_t) * words);
+    return key;
+  };
+
+  Scanned scanned{0, 0, 0};
+  while (scanned.end < text.size()) {
+    // 当前集合中能接受输入的位置，其followpos的并集即为下一个集合
+    auto const cls = byte_classes_[static_cast<uint8_t>(text[scanned.end])];
+    auto const* const matches = nfa_->matches.data() + cls * words;
+    std::fill(next.begin(), next.end(), 0);
+    auto alive = false;
+    for (size_t w = 0; w < words; w++) {
+      for (auto bits = current[w] & matches[w]; bits != 0; bits &= bits - 1) {
+        auto const position = w * 64 + __builtin_ctzll(bits);
+        auto const* const follow = nfa_->follows.data() + position * words;
+        for (size_t i = 0; i < words; i++) next[i] |= follow[i];
+        alive = true;
+      }
+    }
+    if (!alive) break;
+
+    current.swap(next);
+    scanned.end++;
+    std::string failure;
+    if (failures) {
+      failure = key(scanned.end);
+      if (auto const it = failures->memo.find(failure);
+          it != failures->memo.end()) {
+        reach = it->second;
+        break;
+      }
+    }
+
+    // 词法记号ID越小，优先级越高
+    auto accept = 0;
+    for (size_t w = 0; w < words; w++) {
+      for (auto bits = current[w] & nfa_->accepts[w]; bits != 0;
+           bits &= bits - 1) {
+        auto const token = nfa_->tokens[w * 64 + __builtin_ctzll(bits)];
+        if (accept == 0 || token < accept) accept = token;
+      }
+    }
+    if (accept != 0) {
+      scanned.accept = accept;
+      scanned.accept_end = scanned.end;
+      trail.clear();
+    } else if (failures) {
+      trail.push_back(std::move(failure));
+    }
+  }
+
+  if (failures) {
+    failures->reach = reach ? *reach : failures->base + scanned.end;
+    for (auto& failure : trail)
+      failures->memo.emplace(std::move(failure), failures->reach);
+  }
+  return scanned;
+}
+
+bool Lexicon::Jitted() const { return impl_->jit_ != nullptr; }
+
+bool Lexicon::Vectorized() const { return impl_->shuffle_ != nullptr; }
+
+bool Lexicon::Simulated() const { return impl_->nfa_ != nullptr; }
+
+bool Lexicon::Reversible() const { return impl_->reverse_ != nullptr; }
+
+uint64_t Lexicon::Fingerprint() const { return impl_->fingerprint_; }
+
 Scanner::Scanner()
     : context_{0},
       line_{1UL},
       column_{1UL},
       offset_{0UL},
+      reach_{0UL},
       lexicon_{nullptr},
-      source_{nullptr} {}
+      source_{nullptr},
+      failures_limit_{0UL} {}
 
 Token Scanner::NextToken() {
   if (!lexicon_) throw std::runtime_error("lexicon not set");
   if (!source_) throw std::runtime_error("source not set");
 
-  Token token{
+  auto token = StartToken();
+  auto const& content = source_->content;
+  if (offset_ >= content.size()) return token;
+
+  if (offset_ >= failures_limit_) {
+    failures_.clear();
+    simulated_failures_.clear();
+  }
+  auto const key = [](int state, size_t offset) {
+    return static_cast<uint64_t>(offset) << 32 | static_cast<uint32_t>(state);
+  };
+
+  std::optional<int> accept;
+  auto accept_end = offset_;
+  auto offset = offset_;
+  auto scanned = false;
+
+  // 本机代码与重排执行不检查失败记录，只采用不需要回退的扫描结果，
+  // 需要回退时交给下面的解释执行记录失败组合
+  // 模拟位置自动机时没有状态可供解释执行，由它自己记录失败组合
+  std::optional<size_t> reach;
+  if (lexicon_->Simulated()) {
+    Lexicon::Impl::Failures failures{.memo = simulated_failures_,
+                                     .base = offset_};
+    auto const result = lexicon_->impl_->Simulate(
+        context_, std::string_view{content}.substr(offset_), &failures);
+    if (result.accept != 0) accept = result.accept;
+    accept_end = offset_ + result.accept_end;
+    offset = offset_ + result.end;
+    reach = failures.reach;
+    scanned = true;
+    if (!simulated_failures_.empty())
+      failures_limit_ = std::max(failures_limit_, offset);
+  } else if ((lexicon_->Jitted() || lexicon_->Vectorized()) &&
+             failures_.empty() && !Anim::Enabled()) {
+    auto const result =
+        lexicon_->Scan(context_, std::string_view{content}.substr(offset_));
+    if (result.end == result.accept_end) {
+      if (result.accept != 0) accept = result.accept;
+      accept_end = offset_ + result.accept_end;
+      offset = offset_ + result.end;
+      scanned = true;
+    }
+  }
+
+  // 向前扫描直到无法转移，记录最后一次经过的接受状态
+  // trail 记录最后一次接受之后经过的组合，扫描结束后它们都无法再到达接受状态
+  // reach 是扫描读取到的位置，遇到失败记录时延伸到记录时的扫描读取到的位置，
+  // 词法单元的前瞻长度据此计算
+  auto state = scanned ? 0 : lexicon_->TransferOfState(0, context_).value();
+  std::vector<uint64_t> trail;
+  if (!scanned) Anim::ScannerSetState(state);
+  while (!scanned && offset < content.size()) {
+    auto const tr = lexicon_->TransferOfState(
+        state, static_cast<unsigned char>(content[offset]));
+    if (!tr) break;
+
+    state = *tr;
+    offset++;
+    Anim::ScannerSetState(state);
+    if (auto const failure = failures_.find(key(state, offset));
+        failure != failures_.end()) {
+      reach = failure->second;
+      break;
+    }
+
+    if (auto const accepted = lexicon_->AcceptOfState(state); accepted) {
+      accept = accepted;
+      accept_end = offset;
+      trail.clear();
+    } else {
+      trail.push_back(key(state, offset));
+    }
+  }
+  if (!reach) reach = offset;
+  if (!trail.empty()) {
+    for (auto const failure : trail) failures_.emplace(failure, *reach);
+    failures_limit_ = std::max(failures_limit_, offset);
+  }
+
+  FinishToken(token, accept, accept_end, *reach);
+  return token;
+}
+
+std::vector<std::vector<Token>> Scanner::ScanInterleaved(
+    std::vector<Scanner*> const& scanners) {
+  for (auto const scanner : scanners) {
+    if (!scanner->lexicon_) throw std::runtime_error("lexicon not set");
+    if (!scanner->source_) throw std::runtime_error("source not set");
+  }
+
+  // 每条通道对应一个词法分析器，保存当前词法单元的扫描进度
+  struct Lane {
+    Scanner* scanner;
+    Lexicon::Impl const* impl;
+    unsigned char const* data;
+    size_t size;
+    int state;
+    size_t offset;
+    int accept;
+    size_t accept_end;
+  };
+
+  std::vector<std::vector<Token>> results(scanners.size());
+  std::vector<Lane> lanes;
+  std::vector<size_t> active;
+  for (size_t i = 0; i < scanners.size(); i++) {
+    auto const scanner = scanners[i];
+    auto const& content = scanner->source_->content;
+    lanes.push_back({scanner, scanner->lexicon_->impl_.get(),
+                     reinterpret_cast<unsigned char const*>(content.data()),
+                     content.size(), 0, 0, 0, 0});
+    active.push_back(i);
+  }
+
+  // 开始扫描下一个词法单元，返回通道是否已到达末尾
+  // 失败记录仍然有效或正在记录动画时，由 NextToken 逐个提取
+  auto const restart = [&](size_t i) {
+    auto& lane = lanes[i];
+    auto& scanner = *lane.scanner;
+    for (;;) {
+      if (scanner.offset_ >= lane.size) return true;
+      if (scanner.offset_ >= scanner.failures_limit_) scanner.failures_.clear();
+      if (scanner.failures_.empty() && !Anim::Enabled() && !lane.impl->nfa_)
+        break;
+      results[i].push_back(scanner.NextToken());
+    }
+    lane.state = lane.impl->starts_.at(scanner.context_);
+    lane.offset = scanner.offset_;
+    lane.accept = 0;
+    lane.accept_end = scanner.offset_;
+    return false;
+  };
+
+  for (auto it = active.begin(); it != active.end();) {
+    if (restart(*it)) {
+      it = active.erase(it);
+    } else {
+      ++it;
+    }
+  }
+
+  // 每轮让所有通道各前进一步，各通道的查表互不依赖，可以同时等待内存
+  while (!active.empty()) {
+    for (size_t k = 0; k < active.size();) {
+      auto const i = active[k];
+      auto& lane = lanes[i];
+      if (lane.offset < lane.size) {
+        auto const impl = lane.impl;
+        auto const next =
+            impl->transfers_[lane.state * impl->class_count_ +
+                             impl->byte_classes_[lane.data[lane.offset]]];
+        if (next != 0) {
+          lane.state = next;
+          lane.offset++;
+          if (impl->accepts_[next] != 0) {
+            lane.accept = impl->accepts_[next];
+            lane.accept_end = lane.offset;
+          }
+          k++;
+          continue;
+        }
+      }
+
+      // 通道停止转移，不需要回退时直接产出词法单元，否则交给 NextToken
+      auto& scanner = *lane.scanner;
+      if (lane.offset == lane.accept_end) {
+        auto token = scanner.StartToken();
+        std::optional<int> accept;
+        if (lane.accept != 0) accept = lane.accept;
+        scanner.FinishToken(token, accept, lane.accept_end, lane.offset);
+        results[i].push_back(std::move(token));
+      } else {
+        results[i].push_back(scanner.NextToken());
+      }
+
+      if (restart(i)) {
+        active.erase(active.begin() + k);
+      } else {
+        k++;
+      }
+    }
+  }
+
+  return results;
+}
+
+Token Scanner::StartToken() const {
+  return Token{
       .id = Token::kEOF,
       .start_line = line_,
       .start_column = column_,
@@ -102,84 +700,824 @@ Token Scanner::NextToken() {
       .length = 0,
       .source = source_,
       .lexicon = lexicon_,
+      .context = context_,
+      .lookahead = 1,
+      .symbol = SymbolPool::kNone,
   };
+}
 
-  if (offset_ >= source_->content.size()) return token;
-
-  auto state = lexicon_->TransferOfState(0, context_).value();
-  Anim::ScannerSetState(state);
-  while (state != 0) {
-    auto const ch = static_cast<unsigned char>(source_->content[offset_]);
-    auto tr = lexicon_->TransferOfState(state, ch);
-    if (tr) {
-      state = *tr;
-      Anim::ScannerSetState(state);
-    } else if (auto accept = lexicon_->AcceptOfState(state); accept) {
-      token.id = *accept;
-      Anim::ScannerAcceptToken(token);
-      break;
-    } else {
-      token.id = Token::kError;
-      Anim::ScannerAcceptToken(token);
-      if (ch == 0) break;
-
-      state = 0;
-    }
+void Scanner::FinishToken(Token& token, std::optional<int> accept,
+                          size_t accept_end, size_t offset) {
+  auto const& content = source_->content;
+  if (accept) {
+    token.length = accept_end - offset_;
+    token.id = lexicon_->ClassifyToken(
+        *accept, std::string_view{content}.substr(offset_, token.length));
+  } else {
+    // 将连续无法匹配的区域合并为一个错误词法单元
+    token.length =
+        1 + lexicon_->SkipOfContext(
+                context_, std::string_view{content}.substr(offset_ + 1));
+    token.id = Token::kError;
+  }
+  if (symbols_ && token.id > 0 &&
+      static_cast<size_t>(token.id) < interned_.size() &&
+      interned_[token.id]) {
+    token.symbol = symbols_->Intern(
+        std::string_view{content}.substr(offset_, token.length));
+  }
+  // 之前的词法单元读取得更远时，编辑那里同样会改变这个词法单元之前的结果
+  auto const end = offset_ + token.length;
+  reach_ = std::max(reach_, offset);
+  token.lookahead = std::max(reach_, end) - end + 1;
+  Anim::ScannerAcceptToken(token);
 
-    token.length++;
+  for (size_t i = 0; i < token.length; i++) {
     token.end_line = line_;
     token.end_column = column_;
 
     offset_++;
     column_++;
-    if (ch == '\n') {
+    if (content[offset_ - 1] == '\n') {
       line_++;
       column_ = 1UL;
       Anim::ScannerNextLine();
     }
     Anim::ScannerNextInput();
   }
+}
+
+Relexed Scanner::Relex(std::vector<Token> const& tokens, Edit const& edit) {
+  return Relex(
+      tokens.size(), [&](size_t index) { return tokens[index]; }, edit);
+}
+
+Relexed Scanner::Relex(TokenList const& tokens, Edit const& edit) {
+  return Relex(
+      tokens.Count(), [&](size_t index) { return tokens.At(index); }, edit);
+}
+
+Relexed Scanner::Relex(size_t count, std::function<Token(size_t)> const& at,
+                       Edit const& edit) {
+  if (!lexicon_) throw std::runtime_error("lexicon not set");
+  if (!source_) throw std::runtime_error("source not set");
+
+  auto const& content = source_->content;
+  if (edit.offset > content.size() ||
+      edit.removed > content.size() - edit.offset) {
+    throw std::runtime_error("edit out of range");
+  }
+
+  auto const edit_end = edit.offset + edit.removed;
+  auto const inserted_end = edit.offset + edit.inserted.size();
+  auto const delta = static_cast<ptrdiff_t>(edit.inserted.size()) -
+                     static_cast<ptrdiff_t>(edit.removed);
+  auto const shifted = [&](Token const& token) {
+    return static_cast<ptrdiff_t>(token.offset) + delta;
+  };
+  auto const reach = [](Token const& token) {
+    return token.offset + token.length + token.lookahead;
+  };
+
+  // 词法单元结束后还会向前读取若干字符
+  // 若这些字符位于编辑范围内，则词法单元受到影响
+  // 前瞻范围的末尾随词法单元单调不减，可以二分查找第一个受影响的词法单元
+  size_t first = 0;
+  for (auto last = count; first < last;) {
+    auto const middle = first + (last - first) / 2;
+    if (reach(at(middle)) <= edit.offset) {
+      first = middle + 1;
+    } else {
+      last = middle;
+    }
+  }
+  if (first == count && count > 0) first--;
+
+  // 直接拼接源码，不经过 SetSource，动画中只记录编辑本身
+  std::string spliced;
+  spliced.reserve(content.size() - edit.removed + edit.inserted.size());
+  spliced.append(content, 0, edit.offset);
+  spliced.append(edit.inserted);
+  spliced.append(content, edit_end);
+  auto const removed_lines = std::count(content.begin() + edit.offset,
+                                        content.begin() + edit_end, '\n');
+  auto const inserted_lines =
+      std::count(edit.inserted.begin(), edit.inserted.end(), '\n');
+  std::shared_ptr<Source const> source = std::make_shared<Source>(
+      Source{.content = std::move(spliced), .path = source_->path});
+
+  source_ = source;
+  failures_.clear();
+  simulated_failures_.clear();
+  failures_limit_ = 0;
+  Anim::ScannerEditSource(edit.offset, edit.removed, edit.inserted);
+  if (first < count) {
+    auto const token = at(first);
+    line_ = token.start_line;
+    column_ = token.start_column;
+    offset_ = token.offset;
+    context_ = token.context;
+    reach_ = first > 0 ? reach(at(first - 1)) - 1 : 0;
+  } else {
+    line_ = 1;
+    column_ = 1;
+    offset_ = 0;
+    reach_ = 0;
+  }
+
+  Relexed relexed{
+      .first = first,
+      .count = 0,
+      .tokens = {},
+      .source = source,
+      .offset_delta = delta,
+      .line_delta = inserted_lines - removed_lines,
+      .column_delta = 0,
+      .sync_line = 0,
+  };
 
+  // 越过插入的文本后，若新的词法单元边界与某个未受编辑影响的旧词法单元对齐，
+  // 且新的词法单元没有越过它的前瞻范围读取，则其后的词法单元都不会改变
+  auto sync = first;
+  while (true) {
+    if (offset_ >= inserted_end) {
+      std::optional<Token> old;
+      for (; sync < count; sync++) {
+        old = at(sync);
+        if (old->offset >= edit_end &&
+            shifted(*old) >= static_cast<ptrdiff_t>(offset_)) {
+          break;
+        }
+      }
+      if (sync < count &&
+          shifted(*old) == static_cast<ptrdiff_t>(offset_) &&
+          old->context == context_ &&
+          static_cast<ptrdiff_t>(reach_) <
+              static_cast<ptrdiff_t>(reach(*old)) + delta) {
+        break;
+      }
+    }
+
+    auto token = NextToken();
+    if (token.id == Token::kEOF) {
+      sync = count;
+      break;
+    }
+    relexed.tokens.push_back(token);
+  }
+
+  relexed.count = sync - first;
+  if (sync < count) {
+    auto const token = at(sync);
+    relexed.column_delta = static_cast<ptrdiff_t>(column_) -
+                           static_cast<ptrdiff_t>(token.start_column);
+    relexed.sync_line = token.start_line;
+  }
+  return relexed;
+}
+
+void Relexed::Apply(std::vector<Token>& tokens) const {
+  auto const tail = tokens.begin() + first + count;
+  for (auto it = tail; it != tokens.end(); ++it) {
+    if (it->start_line == sync_line) it->start_column += column_delta;
+    if (it->end_line == sync_line) it->end_column += column_delta;
+    it->start_line += line_delta;
+    it->end_line += line_delta;
+    it->offset += offset_delta;
+    it->source = source;
+  }
+
+  tokens.insert(tokens.erase(tokens.begin() + first, tail),
+                this->tokens.begin(), this->tokens.end());
+}
+
+void Relexed::Apply(TokenList& tokens) const {
+  // 间隙之后的词法单元相对源码末尾保存，编辑不改变它们，
+  // 只有与同步点位于同一行的词法单元需要修改列号
+  tokens.MoveGap(first + count);
+  auto const line = tokens.lines_ - sync_line;
+  for (auto it = tokens.back_.rbegin();
+       it != tokens.back_.rend() && it->start_line == line; ++it) {
+    it->start_column += column_delta;
+    if (it->end_line == line) it->end_column += column_delta;
+  }
+
+  tokens.front_.erase(tokens.front_.begin() + first, tokens.front_.end());
+  for (auto const& token : this->tokens) {
+    tokens.front_.push_back(token);
+    tokens.front_.back().source = nullptr;
+  }
+  tokens.source_ = source;
+  tokens.lines_ += line_delta;
+}
+
+TokenList::TokenList(std::vector<Token> tokens,
+                     std::shared_ptr<Source const> source)
+    : front_{std::move(tokens)}, source_{std::move(source)} {
+  lines_ += std::count(source_->content.begin(), source_->content.end(), '\n');
+  for (auto& token : front_) token.source = nullptr;
+}
+
+Token TokenList::At(size_t index) const {
+  if (index < front_.size()) {
+    auto token = front_[index];
+    token.source = source_;
+    return token;
+  }
+
+  auto token = back_[back_.size() - 1 - (index - front_.size())];
+  token.offset = source_->content.size() - token.offset;
+  token.start_line = lines_ - token.start_line;
+  token.end_line = lines_ - token.end_line;
+  token.source = source_;
   return token;
 }
 
+std::vector<Token> TokenList::List() const {
+  std::vector<Token> tokens;
+  tokens.reserve(Count());
+  for (size_t i = 0; i < Count(); i++) tokens.push_back(At(i));
+  return tokens;
+}
+
+void TokenList::MoveGap(size_t index) {
+  auto const size = source_->content.size();
+  while (front_.size() > index) {
+    auto& token = back_.emplace_back(std::move(front_.back()));
+    front_.pop_back();
+    token.offset = size - token.offset;
+    token.start_line = lines_ - token.start_line;
+    token.end_line = lines_ - token.end_line;
+  }
+  while (front_.size() < index) {
+    auto& token = front_.emplace_back(std::move(back_.back()));
+    back_.pop_back();
+    token.offset = size - token.offset;
+    token.start_line = lines_ - token.start_line;
+    token.end_line = lines_ - token.end_line;
+  }
+}
+
 void Scanner::SetLexicon(std::shared_ptr<Lexicon const> lexicon) {
   lexicon_ = lexicon;
   context_ = 0;
+  failures_.clear();
+  simulated_failures_.clear();
 }
 void Scanner::SetSource(std::shared_ptr<Source const> source) {
   source_ = source;
   line_ = 1;
   column_ = 1;
   offset_ = 0;
+  reach_ = 0;
+  failures_.clear();
+  simulated_failures_.clear();
+  failures_limit_ = 0;
   Anim::ScannerSetSource(source->content);
 }
 void Scanner::SetContext(int context) { context_ = context; }
 void Scanner::SetContext(std::string const& context) {
   context_ = lexicon_->IdOfContext(context);
 }
+void Scanner::SetSymbolPool(std::shared_ptr<SymbolPool> pool,
+                            std::set<int> const& tokens) {
+  symbols_ = pool;
+  interned_.clear();
+  for (auto const token : tokens) {
+    if (token <= 0) continue;
+    if (interned_.size() <= static_cast<size_t>(token))
+      interned_.resize(token + 1);
+    interned_[token] = true;
+  }
+}
 
 struct Lexicon::Builder::Building {
   /**
-   * 对上下文没有要求的正则模式
+   * 词法单元的正则模式
    */
-  std::set<Regex> global_patterns_;
+  struct Pattern {
+    /**
+     * 正则模式在 Arena 中的根节点，以导数构造的正则模式不进入 Arena
+     */
+    regex::Arena::Index root = regex::Arena::kNil;
+
+    /**
+     * 化简后的正则模式，以导数构造时使用
+     */
+    Regex regex;
+
+    /**
+     * 正则模式接受的词法记号
+     */
+    int token;
+
+    /**
+     * 正则模式所属的上下文，空表示任意上下文
+     */
+    std::set<int> contexts;
+  };
+
+  /**
+   * 全部正则模式的中间表示，构建完成后一次性释放
+   */
+  regex::Arena arena_;
+
+  /**
+   * 按照定义顺序排列的正则模式
+   */
+  std::vector<Pattern> patterns_;
 
   /**
-   * 全文正则表达式
+   * 词法记号名称到ID的索引，避免定义大量词法记号时逐个比较名称
    */
-  Regex regex_;
+  std::unordered_map<std::string, int> token_ids_;
 
   /**
-   * firstpos与上下文的映射
+   * 每个标识符词法记号的关键字词法记号ID
    */
-  std::map<std::shared_ptr<regex::LeafNode>, std::set<int>> firstpos_ctx_map_;
+  std::map<int, std::vector<int>> keywords_;
 
   /**
    * 构建的词法规则
    */
   std::unique_ptr<Lexicon::Impl> impl_;
 
+  /**
+   * 是否编译为本机代码
+   */
+  bool jit_ = false;
+
+  /**
+   * 状态数量上限，超出时改为模拟位置自动机
+   */
+  size_t state_limit_ = kDefaultStateLimit;
+
+  /**
+   * 是否以导数构造状态机
+   */
+  bool derivatives_ = false;
+
+  /**
+   * 是否构造逆向状态机
+   */
+  bool reverse_ = false;
+
+  /**
+   * 是否在构建后保留本结构，供扩展时复用
+   */
+  bool extensible_ = false;
+
+  /**
+   * 从被扩展的词法规则直接复用的状态数量，不扩展或无法复用时为0
+   */
+  size_t state_base_ = 0;
+
+  /**
+   * 全部状态的位置集合，下标为状态ID
+   * 扩展时从被扩展的构造中复制，新构造不引用被扩展的构造，连续扩展也只有一层
+   */
+  std::vector<regex::Arena::Positions> state_poses_;
+
+  /**
+   * 位置集合到状态ID的映射
+   */
+  std::map<regex::Arena::Positions, int> state_ids_;
+
+  /**
+   * 查找位置集合对应的状态，不存在时返回-1
+   */
+  int FindState(regex::Arena::Positions const& poses) const {
+    auto const it = state_ids_.find(poses);
+    return it == state_ids_.end() ? -1 : it->second;
+  }
+
+  /**
+   * 根据各上下文的首位置构建位置自动机
+   *
+   * @param starts 每个上下文的首位置，下标为上下文ID
+   */
+  void BuildNfa(std::vector<regex::Arena::Positions> const& starts) {
+    auto& impl = *impl_;
+    auto nfa = std::make_unique<Lexicon::Impl::Nfa>();
+
+    // 为所有可到达的位置分配位集中的序号
+    std::map<regex::Arena::Index, size_t> bits;
+    std::vector<regex::Arena::Index> positions;
+    auto const touch = [&](regex::Arena::Index position) {
+      if (bits.emplace(position, positions.size()).second)
+        positions.push_back(position);
+    };
+    for (auto const& poses : starts) {
+      for (auto const position : poses) touch(position);
+    }
+    for (size_t i = 0; i < positions.size(); i++) {
+      for (auto const follow : arena_.FollowposOf(positions[i])) touch(follow);
+    }
+
+    auto const words = nfa->words = (positions.size() + 63) / 64;
+    auto const set = [&](uint64_t* bitset, regex::Arena::Index position) {
+      auto const bit = bits.at(position);
+      bitset[bit / 64] |= uint64_t{1} << (bit % 64);
+    };
+    for (auto const& poses : starts) {
+      auto& start = nfa->starts.emplace_back(words, 0);
+      for (auto const position : poses) set(start.data(), position);
+    }
+
+    nfa->follows.resize(positions.size() * words, 0);
+    nfa->accepts.resize(words, 0);
+    nfa->tokens.resize(positions.size(), 0);
+    for (size_t i = 0; i < positions.size(); i++) {
+      for (auto const follow : arena_.FollowposOf(positions[i])) {
+        set(nfa->follows.data() + i * words, follow);
+      }
+      if (arena_.TypeOf(positions[i]) == regex::Node::kAccept) {
+        set(nfa->accepts.data(), positions[i]);
+        nfa->tokens[i] = arena_.TokenOf(positions[i]);
+      }
+    }
+
+    // 同一等价类中的字节总是被同样的位置接受，只需检查一个代表字节
+    nfa->matches.resize(impl.class_count_ * words, 0);
+    std::vector<bool> visited(impl.class_count_, false);
+    for (auto ch = 1; ch <= 255; ch++) {
+      auto const cls = impl.byte_classes_[ch];
+      if (visited[cls]) continue;
+      visited[cls] = true;
+      for (size_t i = 0; i < positions.size(); i++) {
+        if (arena_.Match(positions[i], ch))
+          set(nfa->matches.data() + cls * words, positions[i]);
+      }
+    }
+
+    impl.starts_.clear();
+    impl.accepts_.clear();
+    impl.transfers_.clear();
+    impl.nfa_ = std::move(nfa);
+  }
+
+  /**
+   * 以 followpos 构造状态机，状态为位置的集合
+   * 扩展已有的词法规则时，已有状态的位置集合与转移都不会改变，
+   * 只需按新的字节等价类重新排列其转移，再从新的首状态开始构造新增的状态
+   * 状态数超出上限时改为构建位置自动机
+   */
+  void BuildByFollowpos() {
+    auto& arena = arena_;
+    auto& impl = *impl_;
+
+    std::vector<int> pending_states;
+
+    // 计算全部位置的followpos，已分析过的位置不会重复分析
+    arena.Analyze();
+
+    // 将字节划分为等价类，字节0不参与任何转移
+    auto const base_classes = impl.byte_classes_;
+    auto const base_class_count = impl.class_count_;
+    auto classes = arena.Classes();
+    for (auto& cls : classes) cls.Reset(0);
+    auto const blocks = regex::Partition(classes);
+    impl.class_count_ = blocks.size();
+    for (size_t i = 0; i < blocks.size(); i++) {
+      blocks[i].ForEach([&](unsigned char ch) { impl.byte_classes_[ch] = i; });
+    }
+
+    auto const add_state = [&](regex::Arena::Positions&& poses) {
+      auto const state_id = static_cast<int>(state_poses_.size());
+      state_ids_.emplace(poses, state_id);
+      state_poses_.push_back(std::move(poses));
+      impl.accepts_.push_back(0);
+      impl.transfers_.resize(impl.transfers_.size() + impl.class_count_, 0);
+      pending_states.push_back(state_id);
+      Anim::LexiconAddState(state_id, arena, state_poses_.back());
+      return state_id;
+    };
+
+    if (state_base_) {
+      // 新的等价类总是旧等价类的细分，以任一成员字节找到其所属的旧等价类
+      std::vector<int> transfers(state_base_ * impl.class_count_);
+      for (size_t state = 0; state < state_base_; state++) {
+        for (size_t cls = 0; cls < impl.class_count_; cls++) {
+          auto const base_cls = base_classes[blocks[cls].Min()];
+          transfers[state * impl.class_count_ + cls] =
+              impl.transfers_[state * base_class_count + base_cls];
+        }
+      }
+      impl.transfers_.swap(transfers);
+    } else {
+      // 起始状态
+      state_poses_.emplace_back();
+      impl.accepts_.push_back(0);
+      impl.transfers_.resize(impl.class_count_, 0);
+      Anim::LexiconAddState(0, arena, {});
+    }
+
+    // 每个上下文拥有一个首位置状态，包含当前上下文能接受的全部首位置
+    impl.starts_.clear();
+    for (size_t ctxid = 0; ctxid < impl.contexts_.size(); ctxid++) {
+      // 计算当前上下文能接受的首位置
+      regex::Arena::Positions poses;
+      for (auto const& pattern : patterns_) {
+        if (!pattern.contexts.empty() && !pattern.contexts.count(ctxid))
+          continue;
+
+        auto const& firstpos = arena.FirstposOf(pattern.root);
+        poses.insert(poses.end(), firstpos.begin(), firstpos.end());
+      }
+      std::sort(poses.begin(), poses.end());
+
+      // 创建首状态，对起始状态来说上下文id被用作输入
+      // 扩展时未引入新首位置的上下文仍使用原来的首状态
+      auto stateid = FindState(poses);
+      if (stateid < 0) stateid = add_state(std::move(poses));
+      impl.starts_.push_back(stateid);
+      Anim::LexiconAddTransfer(0, stateid, ctxid);
+    }
+
+    // 处理尚未处理的状态，状态数量超出上限时放弃构建状态机
+    auto exceeded = false;
+    while (!pending_states.empty()) {
+      if (state_poses_.size() > state_limit_) {
+        exceeded = true;
+        break;
+      }
+
+      // 收集当前状态信息
+      auto const state_id = pending_states.back();
+      auto const current_pos = state_poses_.at(state_id);
+
+      // 将状态标记为已处理
+      pending_states.pop_back();
+
+      // 计算当前状态接受的词法记号
+      for (auto const posit : current_pos) {
+        if (arena.TypeOf(posit) != regex::Node::kAccept) continue;
+
+        auto& accept = impl.accepts_.at(state_id);
+        auto const token_id = arena.TokenOf(posit);
+        // 词法记号ID越小，优先级越高
+        if (accept == 0 || token_id < accept) {
+          accept = token_id;
+          Anim::LexiconSetAccept(state_id, token_id);
+        }
+      }
+
+      // 计算当前状态的出度转移，同一等价类中的字节只需计算一次
+      std::vector<int> targets(impl.class_count_, -1);
+      for (auto ch = 1; ch <= 255; ch++) {
+        auto const cls = impl.byte_classes_[ch];
+        if (targets[cls] < 0) {
+          regex::Arena::Positions followpos;
+
+          // 收集当前输入字符能到达的所有位置
+          for (auto const posit : current_pos) {
+            if (!arena.Match(posit, ch)) continue;
+
+            auto const& follow = arena.FollowposOf(posit);
+            followpos.insert(followpos.end(), follow.begin(), follow.end());
+          }
+          std::sort(followpos.begin(), followpos.end());
+          followpos.erase(std::unique(followpos.begin(), followpos.end()),
+                          followpos.end());
+
+          // 若当前输入字符不能到达任何位置，则没有转移
+          // 否则计算当前输入字符能到达的状态，若尚未创建，则创建之
+          targets[cls] = 0;
+          if (!followpos.empty()) {
+            targets[cls] = FindState(followpos);
+            if (targets[cls] < 0) targets[cls] = add_state(std::move(followpos));
+          }
+          impl.transfers_[state_id * impl.class_count_ + cls] = targets[cls];
+        }
+
+        // 添加转移
+        if (targets[cls] > 0)
+          Anim::LexiconAddTransfer(state_id, targets[cls], ch);
+      }
+    }
+
+    if (exceeded) {
+      std::vector<regex::Arena::Positions> starts;
+      for (auto const start : impl.starts_)
+        starts.push_back(state_poses_.at(start));
+      state_base_ = 0;
+      state_poses_.clear();
+      state_ids_.clear();
+      BuildNfa(starts);
+    }
+  }
+
+  /**
+   * 以导数构造状态机，状态为各正则模式的导数组成的向量
+   * 不属于某个上下文的正则模式在该上下文的首状态中为 kEmpty
+   */
+  void BuildByDerivatives() {
+    using Term = regex::Derivatives::Term;
+    auto& impl = *impl_;
+
+    regex::Derivatives derivatives;
+    std::vector<Term> roots;
+    for (auto const& pattern : patterns_)
+      roots.push_back(derivatives.Of(pattern.regex));
+
+    // 导数中出现的字符集都由原有字符集求并或求交得到，划分原有字符集即可
+    // 补集可以匹配任何字节，字节0需要单独作为一个等价类
+    auto classes = derivatives.Classes();
+    for (auto& cls : classes) cls.Reset(0);
+    classes.push_back(regex::Charset::Of(std::string(1, '\0')));
+    auto const blocks = regex::Partition(classes);
+    impl.class_count_ = blocks.size();
+    for (size_t i = 0; i < blocks.size(); i++) {
+      blocks[i].ForEach([&](unsigned char ch) { impl.byte_classes_[ch] = i; });
+    }
+
+    std::vector<int> pending_states;
+    std::vector<std::vector<Term>> state_terms;
+    std::map<std::vector<Term>, int> state_ids;
+    auto const add_state = [&](std::vector<Term> const& terms) {
+      if (state_terms.size() > state_limit_) {
+        throw std::runtime_error{"Lexicon: too many states"};
+      }
+
+      auto const state_id = static_cast<int>(state_terms.size());
+      state_terms.push_back(terms);
+      state_ids.emplace(terms, state_id);
+      impl.accepts_.push_back(0);
+      impl.transfers_.resize(impl.transfers_.size() + impl.class_count_, 0);
+      pending_states.push_back(state_id);
+      Anim::LexiconAddState(state_id, arena_, {});
+      return state_id;
+    };
+
+    // 起始状态
+    state_terms.emplace_back();
+    impl.accepts_.push_back(0);
+    impl.transfers_.resize(impl.class_count_, 0);
+    Anim::LexiconAddState(0, arena_, {});
+
+    for (size_t ctxid = 0; ctxid < impl.contexts_.size(); ctxid++) {
+      std::vector<Term> terms(patterns_.size(), regex::Derivatives::kEmpty);
+      for (size_t i = 0; i < patterns_.size(); i++) {
+        auto const& contexts = patterns_[i].contexts;
+        if (contexts.empty() || contexts.count(ctxid)) terms[i] = roots[i];
+      }
+
+      auto const it = state_ids.find(terms);
+      auto const stateid =
+          it != state_ids.end() ? it->second : add_state(terms);
+      impl.starts_.push_back(stateid);
+      Anim::LexiconAddTransfer(0, stateid, ctxid);
+    }
+
+    while (!pending_states.empty()) {
+      auto const state_id = pending_states.back();
+      auto const terms = state_terms.at(state_id);
+      pending_states.pop_back();
+
+      // 匹配空串的正则模式中，词法记号ID最小的优先
+      for (size_t i = 0; i < terms.size(); i++) {
+        if (!derivatives.NullableOf(terms[i])) continue;
+
+        auto& accept = impl.accepts_.at(state_id);
+        if (accept == 0 || patterns_[i].token < accept) {
+          accept = patterns_[i].token;
+          Anim::LexiconSetAccept(state_id, accept);
+        }
+      }
+
+      // 以每个等价类的代表字节求导，所有导数均为 kEmpty 时没有转移
+      std::vector<int> targets(impl.class_count_, -1);
+      targets[impl.byte_classes_[0]] = 0;
+      for (auto ch = 1; ch <= 255; ch++) {
+        auto const cls = impl.byte_classes_[ch];
+        if (targets[cls] < 0) {
+          std::vector<Term> derived(terms.size());
+          auto dead = true;
+          for (size_t i = 0; i < terms.size(); i++) {
+            derived[i] = derivatives.Derive(terms[i], ch);
+            dead = dead && derived[i] == regex::Derivatives::kEmpty;
+          }
+
+          targets[cls] = 0;
+          if (!dead) {
+            auto const it = state_ids.find(derived);
+            targets[cls] =
+                it != state_ids.end() ? it->second : add_state(derived);
+          }
+          impl.transfers_[state_id * impl.class_count_ + cls] = targets[cls];
+        }
+
+        if (targets[cls] > 0)
+          Anim::LexiconAddTransfer(state_id, targets[cls], ch);
+      }
+    }
+  }
+
+  /**
+   * 以反转后的正则模式构造逆向状态机
+   * 首状态包含全部位置而不只是首位置，因此能从词法单元的任意位置开始逆向读入
+   * 状态数超出上限时放弃构造
+   */
+  void BuildReverse() {
+    auto& impl = *impl_;
+    regex::Arena arena;
+    std::vector<regex::Arena::Index> roots;
+    for (auto const& pattern : patterns_) {
+      if (pattern.root == regex::Arena::kNil) {
+        throw std::runtime_error{
+            "Reverse automaton does not support intersection or complement"};
+      }
+      auto const root = arena.Lower(regex::Reverse(pattern.regex));
+      arena.Accept(root, std::make_shared<regex::AcceptNode>(pattern.token));
+      roots.push_back(root);
+    }
+    arena.Analyze();
+
+    auto reverse = std::make_unique<Lexicon::Impl::Reverse>();
+    std::vector<int> pending_states;
+    std::vector<regex::Arena::Positions> state_poses;
+    std::map<regex::Arena::Positions, int> state_ids;
+    auto const touch = [&](regex::Arena::Positions&& poses) {
+      if (auto const it = state_ids.find(poses); it != state_ids.end())
+        return it->second;
+
+      auto const state_id = static_cast<int>(state_poses.size());
+      state_ids.emplace(poses, state_id);
+      state_poses.push_back(std::move(poses));
+      reverse->accepts.push_back(false);
+      reverse->transfers.resize(reverse->transfers.size() + impl.class_count_,
+                                0);
+      pending_states.push_back(state_id);
+      return state_id;
+    };
+    touch({});
+
+    for (size_t ctxid = 0; ctxid < impl.contexts_.size(); ctxid++) {
+      // 收集当前上下文中全部词法单元的全部非接受位置
+      regex::Arena::Positions poses;
+      for (size_t i = 0; i < patterns_.size(); i++) {
+        auto const& contexts = patterns_[i].contexts;
+        if (!contexts.empty() && !contexts.count(ctxid)) continue;
+
+        auto const first = poses.size();
+        auto const& firstpos = arena.FirstposOf(roots[i]);
+        poses.insert(poses.end(), firstpos.begin(), firstpos.end());
+        for (auto j = first; j < poses.size(); j++) {
+          for (auto const follow : arena.FollowposOf(poses[j])) {
+            if (std::find(poses.begin() + first, poses.end(), follow) ==
+                poses.end())
+              poses.push_back(follow);
+          }
+        }
+      }
+      poses.erase(std::remove_if(poses.begin(), poses.end(),
+                                 [&](regex::Arena::Index pos) {
+                                   return arena.TypeOf(pos) ==
+                                          regex::Node::kAccept;
+                                 }),
+                  poses.end());
+      std::sort(poses.begin(), poses.end());
+      reverse->starts.push_back(touch(std::move(poses)));
+    }
+
+    while (!pending_states.empty()) {
+      if (state_poses.size() > state_limit_) return;
+
+      auto const state_id = pending_states.back();
+      auto const current_pos = state_poses.at(state_id);
+      pending_states.pop_back();
+
+      for (auto const posit : current_pos) {
+        if (arena.TypeOf(posit) == regex::Node::kAccept)
+          reverse->accepts[state_id] = true;
+      }
+
+      std::vector<bool> visited(impl.class_count_, false);
+      for (auto ch = 1; ch <= 255; ch++) {
+        auto const cls = impl.byte_classes_[ch];
+        if (visited[cls]) continue;
+        visited[cls] = true;
+
+        regex::Arena::Positions followpos;
+        for (auto const posit : current_pos) {
+          if (!arena.Match(posit, ch)) continue;
+
+          auto const& follow = arena.FollowposOf(posit);
+          followpos.insert(followpos.end(), follow.begin(), follow.end());
+        }
+        if (followpos.empty()) continue;
+
+        std::sort(followpos.begin(), followpos.end());
+        followpos.erase(std::unique(followpos.begin(), followpos.end()),
+                        followpos.end());
+        auto const target = touch(std::move(followpos));
+        reverse->transfers[state_id * impl.class_count_ + cls] = target;
+      }
+    }
+
+    impl.reverse_ = std::move(reverse);
+  }
+
   int TouchContext(std::string const& name) {
     for (size_t id = 0; id < impl_->contexts_.size(); id++)
       if (impl_->contexts_.at(id) == name) return id;
@@ -197,16 +1535,72 @@ struct Lexicon::Builder::Building {
   }
 
   int AddToken(std::string const& name) {
-    for (auto& it : impl_->tokens_) {
-      if (it == name) {
-        throw std::runtime_error{"Token " + name + " already exists"};
-      }
+    auto const id = static_cast<int>(impl_->tokens_.size()) + 1;
+    if (!token_ids_.emplace(name, id).second) {
+      throw std::runtime_error{"Token " + name + " already exists"};
     }
     impl_->tokens_.push_back(name);
-    auto id = impl_->tokens_.size();
     Anim::LexiconAddToken(id, name);
     return id;
   }
+
+  /**
+   * 以哈希与位移的方式为一组关键字构建完美哈希表
+   * 关键字较多的桶先放置，若某个桶找不到可用的种子，则扩大槽位后重试
+   */
+  Lexicon::Impl::Keywords BuildKeywords(std::vector<int> const& ids) const {
+    auto const text = [&](int id) -> std::string const& {
+      return impl_->tokens_[id - 1];
+    };
+
+    size_t slot_count = 1;
+    while (slot_count < ids.size()) slot_count <<= 1;
+
+    for (;; slot_count <<= 1) {
+      Lexicon::Impl::Keywords keywords;
+      keywords.seeds.resize(std::max<size_t>(1, ids.size() / 2), 0);
+      keywords.slots.resize(slot_count, 0);
+
+      std::vector<std::vector<int>> buckets(keywords.seeds.size());
+      for (auto const id : ids) {
+        buckets[HashOf(text(id), 0) % buckets.size()].push_back(id);
+      }
+      std::vector<size_t> order(buckets.size());
+      for (size_t i = 0; i < order.size(); i++) order[i] = i;
+      std::stable_sort(order.begin(), order.end(), [&](size_t a, size_t b) {
+        return buckets[a].size() > buckets[b].size();
+      });
+
+      bool placed = true;
+      for (auto const bucket : order) {
+        if (buckets[bucket].empty()) break;
+
+        std::vector<size_t> slots;
+        uint32_t seed = 1;
+        for (; seed < (1U << 16); seed++) {
+          slots.clear();
+          for (auto const id : buckets[bucket]) {
+            auto const slot = HashOf(text(id), seed) & (slot_count - 1);
+            if (keywords.slots[slot] != 0 ||
+                std::find(slots.begin(), slots.end(), slot) != slots.end())
+              break;
+            slots.push_back(slot);
+          }
+          if (slots.size() == buckets[bucket].size()) break;
+        }
+        if (slots.size() != buckets[bucket].size()) {
+          placed = false;
+          break;
+        }
+
+        keywords.seeds[bucket] = seed;
+        for (size_t i = 0; i < slots.size(); i++) {
+          keywords.slots[slots[i]] = buckets[bucket][i];
+        }
+      }
+      if (placed) return keywords;
+    }
+  }
 };
 
 Lexicon::Builder::Builder() {
@@ -215,6 +1609,40 @@ Lexicon::Builder::Builder() {
   building_->impl_->contexts_.emplace_back(kDefaultContext);
 }
 
+Lexicon::Builder::Builder(std::shared_ptr<Lexicon const> const& base) {
+  auto const& origin = base->impl_->origin_;
+  if (!origin) throw std::runtime_error{"Lexicon is not extensible"};
+
+  building_ = std::make_unique<Building>();
+  building_->arena_ = origin->arena_;
+  building_->patterns_ = origin->patterns_;
+  building_->jit_ = origin->jit_;
+  building_->state_limit_ = origin->state_limit_;
+  building_->derivatives_ = origin->derivatives_;
+  building_->reverse_ = origin->reverse_;
+  building_->extensible_ = true;
+
+  auto const& impl = *base->impl_;
+  building_->impl_ = std::make_unique<Lexicon::Impl>();
+  auto& extended = *building_->impl_;
+  extended.tokens_ = impl.tokens_;
+  for (size_t off = 0; off < impl.tokens_.size(); off++)
+    building_->token_ids_.emplace(impl.tokens_[off], off + 1);
+  extended.contexts_ = impl.contexts_;
+  extended.keywords_ = impl.keywords_;
+
+  // 只有以 followpos 构造的状态机能被复用，否则重新构造
+  if (!origin->derivatives_ && !impl.nfa_) {
+    building_->state_base_ = impl.accepts_.size();
+    building_->state_poses_ = origin->state_poses_;
+    building_->state_ids_ = origin->state_ids_;
+    extended.byte_classes_ = impl.byte_classes_;
+    extended.class_count_ = impl.class_count_;
+    extended.accepts_ = impl.accepts_;
+    extended.transfers_ = impl.transfers_;
+  }
+}
+
 Lexicon::Builder::~Builder() {}
 
 Lexicon::Builder& Lexicon::Builder::DefineToken(
@@ -222,140 +1650,158 @@ Lexicon::Builder& Lexicon::Builder::DefineToken(
     std::optional<std::set<std::string>> const& context) {
   int token_id = building_->AddToken(name);
 
-  (void)regex::Accept(pattern, token_id);
-
-  if (context && !context->empty()) {
-    auto ctx_ids = building_->TouchContexts(*context);
-
-    for (auto const& it : pattern->GetFirstpos())
-      building_->firstpos_ctx_map_[it] = ctx_ids;
-  } else {
-    building_->global_patterns_.insert(pattern);
-  }
+  pattern = regex::Simplify(pattern);
+  auto& added = building_->patterns_.emplace_back();
+  added.regex = pattern;
+  added.token = token_id;
 
-  if (building_->regex_ == nullptr) {
-    building_->regex_ = pattern;
+  // 交集与补集没有 followpos，只能以导数构造
+  if (regex::NeedsDerivatives(pattern)) {
+    building_->derivatives_ = true;
   } else {
-    building_->regex_ = regex::Union(building_->regex_, pattern);
+    auto const accept = regex::Accept(pattern, token_id);
+    added.root = building_->arena_.Lower(pattern);
+    building_->arena_.Accept(added.root, accept);
   }
+  if (context && !context->empty())
+    added.contexts = building_->TouchContexts(*context);
 
   return *this;
 }
 
-std::shared_ptr<Lexicon> Lexicon::Builder::Build() {
-  auto& regex_ = building_->regex_;
-  auto& firstpos_ctx_map_ = building_->firstpos_ctx_map_;
-
-  // 补全全局正则表达式的firstpos与上下文的映射
-  for (auto const& it : building_->global_patterns_) {
-    for (auto const& firstpos : it->GetFirstpos()) {
-      auto& map = firstpos_ctx_map_[firstpos];
-      for (auto i = building_->impl_->contexts_.size(); i > 0; --i)
-        map.insert(i - 1);
-    }
+Lexicon::Builder& Lexicon::Builder::DefineKeywords(
+    std::string const& identifier, std::vector<std::string> const& keywords) {
+  auto const it = building_->token_ids_.find(identifier);
+  if (it == building_->token_ids_.end()) {
+    throw std::runtime_error{"Token " + identifier + " not defined"};
   }
 
-  std::vector<int> pending_states;
-  std::map<int, regex::LeafNodes> state_pos_map;
+  auto const identifier_id = it->second;
+  auto& ids = building_->keywords_[identifier_id];
+  for (auto const& keyword : keywords) {
+    ids.push_back(building_->AddToken(keyword));
+  }
 
-  {
-    // 起始状态
-    building_->impl_->states_.emplace_back();
-    Anim::LexiconAddState(0, {});
+  return *this;
+}
 
-    // 计算全部位置的followpos
-    regex_->CalcFollowpos();
+Lexicon::Builder& Lexicon::Builder::LimitStates(size_t limit) {
+  building_->state_limit_ = limit;
+  return *this;
+}
 
-    // 每个上下文拥有一个首位置状态，包含当前上下文能接受的全部首位置
-    for (size_t ctxid = 0; ctxid < building_->impl_->contexts_.size();
-         ctxid++) {
-      // 创建首状态
-      auto const stateid = building_->impl_->states_.size();
-      pending_states.push_back(stateid);
-      building_->impl_->states_.emplace_back();
+Lexicon::Builder& Lexicon::Builder::EnableJit() {
+  building_->jit_ = true;
+  return *this;
+}
 
-      // 对起始状态来说上下文id被用作输入
-      building_->impl_->states_.front().transfer.emplace(ctxid, stateid);
+Lexicon::Builder& Lexicon::Builder::UseDerivatives() {
+  building_->derivatives_ = true;
+  return *this;
+}
 
-      // 计算当前上下文能接受的首位置
-      for (auto const& posit : regex_->GetFirstpos()) {
-        auto it = firstpos_ctx_map_.find(posit);
-        if (it != firstpos_ctx_map_.end() && 0 == it->second.count(ctxid))
-          continue;
+Lexicon::Builder& Lexicon::Builder::EnableReverse() {
+  building_->reverse_ = true;
+  return *this;
+}
 
-        state_pos_map[stateid].insert(posit);
-      }
+Lexicon::Builder& Lexicon::Builder::EnableExtension() {
+  building_->extensible_ = true;
+  return *this;
+}
 
-      Anim::LexiconAddState(stateid, state_pos_map[stateid]);
-      Anim::LexiconAddTransfer(0, stateid, ctxid);
-    }
+std::shared_ptr<Lexicon> Lexicon::Builder::Build() {
+  auto& impl = *building_->impl_;
+  if (building_->derivatives_) {
+    building_->BuildByDerivatives();
+  } else {
+    building_->BuildByFollowpos();
   }
+  if (building_->reverse_) building_->BuildReverse();
 
-  // 处理尚未处理的状态
-  while (!pending_states.empty()) {
-    // 收集当前状态信息
-    auto const state_id = pending_states.back();
-    auto const& current_pos = state_pos_map.at(state_id);
-
-    // 将状态标记为已处理
-    pending_states.pop_back();
-
-    // 计算当前状态接受的词法记号
-    for (auto const& posit : current_pos) {
-      if (auto accept = std::dynamic_pointer_cast<regex::AcceptNode>(posit);
-          accept != nullptr) {
-        auto& state = building_->impl_->states_.at(state_id);
-        // 词法记号ID越小，优先级越高
-        if (!state.accept || accept->token_id_ < state.accept) {
-          state.accept = accept->token_id_;
-          Anim::LexiconSetAccept(state_id, accept->token_id_);
+  // 计算每个上下文的首字节
+  for (size_t ctxid = 0; ctxid < impl.contexts_.size(); ctxid++) {
+    auto& leaders = impl.leaders_.emplace_back();
+    leaders.fill(0);
+    for (auto ch = 1; ch <= 255; ch++) {
+      auto const cls = impl.byte_classes_[ch];
+      if (impl.nfa_) {
+        auto const& nfa = *impl.nfa_;
+        for (size_t w = 0; w < nfa.words; w++) {
+          leaders[ch] |=
+              (nfa.starts[ctxid][w] & nfa.matches[cls * nfa.words + w]) != 0;
         }
+      } else {
+        leaders[ch] =
+            impl.transfers_[impl.starts_[ctxid] * impl.class_count_ + cls] != 0;
       }
     }
+  }
 
-    // 计算当前状态的出度转移
-    for (auto ch = 1; ch <= 255; ch++) {
-      regex::LeafNodes followpos;
-
-      // 收集当前输入字符能到达的所有位置
-      for (auto it : current_pos) {
-        if (!it->Match(ch)) continue;
-
-        followpos.insert(it->followpos_.begin(), it->followpos_.end());
-      }
-
-      // 若当前输入字符不能到达任何位置，则跳过
-      if (followpos.empty()) continue;
-
-      // 计算当前输入字符能到达的状态
-      int next_state_id = 0;
-      for (auto const& [candidate_state_id, candidate_state_pos] :
-           state_pos_map) {
-        if (candidate_state_pos != followpos) continue;
-
-        next_state_id = candidate_state_id;
-        break;
+  // 构建关键字表，关键字必须在某个上下文中被其标识符完整匹配
+  impl.keywords_.resize(impl.tokens_.size());
+  for (auto const& [identifier, ids] : building_->keywords_) {
+    for (auto const id : ids) {
+      auto const& text = impl.tokens_[id - 1];
+      auto matched = false;
+      for (size_t ctxid = 0; ctxid < impl.contexts_.size(); ctxid++) {
+        auto const scanned = impl.Scan(ctxid, text);
+        if (scanned.accept_end == text.size() &&
+            scanned.accept == identifier) {
+          matched = true;
+          break;
+        }
       }
-
-      // 若当前输入字符能到达的状态尚未创建，则创建之
-      if (next_state_id == 0) {
-        next_state_id = building_->impl_->states_.size();
-        pending_states.push_back(next_state_id);
-        building_->impl_->states_.emplace_back();
-        state_pos_map.emplace(next_state_id, followpos);
-        Anim::LexiconAddState(next_state_id, followpos);
+      if (!matched) {
+        throw std::runtime_error{"Keyword " + text + " is not a " +
+                                 impl.tokens_[identifier - 1]};
       }
+    }
+    if (ids.empty()) continue;
 
-      // 添加转移
-      building_->impl_->states_.at(state_id).transfer.emplace(ch,
-                                                              next_state_id);
-      Anim::LexiconAddTransfer(state_id, next_state_id, ch);
+    // 扩展时保留被扩展的词法规则中已有的关键字
+    auto all = ids;
+    for (auto const slot : impl.keywords_[identifier - 1].slots) {
+      if (slot != 0) all.push_back(slot);
     }
+    impl.keywords_[identifier - 1] = building_->BuildKeywords(all);
+  }
+
+  auto const transfer = [&](int state, uint8_t input) {
+    return impl.transfers_[state * impl.class_count_ +
+                           impl.byte_classes_[input]];
+  };
+  if (!impl.nfa_) {
+    if (building_->jit_) impl.jit_ = Jit::Compile(impl.accepts_, transfer);
+    impl.shuffle_ = Shuffle::Compile(impl.accepts_, transfer);
+  }
+
+  // 指纹只取决于影响分析结果的表，与是否编译为本机代码等执行方式无关
+  auto fingerprint = Mix(14695981039346656037ULL, impl.tokens_);
+  fingerprint = Mix(fingerprint, impl.contexts_);
+  fingerprint = Mix(fingerprint, impl.byte_classes_.data(),
+                    impl.byte_classes_.size());
+  fingerprint = Mix(fingerprint, impl.starts_);
+  fingerprint = Mix(fingerprint, impl.accepts_);
+  fingerprint = Mix(fingerprint, impl.transfers_);
+  for (auto const& keywords : impl.keywords_) {
+    fingerprint = Mix(fingerprint, keywords.seeds);
+    fingerprint = Mix(fingerprint, keywords.slots);
+  }
+  if (impl.nfa_) {
+    auto const& nfa = *impl.nfa_;
+    for (auto const& starts : nfa.starts) fingerprint = Mix(fingerprint, starts);
+    fingerprint = Mix(fingerprint, nfa.matches);
+    fingerprint = Mix(fingerprint, nfa.follows);
+    fingerprint = Mix(fingerprint, nfa.accepts);
+    fingerprint = Mix(fingerprint, nfa.tokens);
   }
+  impl.fingerprint_ = fingerprint;
 
-  auto lexicon = std::make_shared<Lexicon>(std::move(building_->impl_));
+  auto built = std::move(building_->impl_);
+  if (building_->extensible_) built->origin_ = std::move(building_);
   building_.reset();
-  return lexicon;
+  return std::make_shared<Lexicon>(std::move(built));
 }
 
 }  // namespace toylang
\ No newline at end of file
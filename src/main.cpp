@@ -1,12 +1,141 @@
 #ifndef UNIT_TEST
 
+#include <cstdio>
+#include <cstring>
+#include <fstream>
+#include <iostream>
+
+#include "nlohmann/json.hpp"
 #include "toylang/anim.h"
+#include "toylang/dump.h"
+
+namespace {
+
+constexpr char kDumpUsage[] =
+    "usage: toylang --dump-tokens <lexicon.json> <source|-> "
+    "[--format jsonl|binary] [--fields id,name,offset,length,line,column,text] "
+    "[--context <name>]\n";
+
+/**
+ * 从 JSON 文件加载词法规则
+ * tokens 可以是名称到正则表达式的对象，也可以是 [名称, 正则表达式] 的数组，
+ * 对象的键按字典序排列，需要指定优先级时应使用数组
+ */
+std::shared_ptr<toylang::Lexicon const> LoadLexicon(char const* path) {
+  std::ifstream file{path};
+  if (!file.is_open()) return nullptr;
+  auto const json = nlohmann::json::parse(file);
+
+  toylang::Lexicon::Builder builder;
+  auto const& tokens = json.at("tokens");
+  if (tokens.is_array()) {
+    for (auto const& token : tokens) {
+      auto const pattern = token.at(1).get<std::string>();
+      builder.DefineToken(token.at(0).get<std::string>(),
+                          toylang::regex::Compile(pattern));
+    }
+  } else {
+    for (auto const& [name, pattern] : tokens.items()) {
+      builder.DefineToken(name,
+                          toylang::regex::Compile(pattern.get<std::string>()));
+    }
+  }
+  if (json.count("keywords")) {
+    for (auto const& [name, keywords] : json.at("keywords").items()) {
+      builder.DefineKeywords(name, keywords.get<std::vector<std::string>>());
+    }
+  }
+  return builder.Build();
+}
+
+/**
+ * 分析源码并将词法单元写入标准输出
+ */
+int DumpTokens(int argc, char** argv) {
+  if (argc < 4) {
+    std::cerr << kDumpUsage;
+    return 1;
+  }
+
+  auto format = toylang::TokenWriter::Format::kJsonLines;
+  unsigned fields = toylang::TokenWriter::kAllFields;
+  std::string context = toylang::Lexicon::kDefaultContext;
+  for (int i = 4; i < argc; i += 2) {
+    if (i + 1 >= argc) {
+      std::cerr << kDumpUsage;
+      return 1;
+    }
+    if (std::strcmp(argv[i], "--format") == 0 &&
+        std::strcmp(argv[i + 1], "jsonl") == 0) {
+      format = toylang::TokenWriter::Format::kJsonLines;
+    } else if (std::strcmp(argv[i], "--format") == 0 &&
+               std::strcmp(argv[i + 1], "binary") == 0) {
+      format = toylang::TokenWriter::Format::kBinary;
+    } else if (std::strcmp(argv[i], "--fields") == 0) {
+      auto const parsed = toylang::TokenWriter::ParseFields(argv[i + 1]);
+      if (!parsed) {
+        std::cerr << "invalid fields " << argv[i + 1] << std::endl;
+        return 1;
+      }
+      fields = *parsed;
+    } else if (std::strcmp(argv[i], "--context") == 0) {
+      context = argv[i + 1];
+    } else {
+      std::cerr << kDumpUsage;
+      return 1;
+    }
+  }
+
+  auto const lexicon = LoadLexicon(argv[2]);
+  if (!lexicon) {
+    std::cerr << "failed to open " << argv[2] << std::endl;
+    return 1;
+  }
+  auto const source = toylang::Source::Load(argv[3]);
+  if (!source) {
+    std::cerr << "failed to open " << argv[3] << std::endl;
+    return 1;
+  }
+
+  toylang::Scanner scanner;
+  scanner.SetLexicon(lexicon);
+  scanner.SetSource(source);
+  scanner.SetContext(context);
+  toylang::TokenWriter writer{lexicon, stdout, format, fields};
+  for (auto token = scanner.NextToken(); token.id != toylang::Token::kEOF;
+       token = scanner.NextToken()) {
+    writer.Write(token);
+  }
+  return writer.Flush() ? 0 : 1;
+}
+
+}  // namespace
 
 int main(int argc, char **argv) {
+  // 将二进制动画记录转换为 JSON 格式
+  if (argc == 3 && std::strcmp(argv[1], "--anim-json") == 0) {
+    std::ifstream record{argv[2], std::ios::binary};
+    if (!record.is_open()) {
+      std::cerr << "failed to open " << argv[2] << std::endl;
+      return 1;
+    }
+    toylang::Anim::Convert(record, std::cerr);
+    return 0;
+  }
+
+  if (argc >= 2 && std::strcmp(argv[1], "--dump-tokens") == 0) {
+    try {
+      return DumpTokens(argc, argv);
+    } catch (std::exception const& e) {
+      std::cerr << e.what() << std::endl;
+      return 1;
+    }
+  }
+
   if (getenv("TOYLANG_ANIM") != nullptr) {
     return toylang::Anim::main(argc, argv);
   }
   return 0;
 }
 
-#endif
\ No newline at end of file
+#endif
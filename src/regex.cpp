@@ -1,10 +1,15 @@
 #include "toylang/regex.h"
 
+#include <algorithm>
+#include <cctype>
+#include <iterator>
 #include <map>
+#include <optional>
 #include <tuple>
 #include <variant>
 #include <vector>
 
+#include "spdlog/fmt/fmt.h"
 #include "toylang/anim.h"
 
 // #include "toylang/hex.h"
@@ -14,25 +19,13 @@ namespace toylang::regex {
 namespace {
 
 /** 字符集 */
-std::set<char> char_range_digit = {'0', '1', '2', '3', '4',
-                                   '5', '6', '7', '8', '9'};
-std::set<char> char_range_lower = {'a', 'b', 'c', 'd', 'e', 'f', 'g', 'h', 'i',
-                                   'j', 'k', 'l', 'm', 'n', 'o', 'p', 'q', 'r',
-                                   's', 't', 'u', 'v', 'w', 'x', 'y', 'z'};
-std::set<char> char_range_upper = {'A', 'B', 'C', 'D', 'E', 'F', 'G', 'H', 'I',
-                                   'J', 'K', 'L', 'M', 'N', 'O', 'P', 'Q', 'R',
-                                   'S', 'T', 'U', 'V', 'W', 'X', 'Y', 'Z'};
-std::set<char> char_range_punct = {'!', '"', '#', '$', '%', '&', '\'', '(',
-                                   ')', '*', '+', ',', '-', '.', '/',  ':',
-                                   ';', '<', '=', '>', '?', '@', '[',  '\\',
-                                   ']', '^', '_', '`', '{', '|', '}',  '~'};
-std::set<char> char_range_space = {'\t', '\n', '\v', '\f', '\r', ' '};
-std::set<char> char_range_word = {
-    '_', 'a', 'b', 'c', 'd', 'e', 'f', 'g', 'h', 'i', 'j', 'k', 'l',
-    'm', 'n', 'o', 'p', 'q', 'r', 's', 't', 'u', 'v', 'w', 'x', 'y',
-    'z', 'A', 'B', 'C', 'D', 'E', 'F', 'G', 'H', 'I', 'J', 'K', 'L',
-    'M', 'N', 'O', 'P', 'Q', 'R', 'S', 'T', 'U', 'V', 'W', 'X', 'Y',
-    'Z', '0', '1', '2', '3', '4', '5', '6', '7', '8', '9'};
+Charset const char_range_digit = Charset::Range('0', '9');
+Charset const char_range_lower = Charset::Range('a', 'z');
+Charset const char_range_upper = Charset::Range('A', 'Z');
+Charset const char_range_punct = Charset::Of("!\"#$%&'()*+,-./:;<=>?@[\\]^_`{|}~");
+Charset const char_range_space = Charset::Of("\t\n\v\f\r ");
+Charset const char_range_word =
+    char_range_lower | char_range_upper | char_range_digit | Charset::Of("_");
 
 /** 转义字符映射表 */
 std::map<char, std::string> str_escape_table = {
@@ -48,8 +41,7 @@ std::map<char, char> char_escape_table = {{'a', '\a'}, {'b', '\b'},
                                           {'r', '\r'}, {'t', '\t'}};
 
 /** 字符类映射表 */
-std::map<char, std::tuple<RangeNode::Direction, std::set<char>>>
-    char_class_table = {
+std::map<char, std::tuple<RangeNode::Direction, Charset>> char_class_table = {
         {'D', {RangeNode::kNegative, char_range_digit}},
         {'d', {RangeNode::kPositive, char_range_digit}},
         {'L', {RangeNode::kNegative, char_range_lower}},
@@ -64,114 +56,243 @@ std::map<char, std::tuple<RangeNode::Direction, std::set<char>>>
         {'w', {RangeNode::kPositive, char_range_word}},
 };
 
-std::set<char> operator_table = {'*', '+', '?', '|', '(', ')'};
+std::set<char> operator_table = {'*', '+', '?', '|', '&', '~', '(', ')'};
 
 }  // namespace
 
-void LeafNode::CalcFollowpos() { /* do nothing */ }
+std::vector<Charset> Partition(std::vector<Charset> const& sets) {
+  std::vector<Charset> blocks{Charset::All()};
+  for (auto const& set : sets) {
+    std::vector<Charset> refined;
+    refined.reserve(blocks.size() * 2);
+    for (auto const& block : blocks) {
+      auto const inside = block & set;
+      auto const outside = block - set;
+      if (!inside.Empty()) refined.push_back(inside);
+      if (!outside.Empty()) refined.push_back(outside);
+    }
+    blocks.swap(refined);
+  }
 
-bool AcceptNode::GetNullable() {
-  throw std::logic_error("AcceptNode::GetNullable()");
-}
-LeafNodes AcceptNode::GetFirstpos() {
-  throw std::logic_error("AcceptNode::GetFirstpos()");
-}
-LeafNodes AcceptNode::GetLastpos() {
-  throw std::logic_error("AcceptNode::GetLastpos()");
-}
-bool AcceptNode::Match(char input) {
-  (void)input;
-  return false;
+  std::sort(blocks.begin(), blocks.end(),
+            [](Charset const& lhs, Charset const& rhs) {
+              return lhs.Min() < rhs.Min();
+            });
+  return blocks;
 }
 
-bool CharNode::GetNullable() { return false; }
-LeafNodes CharNode::GetFirstpos() {
-  return {std::dynamic_pointer_cast<LeafNode>(shared_from_this())};
-}
-LeafNodes CharNode::GetLastpos() {
-  return {std::dynamic_pointer_cast<LeafNode>(shared_from_this())};
-}
-bool CharNode::Match(char ch) { return ch_ == ch; }
+namespace {
 
-bool RangeNode::GetNullable() { return false; }
-LeafNodes RangeNode::GetFirstpos() {
-  return {std::dynamic_pointer_cast<LeafNode>(shared_from_this())};
-}
-LeafNodes RangeNode::GetLastpos() {
-  return {std::dynamic_pointer_cast<LeafNode>(shared_from_this())};
-}
-bool RangeNode::Match(char ch) {
-  if (dir_ == kNegative)
-    return !set_.count(ch);
-  else
-    return set_.count(ch);
-}
-bool ConcatNode::GetNullable() {
-  return left_->GetNullable() && right_->GetNullable();
+/** 根据方向计算字符类实际匹配的字符 */
+void Seal(RangeNode& node) {
+  node.bits_ = node.dir_ == RangeNode::kNegative ? ~node.set_ : node.set_;
 }
-LeafNodes ConcatNode::GetFirstpos() {
-  auto set = left_->GetFirstpos();
-  if (left_->GetNullable()) set.merge(right_->GetFirstpos());
-  return set;
-}
-LeafNodes ConcatNode::GetLastpos() {
-  auto set = right_->GetLastpos();
-  if (right_->GetNullable()) set.merge(left_->GetLastpos());
-  return set;
-}
-void ConcatNode::CalcFollowpos() {
-  left_->CalcFollowpos();
-  right_->CalcFollowpos();
 
-  for (auto& node : left_->GetLastpos()) {
-    node->followpos_.merge(right_->GetFirstpos());
+/** 合并两个有序位置集合 */
+void MergeInto(Arena::Positions& dst, Arena::Positions const& src) {
+  if (src.empty()) return;
+  if (dst.empty()) {
+    dst = src;
+    return;
   }
+
+  Arena::Positions merged;
+  merged.reserve(dst.size() + src.size());
+  std::set_union(dst.begin(), dst.end(), src.begin(), src.end(),
+                 std::back_inserter(merged));
+  dst.swap(merged);
 }
 
-bool UnionNode::GetNullable() {
-  return left_->GetNullable() || right_->GetNullable();
+/** 书写字符类，仅用于展示 */
+std::string WritingOf(RangeNode::Direction dir, Charset const& set) {
+  auto const write = [](std::string& writing, unsigned char ch) {
+    if (auto it = str_escape_table.find(ch); it != str_escape_table.end()) {
+      writing += it->second;
+    } else if (ch < 0x20 || ch >= 0x7f) {
+      writing += fmt::format("\\x{:02x}", ch);
+    } else {
+      if (ch == '-' || ch == '^') writing += '\\';
+      writing += ch;
+    }
+  };
+
+  // 连续三个及以上的字符书写为范围
+  std::string writing = dir == RangeNode::kNegative ? "[^" : "[";
+  for (unsigned ch = 0; ch < 256; ch++) {
+    if (!set.Test(ch)) continue;
+
+    auto last = ch;
+    while (last + 1 < 256 && set.Test(last + 1)) last++;
+    write(writing, ch);
+    if (last >= ch + 2) writing += '-';
+    if (last >= ch + 1) write(writing, last);
+    ch = last;
+  }
+  return writing + "]";
 }
-LeafNodes UnionNode::GetFirstpos() {
-  auto set = left_->GetFirstpos();
-  set.merge(right_->GetFirstpos());
-  return set;
+
+/** 使用同类二元节点将操作数连接为左深树 */
+Regex Fold(Node::Type type, std::vector<Regex> const& operands) {
+  auto result = operands.front();
+  for (size_t i = 1; i < operands.size(); i++) {
+    if (type == Node::kConcat) {
+      auto const node = std::make_shared<ConcatNode>();
+      node->left_ = result;
+      node->right_ = operands[i];
+      result = node;
+    } else {
+      auto const node = std::make_shared<UnionNode>();
+      node->left_ = result;
+      node->right_ = operands[i];
+      result = node;
+    }
+  }
+  return result;
 }
-LeafNodes UnionNode::GetLastpos() {
-  auto set = left_->GetLastpos();
-  set.merge(right_->GetLastpos());
-  return set;
+
+}  // namespace
+
+Arena::Index Arena::Add(Item const& item) {
+  items_.push_back(item);
+  return items_.size() - 1;
 }
-void UnionNode::CalcFollowpos() {
-  left_->CalcFollowpos();
-  right_->CalcFollowpos();
+
+Arena::Index Arena::Lower(Regex const& regex) {
+  owners_.push_back(regex);
+  return LowerNode(*regex);
 }
 
-bool KleeneNode::GetNullable() { return true; }
-LeafNodes KleeneNode::GetFirstpos() { return child_->GetFirstpos(); }
-LeafNodes KleeneNode::GetLastpos() { return child_->GetLastpos(); }
-void KleeneNode::CalcFollowpos() {
-  child_->CalcFollowpos();
+Arena::Index Arena::LowerNode(Node const& root) {
+  // 以显式栈后序遍历，子节点总是先于父节点存放
+  std::vector<std::pair<Node const*, bool>> stack{{&root, false}};
+  std::vector<Index> lowered;
+  while (!stack.empty()) {
+    auto const [node, expanded] = stack.back();
+    stack.pop_back();
+    if (node->type() == Node::kIntersect || node->type() == Node::kComplement) {
+      throw std::logic_error(
+          "Lower: intersection and complement need derivatives");
+    }
+
+    auto const [left, right] = ChildrenOf(*node);
+    if (!expanded && left) {
+      stack.push_back({node, true});
+      if (right) stack.push_back({right->get(), false});
+      stack.push_back({left->get(), false});
+      continue;
+    }
 
-  for (auto& node : child_->GetLastpos()) {
-    node->followpos_.merge(child_->GetFirstpos());
+    Item item{.type = node->type(),
+              .lhs = kNil,
+              .rhs = kNil,
+              .cls = kNil,
+              .token_id = 0,
+              .origin = node};
+    switch (item.type) {
+      case Node::kAccept:
+        item.token_id = static_cast<AcceptNode const&>(*node).token_id_;
+        break;
+      case Node::kChar:
+        item.cls = Intern(static_cast<CharNode const&>(*node).Bits());
+        break;
+      case Node::kRange:
+        item.cls = Intern(static_cast<RangeNode const&>(*node).Bits());
+        break;
+      default:
+        if (right) {
+          item.rhs = lowered.back();
+          lowered.pop_back();
+        }
+        item.lhs = lowered.back();
+        lowered.pop_back();
+        break;
+    }
+    lowered.push_back(Add(item));
   }
+  return lowered.back();
 }
 
-bool PositiveNode::GetNullable() { return child_->GetNullable(); }
-LeafNodes PositiveNode::GetFirstpos() { return child_->GetFirstpos(); }
-LeafNodes PositiveNode::GetLastpos() { return child_->GetLastpos(); }
-void PositiveNode::CalcFollowpos() {
-  child_->CalcFollowpos();
+Arena::Index Arena::Accept(Index regex,
+                           std::shared_ptr<AcceptNode> const& accept) {
+  owners_.push_back(accept);
+  return Add({.type = Node::kAccept,
+              .lhs = regex,
+              .rhs = kNil,
+              .cls = kNil,
+              .token_id = accept->token_id_,
+              .origin = accept.get()});
+}
 
-  for (auto& node : child_->GetLastpos()) {
-    node->followpos_.merge(child_->GetFirstpos());
+void Arena::Analyze() {
+  auto const analyzed = nullable_.size();
+  nullable_.resize(items_.size());
+  firstpos_.resize(items_.size());
+  lastpos_.resize(items_.size());
+  followpos_.resize(items_.size());
+
+  // 子节点总是先于父节点存放，按下标顺序处理时子节点已分析完毕
+  for (auto i = static_cast<Index>(analyzed); i < items_.size(); i++) {
+    auto const& item = items_[i];
+    switch (item.type) {
+      case Node::kAccept:
+        // 接受节点是其所接受的正则表达式所有末位置的后继
+        if (item.lhs != kNil) {
+          for (auto pos : lastpos_[item.lhs]) followpos_[pos].push_back(i);
+        }
+        [[fallthrough]];
+      case Node::kChar:
+      case Node::kRange:
+        nullable_[i] = false;
+        firstpos_[i] = {i};
+        lastpos_[i] = {i};
+        break;
+      case Node::kConcat:
+        nullable_[i] = nullable_[item.lhs] && nullable_[item.rhs];
+        firstpos_[i] = firstpos_[item.lhs];
+        if (nullable_[item.lhs]) MergeInto(firstpos_[i], firstpos_[item.rhs]);
+        lastpos_[i] = lastpos_[item.rhs];
+        if (nullable_[item.rhs]) MergeInto(lastpos_[i], lastpos_[item.lhs]);
+        for (auto pos : lastpos_[item.lhs])
+          MergeInto(followpos_[pos], firstpos_[item.rhs]);
+        break;
+      case Node::kUnion:
+        nullable_[i] = nullable_[item.lhs] || nullable_[item.rhs];
+        firstpos_[i] = firstpos_[item.lhs];
+        MergeInto(firstpos_[i], firstpos_[item.rhs]);
+        lastpos_[i] = lastpos_[item.lhs];
+        MergeInto(lastpos_[i], lastpos_[item.rhs]);
+        break;
+      case Node::kKleene:
+      case Node::kPositive:
+        nullable_[i] = item.type == Node::kKleene || nullable_[item.lhs];
+        firstpos_[i] = firstpos_[item.lhs];
+        lastpos_[i] = lastpos_[item.lhs];
+        for (auto pos : lastpos_[item.lhs])
+          MergeInto(followpos_[pos], firstpos_[item.lhs]);
+        break;
+      case Node::kOptional:
+        nullable_[i] = true;
+        firstpos_[i] = firstpos_[item.lhs];
+        lastpos_[i] = lastpos_[item.lhs];
+        break;
+      case Node::kIntersect:
+      case Node::kComplement:
+        throw std::logic_error("Analyze: unexpected derivative-only node");
+    }
   }
 }
 
-bool OptionalNode::GetNullable() { return true; }
-LeafNodes OptionalNode::GetFirstpos() { return child_->GetFirstpos(); }
-LeafNodes OptionalNode::GetLastpos() { return child_->GetLastpos(); }
-void OptionalNode::CalcFollowpos() { child_->CalcFollowpos(); }
+Arena::Index Arena::Intern(Charset const& cls) {
+  auto [it, created] = class_ids_.emplace(cls, classes_.size());
+  if (created) classes_.push_back(cls);
+  return it->second;
+}
+
+bool Arena::Match(Index node, char input) const {
+  auto const cls = items_[node].cls;
+  if (cls == kNil) return false;
+  return classes_[cls].Test(input);
+}
 
 /** 泛型输入单元 */
 struct Unit {
@@ -190,111 +311,391 @@ struct Unit {
   bool operator!=(char ch) { return !(*this == ch); }
 };
 
+namespace {
+
+/** 码点范围，闭区间 */
+using CodeRange = std::pair<char32_t, char32_t>;
+
+/** 字节范围，闭区间 */
+using ByteRange = std::pair<unsigned char, unsigned char>;
+
+/** 将码点编码为UTF-8字节序列 */
+std::string EncodeUtf8(char32_t code) {
+  std::string bytes;
+  if (code < 0x80) {
+    bytes += static_cast<char>(code);
+  } else if (code < 0x800) {
+    bytes += static_cast<char>(0xC0 | (code >> 6));
+    bytes += static_cast<char>(0x80 | (code & 0x3F));
+  } else if (code < 0x10000) {
+    bytes += static_cast<char>(0xE0 | (code >> 12));
+    bytes += static_cast<char>(0x80 | ((code >> 6) & 0x3F));
+    bytes += static_cast<char>(0x80 | (code & 0x3F));
+  } else {
+    bytes += static_cast<char>(0xF0 | (code >> 18));
+    bytes += static_cast<char>(0x80 | ((code >> 12) & 0x3F));
+    bytes += static_cast<char>(0x80 | ((code >> 6) & 0x3F));
+    bytes += static_cast<char>(0x80 | (code & 0x3F));
+  }
+  return bytes;
+}
+
+/**
+ * 尝试从start位置解码一个多字节UTF-8字符
+ * 不合法的序列不被解码，其中的字节仍被当作单独的字节处理
+ *
+ * @return 码点与其占用的字节数
+ */
+std::optional<std::pair<char32_t, size_t>> DecodeUtf8(
+    std::vector<Unit> const& input, size_t const start) {
+  if (!input[start].IsChar()) return std::nullopt;
+
+  auto const lead = static_cast<unsigned char>(input[start].GetChar());
+  size_t size = 0;
+  char32_t code = 0;
+  if (lead >= 0xC2 && lead <= 0xDF) {
+    size = 2;
+    code = lead & 0x1F;
+  } else if (lead >= 0xE0 && lead <= 0xEF) {
+    size = 3;
+    code = lead & 0x0F;
+  } else if (lead >= 0xF0 && lead <= 0xF4) {
+    size = 4;
+    code = lead & 0x07;
+  } else {
+    return std::nullopt;
+  }
+
+  if (start + size > input.size()) return std::nullopt;
+  for (size_t i = 1; i < size; i++) {
+    if (!input[start + i].IsChar()) return std::nullopt;
+    auto const ch = static_cast<unsigned char>(input[start + i].GetChar());
+    if ((ch & 0xC0) != 0x80) return std::nullopt;
+    code = code << 6 | (ch & 0x3F);
+  }
+
+  // 拒绝过长编码、代理码点与超出范围的码点
+  char32_t const min[] = {0, 0, 0x80, 0x800, 0x10000};
+  if (code < min[size] || code > 0x10FFFF ||
+      (code >= 0xD800 && code <= 0xDFFF)) {
+    return std::nullopt;
+  }
+  return std::make_pair(code, size);
+}
+
+/**
+ * 从start位置分析形如 {1F600} 的码点，成功则删除这些输入，失败则抛出异常
+ *
+ * @param writing 若不为空，则被删除的输入追加到其中
+ */
+char32_t ScanCodePoint(std::vector<Unit>& input, size_t const start,
+                       std::string* writing) {
+  auto const take = [&]() {
+    if (start >= input.size() || !input[start].IsChar()) {
+      throw std::runtime_error("ScanCodePoint: endless code point");
+    }
+    auto const ch = input[start].GetChar();
+    if (writing) *writing += ch;
+    input.erase(input.begin() + start);
+    return ch;
+  };
+
+  if (take() != '{') throw std::runtime_error("ScanCodePoint: missing '{'");
+
+  char32_t code = 0;
+  size_t digits = 0;
+  for (auto ch = take(); ch != '}'; ch = take()) {
+    if (!std::isxdigit(static_cast<unsigned char>(ch)) || ++digits > 6) {
+      throw std::runtime_error("ScanCodePoint: invalid code point");
+    }
+    code = code * 16 + (std::isdigit(static_cast<unsigned char>(ch))
+                            ? ch - '0'
+                            : std::tolower(static_cast<unsigned char>(ch)) -
+                                  'a' + 10);
+  }
+
+  if (digits == 0 || code > 0x10FFFF || (code >= 0xD800 && code <= 0xDFFF)) {
+    throw std::runtime_error("ScanCodePoint: invalid code point");
+  }
+  return code;
+}
+
+/** 构造匹配一个字节范围的节点 */
+Regex ByteRangeOf(ByteRange const& range) {
+  if (range.first == range.second) {
+    auto const node = std::make_shared<CharNode>();
+    node->ch_ = static_cast<char>(range.first);
+    return node;
+  }
+
+  auto const node = std::make_shared<RangeNode>();
+  node->dir_ = RangeNode::kPositive;
+  node->set_ = Charset::Range(range.first, range.second);
+  node->writing_ = WritingOf(node->dir_, node->set_);
+  Seal(*node);
+  return node;
+}
+
+/** 构造依次匹配一串字节的节点 */
+Regex SequenceOf(std::string const& bytes) {
+  std::vector<Regex> chars;
+  for (auto const ch : bytes) {
+    auto const byte = static_cast<unsigned char>(ch);
+    chars.push_back(ByteRangeOf({byte, byte}));
+  }
+  return Fold(Node::kConcat, chars);
+}
+
+/**
+ * 将编码长度相同的码点范围拆分为若干字节范围序列，
+ * 每个序列中第i个字节范围恰好对应其码点的第i个字节
+ */
+void SplitUtf8(CodeRange const& range,
+               std::vector<std::vector<ByteRange>>& sequences) {
+  std::vector<CodeRange> stack{range};
+  while (!stack.empty()) {
+    auto const [lo, hi] = stack.back();
+    stack.pop_back();
+
+    // 编码长度不同的部分分别处理
+    auto split = false;
+    for (char32_t const max : {0x7F, 0x7FF, 0xFFFF}) {
+      if (lo <= max && hi > max) {
+        stack.push_back({max + 1, hi});
+        stack.push_back({lo, max});
+        split = true;
+        break;
+      }
+    }
+
+    // 低位字节不能覆盖完整的后续字节范围时，拆出不完整的部分
+    for (auto i = 1; i < 4 && !split; i++) {
+      char32_t const mask = (1U << (6 * i)) - 1;
+      if ((lo & ~mask) == (hi & ~mask)) continue;
+      if ((lo & mask) != 0) {
+        stack.push_back({(lo | mask) + 1, hi});
+        stack.push_back({lo, lo | mask});
+        split = true;
+      } else if ((hi & mask) != mask) {
+        stack.push_back({hi & ~mask, hi});
+        stack.push_back({lo, (hi & ~mask) - 1});
+        split = true;
+      }
+    }
+    if (split) continue;
+
+    auto const first = EncodeUtf8(lo);
+    auto const last = EncodeUtf8(hi);
+    auto& sequence = sequences.emplace_back();
+    for (size_t i = 0; i < first.size(); i++) {
+      sequence.emplace_back(first[i], last[i]);
+    }
+  }
+}
+
+/** 字节范围序列的后缀树节点，相同后缀的序列共享节点 */
+struct Suffix {
+  ByteRange range;
+  std::vector<Suffix> prefixes;
+};
+
+/** 构造匹配后缀树中全部序列的节点，共享的后缀只出现一次 */
+Regex SuffixesOf(std::vector<Suffix> const& suffixes) {
+  std::vector<Regex> alternatives;
+  for (auto const& suffix : suffixes) {
+    auto regex = ByteRangeOf(suffix.range);
+    if (!suffix.prefixes.empty()) {
+      regex = Fold(Node::kConcat, {SuffixesOf(suffix.prefixes), regex});
+    }
+    alternatives.push_back(regex);
+  }
+  return Fold(Node::kUnion, alternatives);
+}
+
+/**
+ * 构造匹配一组码点范围的UTF-8字节序列的节点
+ * 代理码点被排除在外
+ */
+Regex Utf8Of(std::vector<CodeRange> const& ranges) {
+  std::vector<std::vector<ByteRange>> sequences;
+  for (auto const& [first, last] : ranges) {
+    auto const lo = first >= 0xD800 && first <= 0xDFFF ? 0xE000 : first;
+    auto const hi = last >= 0xD800 && last <= 0xDFFF ? 0xD7FF : last;
+    if (lo < 0xD800 && hi > 0xDFFF) {
+      SplitUtf8({lo, 0xD7FF}, sequences);
+      SplitUtf8({0xE000, hi}, sequences);
+    } else if (lo <= hi) {
+      SplitUtf8({lo, hi}, sequences);
+    }
+  }
+
+  // 将序列反向插入后缀树
+  std::vector<Suffix> root;
+  for (auto const& sequence : sequences) {
+    auto* level = &root;
+    for (auto it = sequence.rbegin(); it != sequence.rend(); ++it) {
+      auto found = std::find_if(
+          level->begin(), level->end(),
+          [&](Suffix const& suffix) { return suffix.range == *it; });
+      if (found == level->end()) {
+        level->push_back({*it, {}});
+        found = level->end() - 1;
+      }
+      level = &found->prefixes;
+    }
+  }
+  return SuffixesOf(root);
+}
+
+}  // namespace
+
 /**
  * 从start位置分析一个由方括号引领的字符类表达式，成功则原地归约，失败则抛出异常
+ * 字符类中出现 \u{...} 或多字节UTF-8字符时，字符类按码点匹配，
+ * 非ASCII部分被编译为UTF-8字节序列
  */
 void ScanRange(std::vector<Unit>& input, size_t const start) {
-  int state = 1;
-  char range_left = 0;
+  /** 字符类中的一个字符，byte 表示未被解码为码点的单个字节 */
+  struct Atom {
+    char32_t code;
+    bool byte;
+  };
+
   const auto node = std::make_shared<RangeNode>();
+  std::vector<CodeRange> unicode;
+
+  auto const peek = [&](char ch) {
+    return start < input.size() && input[start] == ch;
+  };
+  auto const take = [&]() {
+    if (start >= input.size()) {
+      throw std::runtime_error("ScanRange: endless range");
+    }
+    if (!input[start].IsChar()) {
+      throw std::runtime_error("ScanRange: invalid input in range");
+    }
+    auto const ch = input[start].GetChar();
+    node->writing_ += ch;
+    input.erase(input.begin() + start);
+    return ch;
+  };
+
+  // 读取一个字符，若读到的是字符类转义，则直接并入字符类
+  auto const read = [&]() -> std::optional<Atom> {
+    if (auto decoded = DecodeUtf8(input, start); decoded) {
+      for (size_t i = 0; i < decoded->second; i++) take();
+      return Atom{decoded->first, false};
+    }
+
+    auto const ch = take();
+    if (ch != '\\') return Atom{static_cast<unsigned char>(ch), true};
+
+    auto const escaped = take();
+    if (escaped == 'u' && peek('{')) {
+      return Atom{ScanCodePoint(input, start, &node->writing_), false};
+    } else if (auto it = char_escape_table.find(escaped);
+               it != char_escape_table.end()) {
+      return Atom{static_cast<unsigned char>(it->second), true};
+    } else if (auto it = char_class_table.find(escaped);
+               it != char_class_table.end()) {
+      auto const& [dir, set] = it->second;
+      if (dir == RangeNode::kNegative) {
+        throw std::runtime_error("ScanRange: negative char class in range");
+      }
+
+      node->set_ |= set;
+      return std::nullopt;
+    }
+    return Atom{static_cast<unsigned char>(escaped), true};
+  };
+
+  auto const add = [&](Atom const& lo, Atom const& hi) {
+    auto const [min, max] = std::minmax(lo.code, hi.code);
+    if ((lo.byte && hi.byte) || max < 0x80) {
+      node->set_ |= Charset::Range(min, max);
+      return;
+    }
+
+    if (min < 0x80) node->set_ |= Charset::Range(min, 0x7F);
+    unicode.push_back({std::max<char32_t>(min, 0x80), max});
+  };
 
-  if (input[start] != '[') {
+  if (take() != '[') {
     throw std::runtime_error("ScanRange: invalid start char");
-  } else {
-    node->writing_ += input[start].GetChar();
-    input.erase(input.begin() + start);
   }
 
-  if (input[start] == '^') {
+  if (peek('^')) {
     node->dir_ = RangeNode::kNegative;
-    node->writing_ += input[start].GetChar();
-    input.erase(input.begin() + start);
+    take();
   } else {
     node->dir_ = RangeNode::kPositive;
   }
 
-  while (state > 0) {
-    if (!input[start].IsChar()) {
-      throw std::runtime_error("ScanRange: invalid input in range");
+  while (!peek(']')) {
+    auto const lo = read();
+    if (!lo) continue;
+
+    // '-' 紧跟在 ']' 之前时表示字符本身
+    if (peek('-')) {
+      take();
+      if (peek(']')) {
+        add(*lo, *lo);
+        add({'-', true}, {'-', true});
+        break;
+      }
+
+      auto const hi = read();
+      if (!hi) throw std::runtime_error("ScanRange: char class in range");
+      add(*lo, *hi);
+    } else {
+      add(*lo, *lo);
     }
+  }
+  take();
 
-    auto ch = input[start].GetChar();
-    switch (state) {
-      case 1: {
-        if (ch == ']') {
-          state = 0;
-        } else if (ch == '\\') {
-          state = 2;
-        } else if (ch == '-' && range_left != 0) {
-          state = 3;
-        } else {
-          range_left = ch;
-          node->set_.insert(range_left);
-        }
-      } break;
-      case 2: {  // 转义字符
-        if (auto it = char_escape_table.find(ch);
-            it != char_escape_table.end()) {
-          node->set_.insert(it->second);
-          range_left = it->second;
-        } else if (auto it = char_class_table.find(ch);
-                   it != char_class_table.end()) {
-          auto const& [dir, set] = it->second;
-          if (dir == RangeNode::kNegative) {
-            throw std::runtime_error("ScanRange: negative char class in range");
-          }
+  if (node->set_.Empty() && unicode.empty()) {
+    throw std::runtime_error("ScanRange: empty range");
+  }
 
-          node->set_.insert(set.begin(), set.end());
-        } else {
-          node->set_.insert(ch);
-          range_left = ch;
-        }
-        state = 1;
-      } break;
-      case 3: {  // 字符范围
-        if (ch == ']') {
-          node->set_.insert('-');
-          state = 0;
-        } else if (ch == '\\') {
-          state = 4;
-        } else if (ch < range_left) {
-          for (auto c = ch; c <= range_left; ++c) node->set_.insert(c);
-          range_left = 0;
-          state = 1;
-        } else {
-          for (auto c = range_left; c <= ch; ++c) node->set_.insert(c);
-          range_left = 0;
-          state = 1;
-        }
-      } break;
-      case 4: {
-        auto it = char_escape_table.find(ch);
-        if (it != char_escape_table.end()) ch = it->second;
-
-        if (ch < range_left) {
-          for (auto c = ch; c <= range_left; ++c) node->set_.insert(c);
-        } else {
-          for (auto c = range_left; c <= ch; ++c) node->set_.insert(c);
-        }
+  if (unicode.empty()) {
+    Seal(*node);
+    input.insert(input.begin() + start, {node});
+    return;
+  }
 
-        range_left = 0;
-        state = 1;
-      } break;
+  // 按码点匹配时，ASCII部分仍由字节字符类匹配，其余码点由UTF-8字节序列匹配
+  std::sort(unicode.begin(), unicode.end());
+  std::vector<CodeRange> merged;
+  for (auto const& range : unicode) {
+    if (!merged.empty() && range.first <= merged.back().second + 1) {
+      merged.back().second = std::max(merged.back().second, range.second);
+    } else {
+      merged.push_back(range);
     }
-
-    node->writing_ += input[start].GetChar();
-    input.erase(input.begin() + start);
   }
 
-  if (state != 0) {
-    throw std::runtime_error("ScanRange: endless range");
+  if (node->dir_ == RangeNode::kNegative) {
+    node->dir_ = RangeNode::kPositive;
+    node->set_ = Charset::Range(0, 0x7F) - node->set_;
+
+    std::vector<CodeRange> complement;
+    char32_t next = 0x80;
+    for (auto const& [lo, hi] : merged) {
+      if (lo > next) complement.push_back({next, lo - 1});
+      next = hi + 1;
+    }
+    if (next <= 0x10FFFF) complement.push_back({next, 0x10FFFF});
+    merged.swap(complement);
   }
+  Seal(*node);
 
-  if (node->set_.empty()) {
+  std::vector<Regex> alternatives;
+  if (!node->bits_.Empty()) alternatives.push_back(node);
+  if (!merged.empty()) alternatives.push_back(Utf8Of(merged));
+  if (alternatives.empty()) {
     throw std::runtime_error("ScanRange: empty range");
   }
-
-  input.insert(input.begin() + start, {node});
+  input.insert(input.begin() + start, {Fold(Node::kUnion, alternatives)});
 }
 
 /**
@@ -311,7 +712,11 @@ void Scan(std::vector<Unit>& input) {
       }
 
       input.erase(input.begin() + i);
-      if (auto it = char_escape_table.find(input[i].GetChar());
+      if (input[i] == 'u' && i + 1 < input.size() && input[i + 1] == '{') {
+        input.erase(input.begin() + i);
+        auto const code = ScanCodePoint(input, i, nullptr);
+        input.insert(input.begin() + i, {SequenceOf(EncodeUtf8(code))});
+      } else if (auto it = char_escape_table.find(input[i].GetChar());
           it != char_escape_table.end()) {
         auto const node = std::make_shared<CharNode>();
         node->ch_ = it->second;
@@ -322,16 +727,23 @@ void Scan(std::vector<Unit>& input) {
 
         auto const node = std::make_shared<RangeNode>();
         node->dir_ = dir;
-        node->set_.insert(set.begin(), set.end());
+        node->set_ = set;
+        Seal(*node);
         input[i].value_ = node;
       } else {
         auto const node = std::make_shared<CharNode>();
         node->ch_ = input[i].GetChar();
         input[i].value_ = node;
       }
+    } else if (auto decoded = DecodeUtf8(input, i); decoded) {
+      // 多字节字符作为一个整体参与后缀运算
+      input.erase(input.begin() + i + 1,
+                  input.begin() + i + decoded->second);
+      input[i].value_ = SequenceOf(EncodeUtf8(decoded->first));
     } else if (input[i].GetChar() == '.') {
       auto const node = std::make_shared<RangeNode>();
       node->dir_ = RangeNode::kNegative;
+      Seal(*node);
       input[i].value_ = node;
     } else if (!operator_table.count(input[i].GetChar())) {
       auto const node = std::make_shared<CharNode>();
@@ -346,8 +758,10 @@ void Scan(std::vector<Unit>& input) {
  * 解析正则表达式
  *  1. 递归处理括号，将分析完毕的表达式在原地归约
  *  2. 处理后缀运算符，将分析完毕的表达式在原地归约
- *  3. 处理连接，将分析完毕的表达式在原地归约
- *  4. 处理或运算符，将分析完毕的表达式在原地归约
+ *  3. 处理前缀补集运算符，将分析完毕的表达式在原地归约
+ *  4. 处理连接，将分析完毕的表达式在原地归约
+ *  5. 处理交集运算符，将分析完毕的表达式在原地归约
+ *  6. 处理或运算符，将分析完毕的表达式在原地归约
  */
 void Parse(std::vector<Unit>& input, size_t const start = 0UL,
            size_t const depth = 0UL) {
@@ -401,7 +815,25 @@ void Parse(std::vector<Unit>& input, size_t const start = 0UL,
     }
   }
 
-  // 3. 处理连接，将分析完毕的表达式在原地归约
+  // 3. 从右向左处理前缀补集运算符，使 ~~x 归约为 ~(~x)
+  //    只处理本层括号内的部分，外层尚未分析的部分留给外层处理
+  auto close = start;
+  while (close < input.size() && input[close] != ')') ++close;
+  for (size_t i = close; i-- > start;) {
+    if (input[i] != '~') continue;
+
+    if (i + 1 >= close || !input[i + 1].IsNode()) {
+      throw std::runtime_error("Parse: missing operand");
+    }
+
+    auto const node = std::make_shared<ComplementNode>();
+    node->child_ = input[i + 1].GetNode();
+    input[i].value_ = node;
+    input.erase(input.begin() + i + 1);
+    --close;
+  }
+
+  // 4. 处理连接，将分析完毕的表达式在原地归约
   for (size_t i = start; i < input.size() && input[i] != ')'; ++i) {
     if (i <= start || !input[i].IsNode() || !input[i - 1].IsNode()) continue;
 
@@ -412,7 +844,24 @@ void Parse(std::vector<Unit>& input, size_t const start = 0UL,
     input.erase(input.begin() + i + 1);
   }
 
-  // 4. 处理或运算符，将分析完毕的表达式在原地归约
+  // 5. 处理交集运算符，将分析完毕的表达式在原地归约
+  for (size_t i = start; i < input.size() && input[i] != ')'; ++i) {
+    if (input[i] != '&') continue;
+
+    if (i == start || !input[i - 1].IsNode() || i + 1 >= input.size() ||
+        !input[i + 1].IsNode()) {
+      throw std::runtime_error("Parse: missing operand");
+    }
+
+    auto const node = std::make_shared<IntersectNode>();
+    input.erase(input.begin() + i);
+    node->right_ = input[i].GetNode();
+    node->left_ = input[--i].GetNode();
+    input[i].value_ = node;
+    input.erase(input.begin() + i + 1);
+  }
+
+  // 6. 处理或运算符，将分析完毕的表达式在原地归约
   for (size_t i = start; i < input.size() && input[i] != ')'; ++i) {
     if (input[i] != '|') continue;
 
@@ -448,6 +897,394 @@ Regex Compile(std::string const& expression) {
   return node;
 }
 
+namespace {
+
+/** 判断两个正则表达式结构是否相同 */
+bool Same(Regex const& lhs, Regex const& rhs) {
+  std::vector<std::pair<Node const*, Node const*>> stack{{lhs.get(), rhs.get()}};
+  while (!stack.empty()) {
+    auto const [l, r] = stack.back();
+    stack.pop_back();
+    if (l == r) continue;
+    if (l->type() != r->type()) return false;
+
+    switch (l->type()) {
+      case Node::kAccept:
+        if (static_cast<AcceptNode const&>(*l).token_id_ !=
+            static_cast<AcceptNode const&>(*r).token_id_)
+          return false;
+        break;
+      case Node::kChar:
+        if (static_cast<CharNode const&>(*l).ch_ !=
+            static_cast<CharNode const&>(*r).ch_)
+          return false;
+        break;
+      case Node::kRange:
+        if (static_cast<RangeNode const&>(*l).bits_ !=
+            static_cast<RangeNode const&>(*r).bits_)
+          return false;
+        break;
+      default: {
+        auto const lc = ChildrenOf(*l);
+        auto const rc = ChildrenOf(*r);
+        for (size_t i = 0; i < lc.size(); i++) {
+          if (lc[i]) stack.push_back({lc[i]->get(), rc[i]->get()});
+        }
+      } break;
+    }
+  }
+  return true;
+}
+
+/** 获取闭包节点的子节点 */
+Regex& ChildOf(Regex const& closure) {
+  switch (closure->type()) {
+    case Node::kKleene:
+      return static_cast<KleeneNode&>(*closure).child_;
+    case Node::kPositive:
+      return static_cast<PositiveNode&>(*closure).child_;
+    case Node::kOptional:
+      return static_cast<OptionalNode&>(*closure).child_;
+    default:
+      throw std::logic_error("ChildOf: not a closure");
+  }
+}
+
+bool IsClosure(Regex const& regex) {
+  return regex->type() == Node::kKleene || regex->type() == Node::kPositive ||
+         regex->type() == Node::kOptional;
+}
+
+Regex MakeClosure(Node::Type type, Regex const& child) {
+  Regex node;
+  switch (type) {
+    case Node::kKleene:
+      node = std::make_shared<KleeneNode>();
+      break;
+    case Node::kPositive:
+      node = std::make_shared<PositiveNode>();
+      break;
+    default:
+      node = std::make_shared<OptionalNode>();
+      break;
+  }
+  ChildOf(node) = child;
+  return node;
+}
+
+/**
+ * 将两个单字符正则表达式合并为字符类
+ * 若任一字符类是反向的，则合并结果也书写为反向字符类
+ */
+std::shared_ptr<RangeNode> MergeClass(std::shared_ptr<RangeNode> const& range,
+                                      Regex const& regex) {
+  auto const merged = std::make_shared<RangeNode>();
+  if (regex->type() == Node::kChar) {
+    merged->dir_ = RangeNode::kPositive;
+    merged->bits_ = static_cast<CharNode&>(*regex).Bits();
+  } else {
+    merged->dir_ = static_cast<RangeNode&>(*regex).dir_;
+    merged->bits_ = static_cast<RangeNode&>(*regex).bits_;
+  }
+
+  if (range) {
+    if (range->dir_ == RangeNode::kNegative) merged->dir_ = RangeNode::kNegative;
+    merged->bits_ |= range->bits_;
+  }
+
+  merged->set_ =
+      merged->dir_ == RangeNode::kNegative ? ~merged->bits_ : merged->bits_;
+  merged->writing_ = WritingOf(merged->dir_, merged->set_);
+  return merged;
+}
+
+/**
+ * 按从左到右的顺序收集同类二元节点的全部操作数
+ *
+ * @return 原节点是否已经是左深树
+ */
+bool Flatten(Regex const& regex, Node::Type type, std::vector<Regex>& operands) {
+  auto left_deep = true;
+  std::vector<Regex> stack{regex};
+  while (!stack.empty()) {
+    auto node = stack.back();
+    stack.pop_back();
+    if (node->type() != type) {
+      operands.push_back(node);
+      continue;
+    }
+
+    auto const& [left, right] =
+        type == Node::kConcat
+            ? std::tie(static_cast<ConcatNode&>(*node).left_,
+                       static_cast<ConcatNode&>(*node).right_)
+            : std::tie(static_cast<UnionNode&>(*node).left_,
+                       static_cast<UnionNode&>(*node).right_);
+    if (right->type() == type) left_deep = false;
+    stack.push_back(right);
+    stack.push_back(left);
+  }
+  return left_deep;
+}
+
+/**
+ * 由化简后的子节点构造化简后的父节点
+ *
+ * @param regex 原节点，不能是叶节点
+ * @param operands 原节点的子节点，串与联合为 Flatten 收集的全部操作数
+ * @param children 与 operands 一一对应的化简结果
+ * @param changed 串与联合的原节点是否已经需要重建
+ */
+Regex SimplifyParent(Regex const& regex, std::vector<Regex> const& operands,
+                     std::vector<Regex> const& children, bool changed) {
+  switch (regex->type()) {
+    case Node::kKleene:
+    case Node::kPositive:
+    case Node::kOptional: {
+      auto const& origin = operands.front();
+      auto const& child = children.front();
+      if (IsClosure(child)) {
+        // 同种闭包嵌套时外层闭包是多余的，不同种闭包嵌套等价于克林闭包
+        if (child->type() == regex->type()) return child;
+        if (child->type() == Node::kKleene) return child;
+        return MakeClosure(Node::kKleene, ChildOf(child));
+      }
+      if (child == origin) return regex;
+      return MakeClosure(regex->type(), child);
+    }
+    case Node::kConcat:
+    case Node::kUnion: {
+      std::vector<Regex> simplified;
+      std::shared_ptr<RangeNode> range;
+      size_t range_index = 0;
+      size_t range_count = 0;
+      for (size_t i = 0; i < operands.size(); i++) {
+        auto const& node = children[i];
+        if (node != operands[i]) changed = true;
+
+        if (regex->type() == Node::kConcat) {
+          simplified.push_back(node);
+          continue;
+        }
+
+        // 单字符的候选项合并为一个字符类
+        if (node->type() == Node::kChar || node->type() == Node::kRange) {
+          range = MergeClass(range, node);
+          if (range_count++ == 0) {
+            range_index = simplified.size();
+            simplified.push_back(node);
+          } else {
+            changed = true;
+          }
+          continue;
+        }
+
+        // 去除重复的候选项
+        if (std::any_of(simplified.begin(), simplified.end(),
+                        [&](Regex const& it) { return Same(it, node); })) {
+          changed = true;
+          continue;
+        }
+        simplified.push_back(node);
+      }
+
+      if (!changed) return regex;
+      if (range_count > 1) simplified[range_index] = range;
+      if (simplified.size() == 1) return simplified.front();
+      return Fold(regex->type(), simplified);
+    }
+    case Node::kIntersect: {
+      auto const& left = children[0];
+      auto const& right = children[1];
+      if (left == operands[0] && right == operands[1]) return regex;
+
+      auto const simplified = std::make_shared<IntersectNode>();
+      simplified->left_ = left;
+      simplified->right_ = right;
+      return simplified;
+    }
+    case Node::kComplement: {
+      // 双重补集即原表达式
+      auto const& child = children.front();
+      if (child->type() == Node::kComplement)
+        return static_cast<ComplementNode&>(*child).child_;
+      if (child == operands.front()) return regex;
+
+      auto const simplified = std::make_shared<ComplementNode>();
+      simplified->child_ = child;
+      return simplified;
+    }
+    case Node::kAccept:
+    case Node::kChar:
+    case Node::kRange:
+      break;
+  }
+  throw std::logic_error("Simplify: unknown regex");
+}
+
+Regex SimplifyNode(Regex const& root) {
+  // 以显式栈后序遍历，子节点化简完毕后再构造父节点
+  // 串与联合一次展开全部同类操作数，其余节点的子节点即为操作数
+  struct Frame {
+    Regex regex;
+    std::vector<Regex> operands;
+    bool changed = false;
+    bool expanded = false;
+  };
+  std::vector<Frame> stack;
+  stack.push_back({root, {}, false, false});
+  std::vector<Regex> simplified;
+  while (!stack.empty()) {
+    auto& frame = stack.back();
+    auto const type = frame.regex->type();
+    if (type == Node::kAccept || type == Node::kChar || type == Node::kRange) {
+      simplified.push_back(frame.regex);
+      stack.pop_back();
+      continue;
+    }
+
+    if (frame.expanded) {
+      auto const first = simplified.end() - frame.operands.size();
+      std::vector<Regex> const children(first, simplified.end());
+      simplified.erase(first, simplified.end());
+      simplified.push_back(SimplifyParent(frame.regex, frame.operands,
+                                          children, frame.changed));
+      stack.pop_back();
+      continue;
+    }
+
+    frame.expanded = true;
+    if (type == Node::kConcat || type == Node::kUnion) {
+      frame.changed = !Flatten(frame.regex, type, frame.operands);
+    } else {
+      for (auto const child : ChildrenOf(*frame.regex)) {
+        if (child) frame.operands.push_back(*child);
+      }
+    }
+    // frame 在压栈后可能失效，先复制操作数
+    auto const operands = frame.operands;
+    for (auto it = operands.rbegin(); it != operands.rend(); ++it) {
+      stack.push_back({*it, {}, false, false});
+    }
+  }
+  return simplified.back();
+}
+
+}  // namespace
+
+std::array<Regex const*, 2> ChildrenOf(Node const& node) {
+  switch (node.type()) {
+    case Node::kAccept:
+    case Node::kChar:
+    case Node::kRange:
+      return {nullptr, nullptr};
+    case Node::kConcat: {
+      auto const& concat = static_cast<ConcatNode const&>(node);
+      return {&concat.left_, &concat.right_};
+    }
+    case Node::kUnion: {
+      auto const& unode = static_cast<UnionNode const&>(node);
+      return {&unode.left_, &unode.right_};
+    }
+    case Node::kIntersect: {
+      auto const& inode = static_cast<IntersectNode const&>(node);
+      return {&inode.left_, &inode.right_};
+    }
+    case Node::kKleene:
+      return {&static_cast<KleeneNode const&>(node).child_, nullptr};
+    case Node::kPositive:
+      return {&static_cast<PositiveNode const&>(node).child_, nullptr};
+    case Node::kOptional:
+      return {&static_cast<OptionalNode const&>(node).child_, nullptr};
+    case Node::kComplement:
+      return {&static_cast<ComplementNode const&>(node).child_, nullptr};
+  }
+  throw std::logic_error("ChildrenOf: unknown regex");
+}
+
+bool NeedsDerivatives(Regex const& regex) {
+  std::vector<Node const*> stack{regex.get()};
+  while (!stack.empty()) {
+    auto const node = stack.back();
+    stack.pop_back();
+    if (node->type() == Node::kIntersect || node->type() == Node::kComplement)
+      return true;
+    for (auto const child : ChildrenOf(*node)) {
+      if (child) stack.push_back(child->get());
+    }
+  }
+  return false;
+}
+
+Regex Simplify(Regex const& regex) {
+  auto const simplified = SimplifyNode(regex);
+  if (simplified != regex) Anim::RegexSimplify(regex, simplified);
+  return simplified;
+}
+
+Regex Reverse(Regex const& regex) {
+  // 以显式栈后序遍历，子节点反转完毕后再构造父节点
+  std::vector<std::pair<Regex, bool>> stack{{regex, false}};
+  std::vector<Regex> reversed;
+  while (!stack.empty()) {
+    auto const [node, expanded] = stack.back();
+    stack.pop_back();
+    if (node->type() == Node::kAccept) {
+      throw std::logic_error("Reverse: unexpected accept node");
+    }
+
+    auto const [left, right] = ChildrenOf(*node);
+    if (!left) {
+      reversed.push_back(node);
+      continue;
+    }
+    if (!expanded) {
+      stack.push_back({node, true});
+      if (right) stack.push_back({*right, false});
+      stack.push_back({*left, false});
+      continue;
+    }
+
+    Regex rhs;
+    if (right) {
+      rhs = std::move(reversed.back());
+      reversed.pop_back();
+    }
+    auto lhs = std::move(reversed.back());
+    reversed.pop_back();
+
+    switch (node->type()) {
+      case Node::kConcat: {
+        auto const concat = std::make_shared<ConcatNode>();
+        concat->left_ = rhs;
+        concat->right_ = lhs;
+        reversed.push_back(concat);
+      } break;
+      case Node::kUnion: {
+        auto const unode = std::make_shared<UnionNode>();
+        unode->left_ = lhs;
+        unode->right_ = rhs;
+        reversed.push_back(unode);
+      } break;
+      case Node::kIntersect: {
+        auto const inode = std::make_shared<IntersectNode>();
+        inode->left_ = lhs;
+        inode->right_ = rhs;
+        reversed.push_back(inode);
+      } break;
+      case Node::kComplement: {
+        auto const complement = std::make_shared<ComplementNode>();
+        complement->child_ = lhs;
+        reversed.push_back(complement);
+      } break;
+      default:
+        reversed.push_back(MakeClosure(node->type(), lhs));
+        break;
+    }
+  }
+  return reversed.back();
+}
+
 Regex Union(Regex const& left, Regex const& right) {
   auto const node = std::make_shared<UnionNode>();
   node->left_ = left;
@@ -459,10 +1296,7 @@ Regex Union(Regex const& left, Regex const& right) {
 
 std::shared_ptr<AcceptNode> Accept(Regex const& regex, int token_id) {
   auto const node = std::make_shared<AcceptNode>(token_id);
-  auto afters = regex->GetLastpos();
-  for (auto it : afters) it->followpos_.insert(node);
-
-  Anim::RegexAccept(node, afters);
+  Anim::RegexAccept(node, regex);
   return node;
 }
 
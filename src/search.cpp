@@ -0,0 +1,463 @@
+#include "toylang/search.h"
+
+#include <algorithm>
+#include <map>
+#include <optional>
+#include <set>
+
+namespace toylang::regex {
+
+namespace {
+
+/**
+ * 化简正则表达式，并将其连同接受节点转换为中间表示
+ *
+ * @return 正则表达式根节点与接受节点的下标
+ */
+std::pair<Arena::Index, Arena::Index> LowerAccepted(Arena& arena,
+                                                    Regex const& regex,
+                                                    int id) {
+  if (NeedsDerivatives(regex)) {
+    throw std::runtime_error{
+        "Search: intersection and complement are not supported"};
+  }
+  auto const root = arena.Lower(regex);
+  auto const accept = arena.Accept(root, std::make_shared<AcceptNode>(id));
+  arena.Analyze();
+  return {root, accept};
+}
+
+/**
+ * 正则表达式的文字信息
+ * prefix 与 suffix 为每个匹配的前缀与后缀，required 为每个匹配都包含的子串，
+ * 均可能为空；exact 表示表达式只能匹配一个串，此时三者都是这个串
+ */
+struct Literals {
+  bool exact = false;
+  std::string prefix;
+  std::string suffix;
+  std::string required;
+};
+
+std::string const& Longest(std::initializer_list<std::string const*> texts) {
+  auto const* longest = *texts.begin();
+  for (auto const* text : texts) {
+    if (text->size() > longest->size()) longest = text;
+  }
+  return *longest;
+}
+
+Literals Exactly(std::string text) {
+  return Literals{true, text, text, text};
+}
+
+Literals LiteralsOf(Regex const& regex) {
+  switch (regex->type()) {
+    case Node::kChar:
+      return Exactly(std::string(1, static_cast<CharNode&>(*regex).ch_));
+    case Node::kRange: {
+      auto const& bits = static_cast<RangeNode&>(*regex).Bits();
+      if (bits.Count() != 1) return {};
+      return Exactly(std::string(1, static_cast<char>(bits.Min())));
+    }
+    case Node::kConcat: {
+      auto const& node = static_cast<ConcatNode&>(*regex);
+      auto const lhs = LiteralsOf(node.left_);
+      auto const rhs = LiteralsOf(node.right_);
+      if (lhs.exact && rhs.exact) return Exactly(lhs.prefix + rhs.prefix);
+
+      Literals literals;
+      literals.prefix = lhs.exact ? lhs.prefix + rhs.prefix : lhs.prefix;
+      literals.suffix = rhs.exact ? lhs.suffix + rhs.suffix : rhs.suffix;
+      auto const joint = lhs.suffix + rhs.prefix;
+      literals.required = Longest({&lhs.required, &rhs.required, &joint,
+                                   &literals.prefix, &literals.suffix});
+      return literals;
+    }
+    case Node::kUnion: {
+      auto const& node = static_cast<UnionNode&>(*regex);
+      auto const lhs = LiteralsOf(node.left_);
+      auto const rhs = LiteralsOf(node.right_);
+      if (lhs.exact && rhs.exact && lhs.prefix == rhs.prefix) return lhs;
+
+      // 两侧共同的前缀与后缀仍然是必然出现的
+      Literals literals;
+      auto const prefix = std::mismatch(lhs.prefix.begin(), lhs.prefix.end(),
+                                        rhs.prefix.begin(), rhs.prefix.end());
+      literals.prefix.assign(lhs.prefix.begin(), prefix.first);
+      auto const suffix =
+          std::mismatch(lhs.suffix.rbegin(), lhs.suffix.rend(),
+                        rhs.suffix.rbegin(), rhs.suffix.rend());
+      literals.suffix.assign(suffix.first.base(), lhs.suffix.end());
+      auto const shared =
+          lhs.required == rhs.required ? lhs.required : std::string{};
+      literals.required =
+          Longest({&shared, &literals.prefix, &literals.suffix});
+      return literals;
+    }
+    case Node::kPositive: {
+      auto literals = LiteralsOf(static_cast<PositiveNode&>(*regex).child_);
+      literals.exact = false;
+      return literals;
+    }
+    case Node::kKleene:
+    case Node::kOptional:
+      return {};
+    case Node::kAccept:
+    case Node::kIntersect:
+    case Node::kComplement:
+      break;
+  }
+  throw std::logic_error("Prefilter: unsupported regex");
+}
+
+}  // namespace
+
+std::string Prefilter::RequiredOf(Regex const& regex) {
+  return LiteralsOf(regex).required;
+}
+
+std::string Prefilter::PrefixOf(Regex const& regex) {
+  return LiteralsOf(regex).prefix;
+}
+
+std::unique_ptr<Prefilter> Prefilter::Create(
+    std::vector<std::string> const& literals) {
+  std::vector<std::string> sorted = literals;
+  std::sort(sorted.begin(), sorted.end(),
+            [](std::string const& lhs, std::string const& rhs) {
+              return lhs.size() < rhs.size() ||
+                     (lhs.size() == rhs.size() && lhs < rhs);
+            });
+  sorted.erase(std::unique(sorted.begin(), sorted.end()), sorted.end());
+
+  // 包含了另一个文字串的文字串是多余的
+  std::unique_ptr<Prefilter> prefilter{new Prefilter};
+  for (auto const& literal : sorted) {
+    if (literal.empty()) return nullptr;
+
+    auto const covered =
+        std::any_of(prefilter->literals_.begin(), prefilter->literals_.end(),
+                    [&](std::string const& shorter) {
+                      return literal.find(shorter) != std::string::npos;
+                    });
+    if (!covered) prefilter->literals_.push_back(literal);
+  }
+  if (prefilter->literals_.empty() ||
+      prefilter->literals_.size() > kMaxLiterals)
+    return nullptr;
+  return prefilter;
+}
+
+bool Prefilter::MayMatch(std::string_view text) const {
+  for (auto const& literal : literals_) {
+    if (text.find(literal) != std::string_view::npos) return true;
+  }
+  return false;
+}
+
+Automaton Automaton::Build(Arena const& arena, Arena::Positions const& starts,
+                           bool unanchored, size_t ids, size_t state_limit) {
+  Automaton dfa;
+  dfa.words_ = (ids + 63) / 64;
+
+  // 文本中的任何字节都可能出现，字节0也参与转移
+  auto const blocks = Partition(arena.Classes());
+  dfa.class_count_ = blocks.size();
+  for (size_t i = 0; i < blocks.size(); i++) {
+    blocks[i].ForEach([&](unsigned char ch) { dfa.byte_classes_[ch] = i; });
+  }
+
+  std::vector<Arena::Positions> state_poses;
+  std::map<Arena::Positions, uint32_t> state_ids;
+  auto const touch = [&](Arena::Positions&& poses) {
+    if (auto const it = state_ids.find(poses); it != state_ids.end())
+      return it->second;
+    if (state_poses.size() >= state_limit) {
+      throw std::runtime_error{"Search: too many states"};
+    }
+
+    auto const state_id = static_cast<uint32_t>(state_poses.size());
+    state_ids.emplace(poses, state_id);
+    state_poses.push_back(std::move(poses));
+    dfa.transfers_.resize(dfa.transfers_.size() + dfa.class_count_, kDead);
+    dfa.accepts_.resize(dfa.accepts_.size() + dfa.words_, 0);
+    dfa.flags_.push_back(0);
+    return state_id;
+  };
+  touch({});
+  touch(Arena::Positions{starts});
+
+  // 状态按创建顺序处理，死状态没有任何位置，也就没有任何转移
+  for (uint32_t state_id = kStart; state_id < state_poses.size(); state_id++) {
+    auto const current_pos = state_poses[state_id];
+    for (auto const posit : current_pos) {
+      if (arena.TypeOf(posit) != Node::kAccept) continue;
+
+      auto const id = arena.TokenOf(posit);
+      dfa.accepts_[state_id * dfa.words_ + id / 64] |= uint64_t{1}
+                                                       << (id % 64);
+      dfa.flags_[state_id] = 1;
+    }
+
+    std::vector<bool> visited(dfa.class_count_, false);
+    for (auto ch = 0; ch <= 255; ch++) {
+      auto const cls = dfa.byte_classes_[ch];
+      if (visited[cls]) continue;
+      visited[cls] = true;
+
+      Arena::Positions followpos;
+      if (unanchored) followpos = starts;
+      for (auto const posit : current_pos) {
+        if (!arena.Match(posit, ch)) continue;
+
+        auto const& follow = arena.FollowposOf(posit);
+        followpos.insert(followpos.end(), follow.begin(), follow.end());
+      }
+      std::sort(followpos.begin(), followpos.end());
+      followpos.erase(std::unique(followpos.begin(), followpos.end()),
+                      followpos.end());
+      auto const target = touch(std::move(followpos));
+      dfa.transfers_[state_id * dfa.class_count_ + cls] = target;
+    }
+  }
+  return dfa;
+}
+
+Automaton Automaton::BuildLeftmost(Arena const& arena,
+                                   Arena::Positions const& starts,
+                                   size_t state_limit) {
+  Automaton dfa;
+  dfa.words_ = 1;
+
+  auto const blocks = Partition(arena.Classes());
+  dfa.class_count_ = blocks.size();
+  for (size_t i = 0; i < blocks.size(); i++) {
+    blocks[i].ForEach([&](unsigned char ch) { dfa.byte_classes_[ch] = i; });
+  }
+
+  // 状态由各起点的位置集合与是否已经匹配组成，没有任何集合的状态都是死状态
+  using Groups = std::vector<Arena::Positions>;
+  std::vector<std::pair<Groups, bool>> state_groups;
+  std::map<std::pair<Groups, bool>, uint32_t> state_ids;
+  auto const touch = [&](Groups&& groups, bool matched) {
+    // 第一个包含接受节点的集合之后的起点都不再是最左的
+    auto accepting = false;
+    for (size_t i = 0; i < groups.size() && !accepting; i++) {
+      for (auto const posit : groups[i]) {
+        if (arena.TypeOf(posit) != Node::kAccept) continue;
+        groups.resize(i + 1);
+        accepting = matched = true;
+        break;
+      }
+    }
+    if (groups.empty()) matched = false;
+
+    auto key = std::make_pair(std::move(groups), matched);
+    if (auto const it = state_ids.find(key); it != state_ids.end())
+      return it->second;
+    if (state_groups.size() >= state_limit) {
+      throw std::runtime_error{"Search: too many states"};
+    }
+
+    auto const state_id = static_cast<uint32_t>(state_groups.size());
+    state_ids.emplace(key, state_id);
+    state_groups.push_back(std::move(key));
+    dfa.transfers_.resize(dfa.transfers_.size() + dfa.class_count_, kDead);
+    dfa.accepts_.push_back(accepting ? 1 : 0);
+    dfa.flags_.push_back(accepting ? 1 : 0);
+    return state_id;
+  };
+  touch({}, false);
+  touch(starts.empty() ? Groups{} : Groups{starts}, false);
+
+  for (uint32_t state_id = kStart; state_id < state_groups.size();
+       state_id++) {
+    auto const [groups, matched] = state_groups[state_id];
+    std::vector<bool> visited(dfa.class_count_, false);
+    for (auto ch = 0; ch <= 255; ch++) {
+      auto const cls = dfa.byte_classes_[ch];
+      if (visited[cls]) continue;
+      visited[cls] = true;
+
+      // 同一位置只保留在起点最靠前的集合中，之后的行为与起点无关
+      Groups targets;
+      std::set<Arena::Index> taken;
+      auto const add = [&](Arena::Positions&& poses) {
+        std::sort(poses.begin(), poses.end());
+        poses.erase(std::unique(poses.begin(), poses.end()), poses.end());
+        poses.erase(std::remove_if(poses.begin(), poses.end(),
+                                   [&](Arena::Index posit) {
+                                     return !taken.insert(posit).second;
+                                   }),
+                    poses.end());
+        if (!poses.empty()) targets.push_back(std::move(poses));
+      };
+      for (auto const& group : groups) {
+        Arena::Positions followpos;
+        for (auto const posit : group) {
+          if (!arena.Match(posit, ch)) continue;
+
+          auto const& follow = arena.FollowposOf(posit);
+          followpos.insert(followpos.end(), follow.begin(), follow.end());
+        }
+        add(std::move(followpos));
+      }
+      if (!matched) add(Arena::Positions{starts});
+
+      auto const target = touch(std::move(targets), matched);
+      dfa.transfers_[state_id * dfa.class_count_ + cls] = target;
+    }
+  }
+  return dfa;
+}
+
+std::unique_ptr<Set> Set::Compile(std::vector<Regex> const& patterns,
+                                  size_t state_limit) {
+  std::unique_ptr<Set> set{new Set};
+  set->patterns_ = patterns.size();
+
+  Arena arena;
+  Arena::Positions starts;
+  std::vector<std::string> literals;
+  for (size_t id = 0; id < patterns.size(); id++) {
+    auto const pattern = Simplify(patterns[id]);
+    auto const [root, accept] =
+        LowerAccepted(arena, pattern, static_cast<int>(id));
+    literals.push_back(Prefilter::RequiredOf(pattern));
+
+    // 能匹配空串的模式在任何位置都匹配
+    auto const& firstpos = arena.FirstposOf(root);
+    starts.insert(starts.end(), firstpos.begin(), firstpos.end());
+    if (arena.NullableOf(root)) starts.push_back(accept);
+  }
+  std::sort(starts.begin(), starts.end());
+  set->prefilter_ = Prefilter::Create(literals);
+  set->dfa_ =
+      Automaton::Build(arena, starts, true, patterns.size(), state_limit);
+  return set;
+}
+
+std::vector<int> Set::Match(std::string_view text) const {
+  std::vector<int> ids;
+  if (prefilter_ && !prefilter_->MayMatch(text)) return ids;
+
+  // 只在经过接受状态时合并位图
+  auto const words = dfa_.Words();
+  std::vector<uint64_t> matched(words, 0);
+  auto const merge = [&](uint32_t state) {
+    auto const* const bits = dfa_.AcceptsOf(state);
+    for (size_t w = 0; w < words; w++) matched[w] |= bits[w];
+  };
+
+  auto state = Automaton::kStart;
+  if (dfa_.Accepting(state)) merge(state);
+  for (auto const ch : text) {
+    state = dfa_.Next(state, ch);
+    if (dfa_.Accepting(state)) merge(state);
+  }
+
+  for (size_t w = 0; w < words; w++) {
+    for (auto bits = matched[w]; bits; bits &= bits - 1) {
+      ids.push_back(static_cast<int>(w * 64 + __builtin_ctzll(bits)));
+    }
+  }
+  return ids;
+}
+
+std::unique_ptr<Matcher> Matcher::Compile(Regex const& regex,
+                                          size_t state_limit) {
+  std::unique_ptr<Matcher> matcher{new Matcher};
+  auto const pattern = Simplify(regex);
+
+  Arena arena;
+  auto const [root, accept] = LowerAccepted(arena, pattern, 0);
+  auto starts = arena.FirstposOf(root);
+  matcher->nullable_ = arena.NullableOf(root);
+  if (matcher->nullable_) starts.push_back(accept);
+  std::sort(starts.begin(), starts.end());
+  matcher->dfa_ = Automaton::BuildLeftmost(arena, starts, state_limit);
+
+  Arena reversed;
+  auto const [rroot, raccept] = LowerAccepted(reversed, Reverse(pattern), 0);
+  auto rstarts = reversed.FirstposOf(rroot);
+  if (reversed.NullableOf(rroot)) rstarts.push_back(raccept);
+  std::sort(rstarts.begin(), rstarts.end());
+  matcher->reverse_ =
+      Automaton::Build(reversed, rstarts, false, 1, state_limit);
+
+  matcher->prefix_ = Prefilter::PrefixOf(pattern);
+  matcher->required_ = Prefilter::RequiredOf(pattern);
+  for (auto ch = 0; ch <= 255; ch++) {
+    matcher->leaders_[ch] =
+        matcher->dfa_.Next(Automaton::kStart, static_cast<char>(ch)) !=
+        Automaton::kStart;
+  }
+  return matcher;
+}
+
+bool Matcher::Match(std::string_view text) const {
+  // 文本匹配当且仅当逆序的文本匹配逆向正则表达式
+  auto state = Automaton::kStart;
+  for (auto i = text.size(); i > 0; i--) {
+    state = reverse_.Next(state, text[i - 1]);
+    if (state == Automaton::kDead) return false;
+  }
+  return reverse_.Accepting(state);
+}
+
+std::optional<Matcher::Found> Matcher::Search(std::string_view text,
+                                              size_t from) const {
+  if (from > text.size()) return std::nullopt;
+  if (!required_.empty() &&
+      text.find(required_, from) == std::string_view::npos)
+    return std::nullopt;
+
+  // 正向扫描，最后经过的接受状态即为最左最长匹配的终点
+  // 停在起始状态说明没有候选匹配，可以直接跳到下一个可能的起点
+  std::optional<size_t> end;
+  auto state = Automaton::kStart;
+  if (dfa_.Accepting(state)) end = from;
+  for (auto i = from; i < text.size(); i++) {
+    if (state == Automaton::kStart && !nullable_) {
+      if (!prefix_.empty()) {
+        i = text.find(prefix_, i);
+        if (i == std::string_view::npos) return std::nullopt;
+      } else {
+        while (i < text.size() &&
+               !leaders_[static_cast<unsigned char>(text[i])])
+          i++;
+        if (i == text.size()) return std::nullopt;
+      }
+    }
+
+    state = dfa_.Next(state, text[i]);
+    if (state == Automaton::kDead) break;
+    if (dfa_.Accepting(state)) end = i + 1;
+  }
+  if (!end) return std::nullopt;
+
+  // 从终点向前运行逆向状态机，不早于 from 的最远接受位置即为起点
+  auto start = *end;
+  state = Automaton::kStart;
+  for (auto i = *end; i > from; i--) {
+    state = reverse_.Next(state, text[i - 1]);
+    if (state == Automaton::kDead) break;
+    if (reverse_.Accepting(state)) start = i - 1;
+  }
+  return Found{start, *end - start};
+}
+
+std::vector<Matcher::Found> Matcher::FindAll(std::string_view text) const {
+  std::vector<Found> founds;
+  for (size_t offset = 0; offset <= text.size();) {
+    auto const found = Search(text, offset);
+    if (!found) break;
+
+    founds.push_back(*found);
+    offset = found->offset + std::max<size_t>(found->length, 1);
+  }
+  return founds;
+}
+
+}  // namespace toylang::regex
@@ -0,0 +1,156 @@
+#include "toylang/shuffle.h"
+
+#if defined(__x86_64__) || defined(__i386__)
+#include <immintrin.h>
+#define TOYLANG_SHUFFLE_X86 1
+#endif
+
+namespace toylang {
+
+namespace {
+
+#ifdef TOYLANG_SHUFFLE_X86
+
+/**
+ * 一个映射的两半，lo 对应未离开过接受状态的定义域，hi 对应离开过的定义域
+ */
+struct Map {
+  __m128i lo;
+  __m128i hi;
+};
+
+/**
+ * 以 index 中的每个值查找 g 的目标
+ * 目标值小于32，低4位作为重排下标，第4位选择 g 的哪一半
+ */
+__attribute__((target("ssse3"))) inline __m128i Lookup(Map const& g,
+                                                       __m128i index) {
+  auto const lo = _mm_shuffle_epi8(g.lo, index);
+  auto const hi = _mm_shuffle_epi8(g.hi, index);
+  auto const mask = _mm_cmpgt_epi8(index, _mm_set1_epi8(15));
+  return _mm_or_si128(_mm_and_si128(mask, hi), _mm_andnot_si128(mask, lo));
+}
+
+/**
+ * 先执行 f 再执行 g 的复合映射
+ */
+__attribute__((target("ssse3"))) inline Map Then(Map const& f, Map const& g) {
+  return {Lookup(g, f.lo), Lookup(g, f.hi)};
+}
+
+/**
+ * 复合一个16字节块中全部字节的映射，返回状态 state 经过该块后的目标
+ */
+using Maps = std::array<std::array<uint8_t, 2 * Shuffle::kMaxStates>, 256>;
+
+__attribute__((target("ssse3"))) uint8_t Compose(Maps const& maps,
+                                                 uint8_t const* block,
+                                                 int state) {
+  Map composed[16];
+  for (auto i = 0; i < 16; i++) {
+    auto const* const map = maps[block[i]].data();
+    composed[i].lo = _mm_loadu_si128(reinterpret_cast<__m128i const*>(map));
+    composed[i].hi =
+        _mm_loadu_si128(reinterpret_cast<__m128i const*>(map + 16));
+  }
+
+  // 相邻的映射两两复合，同一层的复合互不依赖
+  for (auto width = 1; width < 16; width *= 2) {
+    for (auto i = 0; i + width < 16; i += 2 * width) {
+      composed[i] = Then(composed[i], composed[i + width]);
+    }
+  }
+
+  alignas(16) uint8_t targets[16];
+  _mm_store_si128(reinterpret_cast<__m128i*>(targets), composed[0].lo);
+  return targets[state];
+}
+
+#endif
+
+}  // namespace
+
+bool Shuffle::Supported() {
+#ifdef TOYLANG_SHUFFLE_X86
+  return __builtin_cpu_supports("ssse3");
+#else
+  return false;
+#endif
+}
+
+std::unique_ptr<Shuffle> Shuffle::Compile(std::vector<int> const& accepts,
+                                          Jit::Transfer const& transfer) {
+  if (accepts.empty() || accepts.size() > kMaxStates || !Supported())
+    return nullptr;
+
+  std::unique_ptr<Shuffle> shuffle{new Shuffle};
+  shuffle->accepts_ = accepts;
+  shuffle->accepts_.resize(kMaxStates, 0);
+  shuffle->transfers_.resize(kMaxStates * 256, 0);
+
+  auto const& accepted = shuffle->accepts_;
+  for (auto input = 0; input < 256; input++) {
+    auto& map = shuffle->maps_[input];
+    for (size_t state = 0; state < kMaxStates; state++) {
+      auto target = 0;
+      if (state != 0 && state < accepts.size()) {
+        target = transfer(state, static_cast<uint8_t>(input));
+      }
+      shuffle->transfers_[state * 256 + input] = target;
+
+      auto const left = accepted[state] != 0 && accepted[target] == 0;
+      map[state] = target | (left ? kMaxStates : 0);
+      map[kMaxStates + state] = target | kMaxStates;
+    }
+  }
+  return shuffle;
+}
+
+Shuffle::Result Shuffle::Run(int state, uint8_t const* begin,
+                             uint8_t const* end) const {
+  Result result{begin, begin, 0};
+  auto const* p = begin;
+
+#ifdef TOYLANG_SHUFFLE_X86
+  for (; end - p >= 16; p += 16) {
+    auto const target = Compose(maps_, p, state);
+    auto const next = target & (kMaxStates - 1);
+
+    // 块内没有停止也没有离开过接受状态，块末尾的状态决定最后一次接受的位置
+    if (next != 0 && !(target & kMaxStates)) {
+      state = next;
+      if (accepts_[state] != 0) {
+        result.accept = accepts_[state];
+        result.accept_end = p + 16;
+      }
+      continue;
+    }
+
+    auto const stop = Step(state, p, p + 16, result);
+    if (stop != p + 16) {
+      result.stop = stop;
+      return result;
+    }
+  }
+#endif
+
+  result.stop = Step(state, p, end, result);
+  return result;
+}
+
+uint8_t const* Shuffle::Step(int& state, uint8_t const* begin,
+                             uint8_t const* end, Result& result) const {
+  for (auto const* p = begin; p < end; p++) {
+    auto const next = transfers_[state * 256 + *p];
+    if (next == 0) return p;
+
+    state = next;
+    if (accepts_[state] != 0) {
+      result.accept = accepts_[state];
+      result.accept_end = p + 1;
+    }
+  }
+  return end;
+}
+
+}  // namespace toylang
@@ -0,0 +1,107 @@
+#include "toylang/stream.h"
+
+#include <stdexcept>
+
+namespace toylang {
+
+TokenStream::TokenStream(Scanner& scanner, size_t capacity, bool pipelined)
+    : scanner_{scanner},
+      position_{0},
+      end_{0},
+      stopping_{false},
+      finished_{false} {
+  size_t size = 1;
+  while (size < capacity) size <<= 1;
+  ring_.resize(size);
+
+  if (!pipelined) return;
+
+  queue_ = std::make_unique<SpscQueue<Token>>(size);
+  producer_ = std::thread([this] {
+    try {
+      while (!stopping_.load(std::memory_order_relaxed)) {
+        auto token = scanner_.NextToken();
+        auto const eof = token.id == Token::kEOF;
+        while (!queue_->TryPush(std::move(token))) {
+          if (stopping_.load(std::memory_order_relaxed)) break;
+          std::this_thread::yield();
+        }
+        if (eof) break;
+      }
+    } catch (...) {
+      error_ = std::current_exception();
+    }
+    finished_.store(true, std::memory_order_release);
+  });
+}
+
+TokenStream::~TokenStream() {
+  stopping_.store(true, std::memory_order_relaxed);
+  if (producer_.joinable()) producer_.join();
+}
+
+Token const& TokenStream::Peek(size_t k) {
+  Fill(position_ + k + 1);
+  return ring_[(position_ + k) & (ring_.size() - 1)];
+}
+
+Token TokenStream::Advance() {
+  auto token = Peek();
+  position_++;
+  return token;
+}
+
+size_t TokenStream::Mark() {
+  marks_.insert(position_);
+  return position_;
+}
+
+void TokenStream::Rewind(size_t mark) {
+  if (!marks_.count(mark)) throw std::runtime_error("mark not found");
+  position_ = mark;
+}
+
+void TokenStream::Release(size_t mark) {
+  auto const it = marks_.find(mark);
+  if (it == marks_.end()) throw std::runtime_error("mark not found");
+  marks_.erase(it);
+}
+
+Token TokenStream::Produce() {
+  if (eof_) return *eof_;
+
+  Token token;
+  if (!queue_) {
+    token = scanner_.NextToken();
+  } else {
+    while (!queue_->TryPop(token)) {
+      if (finished_.load(std::memory_order_acquire)) {
+        // 后台线程结束前放入的词法单元此时一定可见
+        if (queue_->TryPop(token)) break;
+        if (error_) std::rethrow_exception(error_);
+        throw std::runtime_error("token stream terminated");
+      }
+      std::this_thread::yield();
+    }
+  }
+
+  if (token.id == Token::kEOF) eof_ = token;
+  return token;
+}
+
+void TokenStream::Fill(size_t end) {
+  while (end_ < end) {
+    if (end_ - Base() >= ring_.size()) {
+      throw std::runtime_error("token stream capacity exceeded");
+    }
+    ring_[end_ & (ring_.size() - 1)] = Produce();
+    end_++;
+  }
+}
+
+size_t TokenStream::Base() const {
+  if (marks_.empty()) return position_;
+  return std::min(position_, *marks_.begin());
+}
+
+}  // namespace toylang
@@ -0,0 +1,66 @@
+#include "toylang/symbol.h"
+
+#include <cstring>
+#include <functional>
+#include <stdexcept>
+
+namespace toylang {
+
+std::string_view SymbolPool::Shard::Store(std::string_view text) {
+  if (text.empty()) return {};
+
+  // 过长的文本单独占用一个块，不影响当前块的剩余空间
+  if (text.size() > kBlockSize / 4) {
+    std::unique_ptr<char[]> block{new char[text.size()]};
+    std::memcpy(block.get(), text.data(), text.size());
+    std::string_view const stored{block.get(), text.size()};
+    blocks.insert(blocks.empty() ? blocks.end() : blocks.end() - 1,
+                  std::move(block));
+    return stored;
+  }
+
+  if (used + text.size() > kBlockSize) {
+    blocks.emplace_back(new char[kBlockSize]);
+    used = 0;
+  }
+  auto* const data = blocks.back().get() + used;
+  std::memcpy(data, text.data(), text.size());
+  used += text.size();
+  return {data, text.size()};
+}
+
+SymbolPool::Symbol SymbolPool::Intern(std::string_view text) {
+  auto const hash = std::hash<std::string_view>{}(text);
+  auto const shard_id = hash & (kShardCount - 1);
+  auto& shard = shards_[shard_id];
+
+  std::lock_guard<std::mutex> lock{shard.mutex};
+  if (auto it = shard.ids.find(text); it != shard.ids.end()) {
+    return (it->second << kShardBits | shard_id) + 1;
+  }
+
+  auto const stored = shard.Store(text);
+  auto const id = static_cast<uint32_t>(shard.texts.size());
+  shard.texts.push_back(stored);
+  shard.ids.emplace(stored, id);
+  return (id << kShardBits | shard_id) + 1;
+}
+
+std::string_view SymbolPool::TextOf(Symbol symbol) const {
+  if (symbol == kNone) throw std::runtime_error("symbol not found");
+
+  auto const& shard = shards_[(symbol - 1) & (kShardCount - 1)];
+  std::lock_guard<std::mutex> lock{shard.mutex};
+  return shard.texts.at((symbol - 1) >> kShardBits);
+}
+
+size_t SymbolPool::CountSymbols() const {
+  size_t count = 0;
+  for (auto const& shard : shards_) {
+    std::lock_guard<std::mutex> lock{shard.mutex};
+    count += shard.texts.size();
+  }
+  return count;
+}
+
+}  // namespace toylang
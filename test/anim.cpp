@@ -0,0 +1,149 @@
+#include "toylang/anim.h"
+
+#include <chrono>
+#include <cstdio>
+#include <fstream>
+#include <regex>
+#include <sstream>
+#include <thread>
+
+#include "gtest/gtest.h"
+#include "toylang/lexical.h"
+
+namespace {
+
+void Lex() {
+  auto lexicon = toylang::Lexicon::Builder{}
+                     .DefineToken("ID", toylang::regex::Compile("\\l\\w*|a|b"))
+                     .DefineToken("SPACE", toylang::regex::Compile("[ \\n]+"))
+                     .Build();
+
+  toylang::Scanner scanner;
+  scanner.SetLexicon(lexicon);
+  for (auto const* content : {"abc de\nf ?", "abc de\nf ?", "xyz"}) {
+    scanner.SetSource(toylang::Source::Create(content));
+    while (scanner.NextToken().id != toylang::Token::kEOF) {
+    }
+  }
+}
+
+/** 节点编号在两种格式中不同，比较前统一替换 */
+std::string Mask(std::string const& events) {
+  return std::regex_replace(events, std::regex{"0x[0-9a-f]+"}, "ID");
+}
+
+}  // namespace
+
+TEST(AnimTest, BinaryRecord) {
+  testing::internal::CaptureStderr();
+  toylang::Anim::Open(toylang::Anim::Format::kJson);
+  Lex();
+  toylang::Anim::Close();
+  auto const json = testing::internal::GetCapturedStderr();
+
+  auto const path = testing::TempDir() + "toylang_anim_test.bin";
+  toylang::Anim::Open(toylang::Anim::Format::kBinary, path);
+  Lex();
+  toylang::Anim::Close();
+  EXPECT_FALSE(toylang::Anim::Enabled());
+
+  std::ifstream record{path, std::ios::binary};
+  std::ostringstream converted;
+  toylang::Anim::Convert(record, converted);
+  std::remove(path.c_str());
+
+  EXPECT_FALSE(json.empty());
+  EXPECT_EQ(Mask(converted.str()), Mask(json));
+}
+
+TEST(AnimTest, FlightRecorder) {
+  auto const path = testing::TempDir() + "toylang_anim_flight.log";
+  std::remove(path.c_str());
+
+  toylang::Anim::FlightOptions options;
+  options.capacity = 4;
+  options.events =
+      1u << static_cast<unsigned>(toylang::Anim::Event::kScannerAcceptToken);
+  options.path = path;
+  options.interval = std::chrono::milliseconds{0};
+  toylang::Anim::StartFlight(options);
+  Lex();
+  toylang::Anim::StopFlight();
+
+  std::ifstream file{path};
+  std::vector<std::string> lines;
+  for (std::string line; std::getline(file, line);) lines.push_back(line);
+  std::remove(path.c_str());
+
+  // 两段源码各有一个错误词法单元，每次只写出最近的4条事件
+  ASSERT_EQ(lines.size(), 10);
+  EXPECT_NE(lines[0].find("\"reason\":\"error\""), std::string::npos);
+  EXPECT_NE(lines[0].find("\"dropped\":3"), std::string::npos);
+  for (auto i : {1, 2, 3, 4, 6, 7, 8, 9}) {
+    EXPECT_NE(lines[i].find("ScannerAcceptToken"), std::string::npos);
+  }
+  EXPECT_NE(lines[4].find("\"id\":-1"), std::string::npos);
+  EXPECT_NE(lines[9].find("\"id\":-1"), std::string::npos);
+}
+
+TEST(AnimTest, FlightRecorderInterval) {
+  auto const path = testing::TempDir() + "toylang_anim_flight_interval.log";
+  std::remove(path.c_str());
+
+  toylang::Anim::FlightOptions options;
+  options.capacity = 4;
+  options.events =
+      1u << static_cast<unsigned>(toylang::Anim::Event::kScannerAcceptToken);
+  options.path = path;
+  options.interval = std::chrono::hours{1};
+  toylang::Anim::StartFlight(options);
+  for (auto i = 0; i < 5; i++) Lex();
+  toylang::Anim::StopFlight();
+
+  std::ifstream file{path};
+  std::vector<std::string> dumps;
+  for (std::string line; std::getline(file, line);) {
+    if (line.find("FlightDump") != std::string::npos) dumps.push_back(line);
+  }
+  std::remove(path.c_str());
+
+  // 第一个错误词法单元立即写出，其余9次触发合并为停止时的一次写出
+  ASSERT_EQ(dumps.size(), 2);
+  EXPECT_NE(dumps[0].find("\"triggers\":1"), std::string::npos);
+  EXPECT_NE(dumps[1].find("\"triggers\":9"), std::string::npos);
+}
+
+TEST(AnimTest, FlightRecorderConcurrent) {
+  auto const path = testing::TempDir() + "toylang_anim_flight_mt.log";
+  std::remove(path.c_str());
+
+  toylang::Anim::FlightOptions options;
+  options.capacity = 64;
+  options.on_error = false;
+  options.path = path;
+  toylang::Anim::StartFlight(options);
+
+  // 记录事件的同时反复停止与启动飞行记录器
+  std::vector<std::thread> threads;
+  for (int i = 0; i < 4; i++) {
+    threads.emplace_back([] {
+      for (int j = 0; j < 20; j++) Lex();
+    });
+  }
+  for (int i = 0; i < 20; i++) {
+    toylang::Anim::StopFlight();
+    toylang::Anim::StartFlight(options);
+  }
+  for (auto& thread : threads) thread.join();
+  toylang::Anim::DumpFlight("test");
+  toylang::Anim::StopFlight();
+
+  std::ifstream file{path};
+  std::vector<std::string> lines;
+  for (std::string line; std::getline(file, line);) lines.push_back(line);
+  std::remove(path.c_str());
+
+  ASSERT_FALSE(lines.empty());
+  EXPECT_NE(lines[0].find("\"reason\":\"test\""), std::string::npos);
+  EXPECT_LE(lines.size(), 65);
+}
@@ -0,0 +1,113 @@
+#include "toylang/cache.h"
+
+#include <filesystem>
+#include <fstream>
+
+#include "gtest/gtest.h"
+
+namespace {
+
+std::shared_ptr<toylang::Lexicon const> Build(bool with_number) {
+  toylang::Lexicon::Builder builder;
+  builder.DefineToken("ID", toylang::regex::Compile("\\l\\w*"))
+      .DefineToken("SPACE", toylang::regex::Compile("\\s+"))
+      .DefineToken("STRING", toylang::regex::Compile("\"[^\"]*\""));
+  if (with_number)
+    builder.DefineToken("NUMBER", toylang::regex::Compile("\\d+"));
+  builder.DefineKeywords("ID", {"if"});
+  return builder.Build();
+}
+
+std::vector<toylang::Token> Lex(
+    std::shared_ptr<toylang::Lexicon const> const& lexicon,
+    std::shared_ptr<toylang::Source const> const& source) {
+  toylang::Scanner scanner;
+  scanner.SetLexicon(lexicon);
+  scanner.SetSource(source);
+  std::vector<toylang::Token> tokens;
+  for (auto token = scanner.NextToken(); token.id != toylang::Token::kEOF;
+       token = scanner.NextToken()) {
+    tokens.push_back(token);
+  }
+  return tokens;
+}
+
+void ExpectSame(std::vector<toylang::Token> const& actual,
+                std::vector<toylang::Token> const& expected) {
+  ASSERT_EQ(actual.size(), expected.size());
+  for (size_t i = 0; i < actual.size(); i++) {
+    EXPECT_EQ(actual[i].id, expected[i].id);
+    EXPECT_EQ(actual[i].offset, expected[i].offset);
+    EXPECT_EQ(actual[i].length, expected[i].length);
+    EXPECT_EQ(actual[i].lookahead, expected[i].lookahead);
+    EXPECT_EQ(actual[i].context, expected[i].context);
+    EXPECT_EQ(actual[i].LocationOf(), expected[i].LocationOf());
+    EXPECT_EQ(actual[i].end_line, expected[i].end_line);
+    EXPECT_EQ(actual[i].end_column, expected[i].end_column);
+  }
+}
+
+}  // namespace
+
+TEST(TokenCacheTest, HitAndMiss) {
+  auto const directory = testing::TempDir() + "toylang_cache_test";
+  std::filesystem::remove_all(directory);
+
+  auto const lexicon = Build(true);
+  auto const source = toylang::Source::Create(
+      "if abc 42 \"multi\nline\" ?? x\n\n  tail 7", "main.tl");
+  auto const expected = Lex(lexicon, source);
+
+  toylang::TokenCache cache{directory};
+  ExpectSame(cache.Scan(lexicon, source), expected);
+  EXPECT_EQ(cache.GetStats().misses, 1);
+  auto const path = cache.PathOf(*lexicon, *source, 0);
+  ASSERT_TRUE(std::filesystem::exists(path));
+
+  // 第二次加载缓存，不再分析
+  auto const loaded = cache.Scan(lexicon, source);
+  EXPECT_EQ(cache.GetStats().hits, 1);
+  ExpectSame(loaded, expected);
+  EXPECT_EQ(loaded.front().NameOf(), "if");
+  EXPECT_EQ(loaded.back().TextOf(), "7");
+
+  // 每个词法单元只占几个字节
+  EXPECT_LT(std::filesystem::file_size(path), 8 + 24 + expected.size() * 4);
+
+  // 词法规则或源码改变时不命中
+  auto const other = Build(false);
+  EXPECT_NE(other->Fingerprint(), lexicon->Fingerprint());
+  EXPECT_EQ(Build(true)->Fingerprint(), lexicon->Fingerprint());
+  ExpectSame(cache.Scan(other, source), Lex(other, source));
+  auto const edited = toylang::Source::Create("if abc 43");
+  ExpectSame(cache.Scan(lexicon, edited), Lex(lexicon, edited));
+  EXPECT_EQ(cache.GetStats().misses, 3);
+
+  // 损坏的缓存文件视为未命中并被重新写入
+  {
+    std::ofstream file{path, std::ios::binary | std::ios::trunc};
+    file << "TLTOKS2\ngarbage";
+  }
+  ExpectSame(cache.Scan(lexicon, source), expected);
+  EXPECT_EQ(cache.GetStats().misses, 4);
+  ExpectSame(cache.Scan(lexicon, source), expected);
+  EXPECT_EQ(cache.GetStats().hits, 2);
+
+  // 文件头完好但词法单元ID越界时同样视为未命中
+  // 最后一个词法单元的四个字段各占一个字节，首字节为ID之差
+  std::string data;
+  {
+    std::ifstream file{path, std::ios::binary};
+    data.assign(std::istreambuf_iterator<char>{file},
+                std::istreambuf_iterator<char>{});
+  }
+  data[data.size() - 4] = 0x7e;
+  {
+    std::ofstream file{path, std::ios::binary | std::ios::trunc};
+    file << data;
+  }
+  ExpectSame(cache.Scan(lexicon, source), expected);
+  EXPECT_EQ(cache.GetStats().misses, 5);
+
+  std::filesystem::remove_all(directory);
+}
@@ -0,0 +1,121 @@
+#include "toylang/coroutine.h"
+
+#if __cplusplus >= 202002L
+
+#include <fcntl.h>
+#include <unistd.h>
+
+#include <cstdio>
+#include <fstream>
+#include <string>
+#include <vector>
+
+#include "gtest/gtest.h"
+
+TEST(CoroutineTest, AsyncTokens) {
+  auto lexicon = toylang::Lexicon::Builder{}
+                     .DefineToken("ID", toylang::regex::Compile("\\l+"))
+                     .DefineToken("SPACE", toylang::regex::Compile("\\s+"))
+                     .Build();
+
+  int fds[2];
+  ASSERT_EQ(pipe(fds), 0);
+
+  toylang::EpollPoller poller;
+  auto const read_all = [&]() -> toylang::Task<std::string> {
+    toylang::AsyncReader reader{poller, fds[0], 4};
+    std::string content;
+    for (auto chunk = co_await reader.Read(); !chunk.empty();
+         chunk = co_await reader.Read()) {
+      content += chunk;
+    }
+    co_return content;
+  };
+
+  // 数据分块到达，读取协程在没有数据时挂起
+  auto task = read_all();
+  task.Start();
+  EXPECT_FALSE(task.Done());
+  ASSERT_EQ(write(fds[1], "abc de", 6), 6);
+  poller.Poll();
+  EXPECT_FALSE(task.Done());
+  ASSERT_EQ(write(fds[1], "f ghi", 5), 5);
+  close(fds[1]);
+  while (!task.Done()) poller.Poll();
+
+  toylang::Scanner scanner;
+  scanner.SetLexicon(lexicon);
+  scanner.SetSource(toylang::Source::Create(task.Result()));
+  std::vector<std::string> texts;
+  for (auto const& token : toylang::Tokens(scanner)) {
+    if (token.id == lexicon->IdOfToken("ID")) texts.push_back(token.TextOf());
+  }
+  EXPECT_EQ(texts, (std::vector<std::string>{"abc", "def", "ghi"}));
+}
+
+TEST(CoroutineTest, RegularFile) {
+  auto const path = testing::TempDir() + "toylang_coroutine_test.txt";
+  std::ofstream{path} << "abc def\nghi";
+
+  // 普通文件在后台线程中读取，读取协程挂起直到 Poller 恢复它
+  toylang::EpollPoller poller;
+  auto const read_all = [&]() -> toylang::Task<std::string> {
+    toylang::AsyncReader reader{poller, open(path.c_str(), O_RDONLY), 4};
+    std::string content;
+    for (auto chunk = co_await reader.Read(); !chunk.empty();
+         chunk = co_await reader.Read()) {
+      content += chunk;
+    }
+    co_return content;
+  };
+  auto task = read_all();
+  task.Start();
+  EXPECT_FALSE(task.Done());
+  while (!task.Done()) poller.Poll();
+  EXPECT_EQ(task.Result(), "abc def\nghi");
+
+  auto load = toylang::LoadAsync(poller, path);
+  load.Start();
+  EXPECT_FALSE(load.Done());
+  while (!load.Done()) poller.Poll();
+  auto const source = load.Result();
+  ASSERT_NE(source, nullptr);
+  EXPECT_EQ(source->content, "abc def\nghi");
+
+  // 同时加载多个文件，读取由数量有限的线程共享
+  auto const threads = [] {
+    std::ifstream status{"/proc/self/status"};
+    for (std::string line; std::getline(status, line);) {
+      if (line.rfind("Threads:", 0) == 0) return std::stoul(line.substr(8));
+    }
+    return 0UL;
+  };
+  auto const before = threads();
+  std::vector<toylang::Task<std::shared_ptr<toylang::Source const>>> loads;
+  for (auto i = 0; i < 16; i++)
+    loads.push_back(toylang::LoadAsync(poller, path));
+  for (auto& load : loads) load.Start();
+  EXPECT_LE(threads(), before + toylang::Poller::kMaxReadThreads);
+  for (auto& load : loads) {
+    while (!load.Done()) poller.Poll();
+    EXPECT_EQ(load.Result()->content, "abc def\nghi");
+  }
+  std::remove(path.c_str());
+}
+
+TEST(CoroutineTest, RestoreFlags) {
+  // 读取器关闭自己的文件描述符，共享同一文件描述的其它持有者不受影响
+  int fds[2];
+  ASSERT_EQ(pipe(fds), 0);
+  auto const flags = fcntl(fds[0], F_GETFL);
+  {
+    toylang::EpollPoller poller;
+    toylang::AsyncReader reader{poller, dup(fds[0])};
+    EXPECT_NE(fcntl(fds[0], F_GETFL) & O_NONBLOCK, 0);
+  }
+  EXPECT_EQ(fcntl(fds[0], F_GETFL), flags);
+  close(fds[0]);
+  close(fds[1]);
+}
+
+#endif
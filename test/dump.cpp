@@ -0,0 +1,149 @@
+#include "toylang/dump.h"
+
+#include <cstdio>
+
+#include "gtest/gtest.h"
+#include "nlohmann/json.hpp"
+
+namespace {
+
+std::shared_ptr<toylang::Lexicon const> Build() {
+  return toylang::Lexicon::Builder{}
+      .DefineToken("ID", toylang::regex::Compile("\\l\\w*"))
+      .DefineToken("SPACE", toylang::regex::Compile("\\s+"))
+      .DefineToken("STRING", toylang::regex::Compile("\"[^\"]*\""))
+      .Build();
+}
+
+/** 分析源码，以指定格式写出全部词法单元并读回 */
+std::string Dump(std::shared_ptr<toylang::Lexicon const> const& lexicon,
+                 std::string const& content,
+                 toylang::TokenWriter::Format format, unsigned fields,
+                 size_t capacity = toylang::TokenWriter::kDefaultCapacity) {
+  auto const file = std::tmpfile();
+  {
+    toylang::Scanner scanner;
+    scanner.SetLexicon(lexicon);
+    scanner.SetSource(toylang::Source::Create(content));
+    toylang::TokenWriter writer{lexicon, file, format, fields, capacity};
+    for (auto token = scanner.NextToken(); token.id != toylang::Token::kEOF;
+         token = scanner.NextToken()) {
+      writer.Write(token);
+    }
+  }
+
+  std::string written;
+  std::rewind(file);
+  char chunk[4096];
+  for (size_t n; (n = std::fread(chunk, 1, sizeof(chunk), file)) > 0;)
+    written.append(chunk, n);
+  std::fclose(file);
+  return written;
+}
+
+}  // namespace
+
+TEST(TokenWriterTest, JsonLines) {
+  auto const lexicon = Build();
+  auto const all = toylang::TokenWriter::kAllFields;
+  auto const lines =
+      Dump(lexicon, "ab \"x\\y\n\tz\" ?", toylang::TokenWriter::Format::kJsonLines,
+           all, 1);
+
+  std::vector<nlohmann::json> tokens;
+  size_t begin = 0;
+  for (auto end = lines.find('\n'); end != std::string::npos;
+       begin = end + 1, end = lines.find('\n', begin)) {
+    tokens.push_back(nlohmann::json::parse(lines.substr(begin, end - begin)));
+  }
+  ASSERT_EQ(begin, lines.size());
+  ASSERT_EQ(tokens.size(), 5);
+  EXPECT_EQ(tokens[0], (nlohmann::json{{"id", 1},
+                                       {"name", "ID"},
+                                       {"offset", 0},
+                                       {"length", 2},
+                                       {"line", 1},
+                                       {"column", 1},
+                                       {"text", "ab"}}));
+  EXPECT_EQ(tokens[2]["text"], "\"x\\y\n\tz\"");
+  EXPECT_EQ(tokens[4]["line"], 2);
+  EXPECT_EQ(tokens[4]["name"], "<ERR>");
+
+  auto const fields = toylang::TokenWriter::ParseFields("name,text");
+  ASSERT_TRUE(fields);
+  EXPECT_EQ(Dump(lexicon, "ab cd", toylang::TokenWriter::Format::kJsonLines,
+                 *fields),
+            "{\"name\":\"ID\",\"text\":\"ab\"}\n"
+            "{\"name\":\"SPACE\",\"text\":\" \"}\n"
+            "{\"name\":\"ID\",\"text\":\"cd\"}\n");
+  EXPECT_EQ(toylang::TokenWriter::ParseFields("line,column"),
+            toylang::TokenWriter::kPosition);
+  EXPECT_FALSE(toylang::TokenWriter::ParseFields("id,size"));
+  EXPECT_FALSE(toylang::TokenWriter::ParseFields(""));
+}
+
+TEST(TokenWriterTest, InvalidUtf8) {
+  // Latin-1 字节、截断的多字节序列与代理项都不是合法的 UTF-8
+  auto const lines =
+      Dump(Build(), "ab \xe9t\xe9 \xe4\xb8\xad \xed\xa0\x80 \xe4\xb8",
+           toylang::TokenWriter::Format::kJsonLines,
+           toylang::TokenWriter::kName | toylang::TokenWriter::kText);
+
+  std::vector<nlohmann::json> tokens;
+  size_t begin = 0;
+  for (auto end = lines.find('\n'); end != std::string::npos;
+       begin = end + 1, end = lines.find('\n', begin)) {
+    tokens.push_back(nlohmann::json::parse(lines.substr(begin, end - begin)));
+  }
+  std::vector<std::string> texts;
+  for (auto const& token : tokens) {
+    if (token["name"] != "SPACE") texts.push_back(token["text"]);
+  }
+  EXPECT_EQ(texts, (std::vector<std::string>{
+                       "ab", "\xef\xbf\xbd", "t", "\xef\xbf\xbd", "\xe4\xb8\xad",
+                       "\xef\xbf\xbd\xef\xbf\xbd\xef\xbf\xbd",
+                       "\xef\xbf\xbd\xef\xbf\xbd"}));
+}
+
+TEST(TokenWriterTest, Binary) {
+  auto const lexicon = Build();
+  auto const fields =
+      toylang::TokenWriter::kId | toylang::TokenWriter::kOffset |
+      toylang::TokenWriter::kLength | toylang::TokenWriter::kText;
+  auto const written = Dump(lexicon, "ab cd ?",
+                            toylang::TokenWriter::Format::kBinary, fields);
+
+  std::string expected{toylang::TokenWriter::kMagic};
+  expected += std::string{static_cast<char>(fields), 3};
+  expected += "\x02ID\x05SPACE\x06STRING";
+  // ID 以 zigzag 编码，偏移量为与前一个词法单元之差
+  expected += std::string{"\x02\x00\x02\x02" "ab", 6};
+  expected += std::string{"\x04\x02\x01\x01" " ", 5};
+  expected += std::string{"\x02\x01\x02\x02" "cd", 6};
+  expected += std::string{"\x04\x02\x01\x01" " ", 5};
+  expected += std::string{"\x01\x01\x01\x01" "?", 5};
+  EXPECT_EQ(written, expected);
+}
+
+TEST(TokenWriterTest, WriteError) {
+  // 以只读方式打开的文件无法写入，中途的写入错误在最后一次 Flush 时报告
+  auto const path = testing::TempDir() + "toylang_dump_test.jsonl";
+  std::fclose(std::fopen(path.c_str(), "wb"));
+  auto const file = std::fopen(path.c_str(), "rb");
+  ASSERT_NE(file, nullptr);
+
+  auto const lexicon = Build();
+  toylang::Scanner scanner;
+  scanner.SetLexicon(lexicon);
+  scanner.SetSource(toylang::Source::Create("ab cd ef"));
+  toylang::TokenWriter writer{lexicon, file,
+                              toylang::TokenWriter::Format::kJsonLines,
+                              toylang::TokenWriter::kAllFields, 1};
+  writer.Write(scanner.NextToken());
+  writer.Write(scanner.NextToken());
+  EXPECT_FALSE(writer.Flush());
+  EXPECT_FALSE(writer.Flush());
+
+  std::fclose(file);
+  std::remove(path.c_str());
+}
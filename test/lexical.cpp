@@ -1,6 +1,11 @@
 #include "toylang/lexical.h"
 
+#include <chrono>
+#include <tuple>
+
 #include "gtest/gtest.h"
+#include "toylang/jit.h"
+#include "toylang/shuffle.h"
 
 TEST(LexiconTest, Basic) {
   toylang::Scanner scanner;
@@ -142,10 +147,47 @@ TEST(LexiconTest, Numbre) {
   EXPECT_EQ(scanner.NextToken().id, number->IdOfToken("SPACE"));
   EXPECT_EQ(scanner.NextToken().id, number->IdOfToken("BAD_NUMBER"));
   EXPECT_EQ(scanner.NextToken().id, number->IdOfToken("SPACE"));
+  // "0. " 回退到 "0"，"." 无法匹配任何词法单元
+  EXPECT_EQ(scanner.NextToken().id, number->IdOfToken("NUMBER"));
   EXPECT_EQ(scanner.NextToken().id, toylang::Token::kError);
+  EXPECT_EQ(scanner.NextToken().id, number->IdOfToken("SPACE"));
+  // "023 " 被拆分为 "0" 和 "23"
+  EXPECT_EQ(scanner.NextToken().id, number->IdOfToken("NUMBER"));
+  EXPECT_EQ(scanner.NextToken().id, number->IdOfToken("NUMBER"));
+  EXPECT_EQ(scanner.NextToken().id, number->IdOfToken("SPACE"));
+  // "123.456e+ " 回退到 "123.456e"，"+" 无法匹配任何词法单元
+  EXPECT_EQ(scanner.NextToken().id, number->IdOfToken("BAD_NUMBER"));
   EXPECT_EQ(scanner.NextToken().id, toylang::Token::kError);
+  EXPECT_EQ(scanner.NextToken().id, number->IdOfToken("SPACE"));
+  EXPECT_EQ(scanner.NextToken().id, number->IdOfToken("BAD_NUMBER"));
   EXPECT_EQ(scanner.NextToken().id, toylang::Token::kError);
-  EXPECT_EQ(scanner.NextToken().id, toylang::Token::kError);
+  EXPECT_EQ(scanner.NextToken().id, number->IdOfToken("SPACE"));
+  EXPECT_EQ(scanner.NextToken().id, toylang::Token::kEOF);
+}
+
+TEST(LexiconTest, Backtrack) {
+  // 每个 "a" 都会向前扫描到结尾才发现无法匹配 "a*b"
+  auto lexicon = toylang::Lexicon::Builder{}
+                     .DefineToken("A", toylang::regex::Compile("a"))
+                     .DefineToken("AB", toylang::regex::Compile("a*b"))
+                     .Build();
+
+  toylang::Scanner scanner;
+  scanner.SetLexicon(lexicon);
+  scanner.SetSource(toylang::Source::Create(std::string(20000, 'a') + "c"));
+  size_t count = 0;
+  for (auto token = scanner.NextToken(); token.id != toylang::Token::kEOF;
+       token = scanner.NextToken()) {
+    if (count < 20000) {
+      ASSERT_EQ(token.id, lexicon->IdOfToken("A"));
+      EXPECT_EQ(token.offset, count);
+      EXPECT_EQ(token.length, 1);
+    } else {
+      EXPECT_EQ(token.id, toylang::Token::kError);
+    }
+    count++;
+  }
+  EXPECT_EQ(count, 20001);
 }
 
 TEST(LexiconTest, Comment) {
@@ -170,4 +212,693 @@ TEST(LexiconTest, Comment) {
     EXPECT_EQ(scanner.NextToken().id, comment->IdOfToken("COMMENT_BLOCK"));
     EXPECT_EQ(scanner.NextToken().id, comment->IdOfToken("SPACE"));
     EXPECT_EQ(scanner.NextToken().id, toylang::Token::kEOF);
-}
\ No newline at end of file
+}
+
+TEST(LexiconTest, Relex) {
+  auto lexicon = toylang::Lexicon::Builder{}
+                     .DefineToken("ID", toylang::regex::Compile("\\l\\w*"))
+                     .DefineToken("NUMBER", toylang::regex::Compile("\\d+"))
+                     .DefineToken("SPACE", toylang::regex::Compile("\\s+"))
+                     .Build();
+
+  auto const lex = [&](std::string const& content) {
+    toylang::Scanner scanner;
+    scanner.SetLexicon(lexicon);
+    scanner.SetSource(toylang::Source::Create(content));
+    std::vector<toylang::Token> tokens;
+    for (auto token = scanner.NextToken(); token.id != toylang::Token::kEOF;
+         token = scanner.NextToken()) {
+      tokens.push_back(token);
+    }
+    return tokens;
+  };
+
+  auto const expect_same = [](std::vector<toylang::Token> const& lhs,
+                              std::vector<toylang::Token> const& rhs) {
+    ASSERT_EQ(lhs.size(), rhs.size());
+    for (size_t i = 0; i < lhs.size(); i++) {
+      EXPECT_EQ(lhs[i].id, rhs[i].id);
+      EXPECT_EQ(lhs[i].offset, rhs[i].offset);
+      EXPECT_EQ(lhs[i].length, rhs[i].length);
+      EXPECT_EQ(lhs[i].start_line, rhs[i].start_line);
+      EXPECT_EQ(lhs[i].start_column, rhs[i].start_column);
+      EXPECT_EQ(lhs[i].end_line, rhs[i].end_line);
+      EXPECT_EQ(lhs[i].end_column, rhs[i].end_column);
+      EXPECT_EQ(lhs[i].TextOf(), rhs[i].TextOf());
+    }
+  };
+
+  std::string const content = "abc def 123\nghi 456 jkl\nmno";
+  toylang::Scanner scanner;
+  scanner.SetLexicon(lexicon);
+  scanner.SetSource(toylang::Source::Create(content));
+
+  // 在词法单元内部插入字符
+  auto tokens = lex(content);
+  auto relexed = scanner.Relex(tokens, {.offset = 5, .removed = 0,
+                                        .inserted = "xx"});
+  EXPECT_EQ(relexed.first, 2UL);
+  EXPECT_EQ(relexed.count, 1UL);
+  EXPECT_EQ(relexed.tokens.size(), 1UL);
+  relexed.Apply(tokens);
+  expect_same(tokens, lex(relexed.source->content));
+
+  // 插入换行，拆分词法单元
+  relexed = scanner.Relex(tokens, {.offset = 14, .removed = 0,
+                                   .inserted = "\n9"});
+  relexed.Apply(tokens);
+  expect_same(tokens, lex(relexed.source->content));
+
+  // 删除跨越多个词法单元的文本
+  relexed = scanner.Relex(tokens, {.offset = 2, .removed = 9,
+                                   .inserted = ""});
+  relexed.Apply(tokens);
+  expect_same(tokens, lex(relexed.source->content));
+
+  // 在末尾追加文本
+  auto const size = relexed.source->content.size();
+  relexed = scanner.Relex(tokens, {.offset = size, .removed = 0,
+                                   .inserted = "pq 7"});
+  EXPECT_EQ(relexed.count, 1UL);
+  relexed.Apply(tokens);
+  expect_same(tokens, lex(relexed.source->content));
+}
+
+TEST(LexiconTest, Lookahead) {
+  auto lexicon = toylang::Lexicon::Builder{}
+                     .DefineToken("A", toylang::regex::Compile("a"))
+                     .DefineToken("B", toylang::regex::Compile("a*b"))
+                     .Build();
+
+  // 末尾追加 b 会改变全部词法单元，因此每个词法单元的前瞻都必须到达末尾，
+  // 包括因失败记录而提前停止扫描的词法单元
+  toylang::Scanner scanner;
+  scanner.SetLexicon(lexicon);
+  scanner.SetSource(toylang::Source::Create("aaaa"));
+  for (auto token = scanner.NextToken(); token.id != toylang::Token::kEOF;
+       token = scanner.NextToken()) {
+    EXPECT_EQ(token.NameOf(), "A");
+    EXPECT_EQ(token.offset + token.length + token.lookahead, 5UL);
+  }
+
+  scanner.SetSource(toylang::Source::Create("aaaa"));
+  std::vector<toylang::Token> tokens;
+  for (auto token = scanner.NextToken(); token.id != toylang::Token::kEOF;
+       token = scanner.NextToken()) {
+    tokens.push_back(token);
+  }
+  auto relexed = scanner.Relex(tokens, {.offset = 4, .removed = 0,
+                                        .inserted = "b"});
+  relexed.Apply(tokens);
+  ASSERT_EQ(tokens.size(), 1UL);
+  EXPECT_EQ(tokens[0].NameOf(), "B");
+  EXPECT_EQ(tokens[0].length, 5UL);
+}
+
+TEST(LexiconTest, RelexTokenList) {
+  auto lexicon = toylang::Lexicon::Builder{}
+                     .DefineToken("ID", toylang::regex::Compile("\\l\\w*"))
+                     .DefineToken("NUMBER", toylang::regex::Compile("\\d+"))
+                     .DefineToken("SPACE", toylang::regex::Compile("\\s+"))
+                     .DefineToken("A", toylang::regex::Compile("@"))
+                     .DefineToken("B", toylang::regex::Compile("@#=!"))
+                     .DefineToken("C", toylang::regex::Compile("#"))
+                     .Build();
+
+  auto const lex = [&](std::string const& content) {
+    toylang::Scanner scanner;
+    scanner.SetLexicon(lexicon);
+    scanner.SetSource(toylang::Source::Create(content));
+    std::vector<toylang::Token> tokens;
+    for (auto token = scanner.NextToken(); token.id != toylang::Token::kEOF;
+         token = scanner.NextToken()) {
+      tokens.push_back(token);
+    }
+    return tokens;
+  };
+
+  std::string content = "abc def 123\nghi 456 jkl\nmno pq";
+  toylang::Scanner scanner;
+  scanner.SetLexicon(lexicon);
+  scanner.SetSource(toylang::Source::Create(content));
+  toylang::TokenList tokens{lex(content), toylang::Source::Create(content)};
+
+  // 依次在不同位置编辑，间隙随之前后移动
+  std::vector<toylang::Edit> const edits{
+      {.offset = 5, .removed = 0, .inserted = "xx"},
+      {.offset = 0, .removed = 0, .inserted = "zz "},
+      {.offset = 20, .removed = 0, .inserted = "\n9"},
+      {.offset = 2, .removed = 9, .inserted = ""},
+      {.offset = 6, .removed = 3, .inserted = "4\n\n5"},
+      {.offset = 1, .removed = 0, .inserted = " @#=x "},
+      {.offset = 5, .removed = 1, .inserted = "!"},
+  };
+  for (auto const& edit : edits) {
+    auto const relexed = scanner.Relex(tokens, edit);
+    relexed.Apply(tokens);
+    content.replace(edit.offset, edit.removed, edit.inserted);
+    ASSERT_EQ(relexed.source->content, content);
+
+    auto const expected = lex(content);
+    auto const actual = tokens.List();
+    ASSERT_EQ(actual.size(), expected.size());
+    for (size_t i = 0; i < expected.size(); i++) {
+      EXPECT_EQ(actual[i].id, expected[i].id);
+      EXPECT_EQ(actual[i].offset, expected[i].offset);
+      EXPECT_EQ(actual[i].length, expected[i].length);
+      EXPECT_EQ(actual[i].start_line, expected[i].start_line);
+      EXPECT_EQ(actual[i].start_column, expected[i].start_column);
+      EXPECT_EQ(actual[i].end_line, expected[i].end_line);
+      EXPECT_EQ(actual[i].end_column, expected[i].end_column);
+      EXPECT_EQ(actual[i].TextOf(), expected[i].TextOf());
+      EXPECT_GE(actual[i].offset + actual[i].length + actual[i].lookahead,
+                expected[i].offset + expected[i].length +
+                    expected[i].lookahead);
+    }
+  }
+
+  // C 只读取到偏移量2，但之前的 A 读取到了偏移量3，
+  // 编辑偏移量3时必须从 A 开始重新分析
+  content = "@#=?";
+  scanner.SetSource(toylang::Source::Create(content));
+  auto relexed = scanner.Relex(lex(content),
+                               {.offset = 3, .removed = 1, .inserted = "!"});
+  EXPECT_EQ(relexed.first, 0UL);
+  ASSERT_EQ(relexed.tokens.size(), 1UL);
+  EXPECT_EQ(relexed.tokens[0].NameOf(), "B");
+}
+
+TEST(LexiconTest, Keywords) {
+  std::vector<std::string> keywords{"if",    "else",  "while", "for",
+                                    "do",    "break", "return", "int",
+                                    "float", "void",  "struct", "switch"};
+  auto lexicon = toylang::Lexicon::Builder{}
+                     .DefineToken("ID", toylang::regex::Compile("\\l\\w*"))
+                     .DefineToken("SPACE", toylang::regex::Compile("\\s+"))
+                     .DefineKeywords("ID", keywords)
+                     .Build();
+
+  toylang::Scanner scanner;
+  scanner.SetLexicon(lexicon);
+  scanner.SetSource(toylang::Source::Create("while iff do_ return"));
+  EXPECT_EQ(scanner.NextToken().id, lexicon->IdOfToken("while"));
+  EXPECT_EQ(scanner.NextToken().id, lexicon->IdOfToken("SPACE"));
+  EXPECT_EQ(scanner.NextToken().id, lexicon->IdOfToken("ID"));
+  EXPECT_EQ(scanner.NextToken().id, lexicon->IdOfToken("SPACE"));
+  EXPECT_EQ(scanner.NextToken().id, lexicon->IdOfToken("ID"));
+  EXPECT_EQ(scanner.NextToken().id, lexicon->IdOfToken("SPACE"));
+  EXPECT_EQ(scanner.NextToken().id, lexicon->IdOfToken("return"));
+  EXPECT_EQ(scanner.NextToken().id, toylang::Token::kEOF);
+
+  for (auto const& keyword : keywords) {
+    EXPECT_EQ(lexicon->ClassifyToken(lexicon->IdOfToken("ID"), keyword),
+              lexicon->IdOfToken(keyword));
+  }
+
+  EXPECT_THROW(toylang::Lexicon::Builder{}
+                   .DefineToken("ID", toylang::regex::Compile("\\l+"))
+                   .DefineKeywords("ID", {"x1"})
+                   .Build(),
+               std::runtime_error);
+}
+
+TEST(LexiconTest, ErrorRun) {
+  auto lexicon = toylang::Lexicon::Builder{}
+                     .DefineToken("ID", toylang::regex::Compile("\\l+"))
+                     .DefineToken("SPACE", toylang::regex::Compile("\\s+"))
+                     .Build();
+
+  toylang::Scanner scanner;
+  scanner.SetLexicon(lexicon);
+  scanner.SetSource(toylang::Source::Create(
+      "abc " + std::string(100, '#') + std::string(3, '\0') + "0123def"));
+  EXPECT_EQ(scanner.NextToken().id, lexicon->IdOfToken("ID"));
+  EXPECT_EQ(scanner.NextToken().id, lexicon->IdOfToken("SPACE"));
+
+  auto error = scanner.NextToken();
+  EXPECT_EQ(error.id, toylang::Token::kError);
+  EXPECT_EQ(error.offset, 4);
+  EXPECT_EQ(error.length, 107);
+
+  auto def = scanner.NextToken();
+  EXPECT_EQ(def.id, lexicon->IdOfToken("ID"));
+  EXPECT_EQ(def.TextOf(), "def");
+  EXPECT_EQ(scanner.NextToken().id, toylang::Token::kEOF);
+}
+
+TEST(LexiconTest, Jit) {
+  auto const build = [](bool jit) {
+    toylang::Lexicon::Builder builder;
+    builder.DefineToken("ID", toylang::regex::Compile("[a-eg-ik-mo-z_]\\w*"))
+        .DefineToken("NUMBER", toylang::regex::Compile("\\d+(\\.\\d+)?"))
+        .DefineToken("OP", toylang::regex::Compile("[-+*/=<>!&|^%]=?"))
+        .DefineToken("SPACE", toylang::regex::Compile("\\s+"));
+    if (jit) builder.EnableJit();
+    return builder.Build();
+  };
+  auto const plain = build(false);
+  auto const jitted = build(true);
+  EXPECT_FALSE(plain->Jitted());
+  EXPECT_EQ(jitted->Jitted(), toylang::Jit::Supported());
+
+  // 包含需要回退的 "1." 与无法匹配的区域
+  std::string const content =
+      "abc = 12.5 + x_1 * 3.\nfoo<=bar!=1. ## nfj 0.0.0 " + std::string(40, 'q');
+  for (size_t i = 0; i <= content.size(); i++) {
+    auto const text = std::string_view{content}.substr(i);
+    auto const expected = plain->Scan(0, text);
+    auto const actual = jitted->Scan(0, text);
+    EXPECT_EQ(actual.end, expected.end);
+    EXPECT_EQ(actual.accept, expected.accept);
+    EXPECT_EQ(actual.accept_end, expected.accept_end);
+  }
+
+  auto const lex = [&](std::shared_ptr<toylang::Lexicon const> lexicon) {
+    toylang::Scanner scanner;
+    scanner.SetLexicon(lexicon);
+    scanner.SetSource(toylang::Source::Create(content));
+    std::vector<std::tuple<int, size_t, size_t, size_t>> tokens;
+    for (auto token = scanner.NextToken(); token.id != toylang::Token::kEOF;
+         token = scanner.NextToken()) {
+      tokens.emplace_back(token.id, token.offset, token.length,
+                          token.lookahead);
+    }
+    return tokens;
+  };
+  EXPECT_EQ(lex(jitted), lex(plain));
+}
+
+TEST(LexiconTest, Interleaved) {
+  auto lexicon = toylang::Lexicon::Builder{}
+                     .DefineToken("ID", toylang::regex::Compile("\\l\\w*"))
+                     .DefineToken("NUMBER", toylang::regex::Compile("\\d+(\\.\\d+)?"))
+                     .DefineToken("SPACE", toylang::regex::Compile("\\s+"))
+                     .Build();
+
+  // 长度各不相同，包含需要回退的 "1." 与错误区域
+  std::vector<std::string> contents;
+  for (auto i = 0; i < 8; i++) {
+    std::string content;
+    for (auto j = 0; j <= i * 7; j++) {
+      content += "v" + std::to_string(j) + " " + std::to_string(i) +
+                 (j % 5 == 0 ? ". " : ".5\n") + (j % 11 == 0 ? "## " : "");
+    }
+    contents.push_back(content);
+  }
+  contents.push_back("");
+
+  std::vector<std::unique_ptr<toylang::Scanner>> owners;
+  std::vector<toylang::Scanner*> scanners;
+  std::vector<std::vector<toylang::Token>> expected;
+  for (auto const& content : contents) {
+    auto const source = toylang::Source::Create(content);
+    toylang::Scanner scanner;
+    scanner.SetLexicon(lexicon);
+    scanner.SetSource(source);
+    auto& tokens = expected.emplace_back();
+    for (auto token = scanner.NextToken(); token.id != toylang::Token::kEOF;
+         token = scanner.NextToken()) {
+      tokens.push_back(token);
+    }
+
+    auto& owner = owners.emplace_back(std::make_unique<toylang::Scanner>());
+    owner->SetLexicon(lexicon);
+    owner->SetSource(source);
+    scanners.push_back(owner.get());
+  }
+
+  auto const results = toylang::Scanner::ScanInterleaved(scanners);
+  ASSERT_EQ(results.size(), expected.size());
+  for (size_t i = 0; i < results.size(); i++) {
+    ASSERT_EQ(results[i].size(), expected[i].size());
+    for (size_t j = 0; j < results[i].size(); j++) {
+      auto const& a = results[i][j];
+      auto const& b = expected[i][j];
+      EXPECT_EQ(std::tie(a.id, a.offset, a.length, a.lookahead, a.start_line,
+                         a.start_column, a.end_line, a.end_column),
+                std::tie(b.id, b.offset, b.length, b.lookahead, b.start_line,
+                         b.start_column, b.end_line, b.end_column));
+    }
+    EXPECT_EQ(scanners[i]->NextToken().id, toylang::Token::kEOF);
+  }
+}
+
+TEST(LexiconTest, Vectorized) {
+  auto lexicon =
+      toylang::Lexicon::Builder{}
+          .DefineToken("ID", toylang::regex::Compile("\\l\\w*"))
+          .DefineToken("STRING", toylang::regex::Compile("\"[^\"]*\""))
+          .DefineToken("SPACE", toylang::regex::Compile("\\s+"))
+          .Build();
+  EXPECT_EQ(lexicon->Vectorized(), toylang::Shuffle::Supported());
+
+  // 长词法单元跨越多个块，未闭合的字符串需要回退
+  std::string const content = "abc " + std::string(50, 'x') + " \"" +
+                              std::string(40, 'y') + "\"   \"" +
+                              std::string(37, 'z') + " q_1" + std::string(20, ' ');
+  for (size_t i = 0; i <= content.size(); i++) {
+    auto const text = std::string_view{content}.substr(i);
+
+    toylang::Lexicon::Scanned expected{0, 0, 0};
+    auto state = lexicon->TransferOfState(0, 0).value();
+    while (expected.end < text.size()) {
+      auto const next = lexicon->TransferOfState(
+          state, static_cast<unsigned char>(text[expected.end]));
+      if (!next) break;
+      state = *next;
+      expected.end++;
+      if (auto const accept = lexicon->AcceptOfState(state)) {
+        expected.accept = *accept;
+        expected.accept_end = expected.end;
+      }
+    }
+
+    auto const actual = lexicon->Scan(0, text);
+    EXPECT_EQ(actual.end, expected.end) << i;
+    EXPECT_EQ(actual.accept, expected.accept) << i;
+    EXPECT_EQ(actual.accept_end, expected.accept_end) << i;
+  }
+}
+
+TEST(LexiconTest, StateLimit) {
+  // 倒数第九个字符为 a 的串，确定状态机需要数百个状态
+  std::string pattern = "(a|b)*a";
+  for (auto i = 0; i < 8; i++) pattern += "(a|b)";
+  auto const build = [&](size_t limit) {
+    return toylang::Lexicon::Builder{}
+        .DefineToken("TAIL", toylang::regex::Compile(pattern))
+        .DefineToken("WORD", toylang::regex::Compile("[ab]+"))
+        .DefineToken("SPACE", toylang::regex::Compile("\\s+"))
+        .LimitStates(limit)
+        .Build();
+  };
+  auto const dfa = build(toylang::Lexicon::kDefaultStateLimit);
+  auto const nfa = build(64);
+  EXPECT_FALSE(dfa->Simulated());
+  EXPECT_TRUE(nfa->Simulated());
+
+  std::string content;
+  uint32_t seed = 7;
+  for (auto i = 0; i < 400; i++) {
+    seed = seed * 1103515245 + 12345;
+    content += (seed >> 16) % 7 == 0 ? ' ' : (seed >> 16) % 2 ? 'a' : 'b';
+  }
+  content += " ab?ba";
+
+  auto const lex = [&](std::shared_ptr<toylang::Lexicon const> lexicon) {
+    toylang::Scanner scanner;
+    scanner.SetLexicon(lexicon);
+    scanner.SetSource(toylang::Source::Create(content));
+    std::vector<std::tuple<int, size_t, size_t, size_t>> tokens;
+    for (auto token = scanner.NextToken(); token.id != toylang::Token::kEOF;
+         token = scanner.NextToken()) {
+      tokens.emplace_back(token.id, token.offset, token.length,
+                          token.lookahead);
+    }
+    return tokens;
+  };
+  auto const expected = lex(dfa);
+  EXPECT_EQ(lex(nfa), expected);
+  EXPECT_EQ(std::get<0>(expected[expected.size() - 2]), toylang::Token::kError);
+}
+
+TEST(LexiconTest, SimulatedLinear) {
+  // 每个 a 都要向前扫描到末尾才能确定不是 B，没有失败记录时耗时与长度的平方成正比
+  auto const lexicon = toylang::Lexicon::Builder{}
+                           .DefineToken("A", toylang::regex::Compile("a"))
+                           .DefineToken("B", toylang::regex::Compile("a*b"))
+                           .LimitStates(1)
+                           .Build();
+  ASSERT_TRUE(lexicon->Simulated());
+
+  constexpr size_t kLength = 50000;
+  toylang::Scanner scanner;
+  scanner.SetLexicon(lexicon);
+  scanner.SetSource(toylang::Source::Create(std::string(kLength, 'a')));
+  auto const start = std::chrono::steady_clock::now();
+  size_t count = 0;
+  for (auto token = scanner.NextToken(); token.id != toylang::Token::kEOF;
+       token = scanner.NextToken()) {
+    EXPECT_EQ(token.NameOf(), "A");
+    // 在末尾追加 b 会改变全部词法单元
+    EXPECT_EQ(token.offset + token.length + token.lookahead, kLength + 1);
+    count++;
+  }
+  auto const elapsed = std::chrono::steady_clock::now() - start;
+  EXPECT_EQ(count, kLength);
+  EXPECT_LT(elapsed, std::chrono::seconds{1});
+}
+
+TEST(LexiconTest, Derivatives) {
+  // 以补集排除 */ 的块注释，与手写的排除模式接受同样的词法单元
+  auto const build = [](std::string const& block, bool derivatives) {
+    toylang::Lexicon::Builder builder;
+    builder
+        .DefineToken("COMMENT_BLOCK", toylang::regex::Compile(block))
+        .DefineToken("IDENT", toylang::regex::Compile("\\l+&~(if|else)"))
+        .DefineToken("KEYWORD", toylang::regex::Compile("\\l+"))
+        .DefineToken("OP", toylang::regex::Compile("[\\/\\*]"))
+        .DefineToken("SPACE", toylang::regex::Compile("\\s+"));
+    if (derivatives) builder.UseDerivatives();
+    return builder.Build();
+  };
+  auto const manual_block = "\\/\\*([^\\*]|\\*+[^\\*\\/])*\\*+\\/";
+  auto const complement_block = "\\/\\*~(.*\\*\\/.*)\\*\\/";
+  auto const manual = build(manual_block, true);
+  auto const complement = build(complement_block, false);
+  EXPECT_FALSE(complement->Simulated());
+
+  // 补集构造的状态机不大于 followpos 为手写模式构造的状态机
+  auto const count = [](std::string const& block, bool derivatives) {
+    toylang::Lexicon::Builder builder;
+    builder.DefineToken("COMMENT_BLOCK", toylang::regex::Compile(block));
+    if (derivatives) builder.UseDerivatives();
+    return builder.Build()->CountStates();
+  };
+  EXPECT_LE(count(complement_block, true), count(manual_block, false));
+  EXPECT_THROW(toylang::Lexicon::Builder{}
+                   .DefineToken("IDENT", toylang::regex::Compile("\\l+&~if"))
+                   .UseDerivatives()
+                   .LimitStates(2)
+                   .Build(),
+               std::runtime_error);
+
+  auto const content =
+      "/* a ** b */ if iffy else elsewhere /***/ /* x */ */ /* open";
+  auto const lex = [&](std::shared_ptr<toylang::Lexicon const> lexicon) {
+    toylang::Scanner scanner;
+    scanner.SetLexicon(lexicon);
+    scanner.SetSource(toylang::Source::Create(content));
+    std::vector<std::tuple<std::string, size_t, size_t>> tokens;
+    for (auto token = scanner.NextToken(); token.id != toylang::Token::kEOF;
+         token = scanner.NextToken()) {
+      if (token.id == lexicon->IdOfToken("SPACE")) continue;
+      tokens.emplace_back(lexicon->NameOfToken(token.id), token.offset,
+                          token.length);
+    }
+    return tokens;
+  };
+  std::vector<std::tuple<std::string, size_t, size_t>> const expected{
+      {"COMMENT_BLOCK", 0, 12}, {"KEYWORD", 13, 2}, {"IDENT", 16, 4},
+      {"KEYWORD", 21, 4},       {"IDENT", 26, 9},   {"COMMENT_BLOCK", 36, 5},
+      {"COMMENT_BLOCK", 42, 7}, {"OP", 50, 1},      {"OP", 51, 1},
+      {"OP", 53, 1},            {"OP", 54, 1},      {"IDENT", 56, 4},
+  };
+  EXPECT_EQ(lex(manual), expected);
+  EXPECT_EQ(lex(complement), expected);
+
+  // 补集运算符紧跟在括号之后
+  using toylang::regex::Node;
+  auto const concat = toylang::regex::Compile("(a)~(b)");
+  ASSERT_EQ(concat->type(), Node::kConcat);
+  EXPECT_EQ(static_cast<toylang::regex::ConcatNode&>(*concat).right_->type(),
+            Node::kComplement);
+  auto const intersect = toylang::regex::Compile("(x)&~(y)");
+  ASSERT_EQ(intersect->type(), Node::kIntersect);
+  EXPECT_EQ(
+      static_cast<toylang::regex::IntersectNode&>(*intersect).right_->type(),
+      Node::kComplement);
+  EXPECT_EQ(toylang::regex::Compile("((a)~(b))c")->type(), Node::kConcat);
+}
+
+TEST(LexiconTest, Restart) {
+  auto const lexicon =
+      toylang::Lexicon::Builder{}
+          .DefineToken("COMMENT", toylang::regex::Compile(
+                                      "\\/\\*([^\\*]|\\*+[^\\*\\/])*\\*+\\/"))
+          .DefineToken("STRING", toylang::regex::Compile(
+                                     "\"([^\"\\\\\\n]|\\\\.)*\""))
+          .DefineToken("NUMBER", toylang::regex::Compile("\\d+(\\.\\d+)?"))
+          .DefineToken("IDENT", toylang::regex::Compile("[a-zA-Z_]\\w*"))
+          .DefineToken("OP", toylang::regex::Compile("[-+*/=<>!]=?|[;(){}]"))
+          .DefineToken("SPACE", toylang::regex::Compile("\\s+"))
+          .EnableReverse()
+          .Build();
+  ASSERT_TRUE(lexicon->Reversible());
+
+  std::string content;
+  for (auto i = 0; i < 40; i++) {
+    content += "x" + std::to_string(i) + " = \"a /* b */ c\" + 3.25; ";
+    content += "/* y = \"z\"; 1.5 */\n";
+  }
+  content += "@@ tail";
+
+  auto const lex = [&](size_t begin) {
+    toylang::Scanner scanner;
+    scanner.SetLexicon(lexicon);
+    scanner.SetSource(toylang::Source::Create(content.substr(begin)));
+    std::vector<std::tuple<int, size_t, size_t>> tokens;
+    for (auto token = scanner.NextToken(); token.id != toylang::Token::kEOF;
+         token = scanner.NextToken()) {
+      tokens.emplace_back(token.id, begin + token.offset, token.length);
+    }
+    return tokens;
+  };
+  auto const expected = lex(0);
+
+  size_t farthest = 0;
+  for (size_t offset = 0; offset <= content.size(); offset += 7) {
+    auto const restart = lexicon->RestartOfContext(0, content, offset);
+    ASSERT_LE(restart, offset);
+    farthest = std::max(farthest, offset - restart);
+
+    // 从重启点开始分析得到的词法单元是完整分析结果的后缀
+    auto const tokens = lex(restart);
+    ASSERT_LE(tokens.size(), expected.size());
+    EXPECT_TRUE(std::equal(tokens.begin(), tokens.end(),
+                           expected.end() - tokens.size()))
+        << "restart " << restart << " for offset " << offset;
+  }
+  EXPECT_LT(farthest, 64U);
+
+  EXPECT_THROW(toylang::Lexicon::Builder{}
+                   .DefineToken("IDENT", toylang::regex::Compile("\\l+&~if"))
+                   .EnableReverse()
+                   .Build(),
+               std::runtime_error);
+}
+
+TEST(LexiconTest, Extension) {
+  auto const define_base = [](toylang::Lexicon::Builder& builder) {
+    builder.DefineToken("ID", toylang::regex::Compile("[a-zA-Z_]\\w*"))
+        .DefineToken("NUMBER", toylang::regex::Compile("\\d+"))
+        .DefineToken("OP", toylang::regex::Compile("[-+*/=<>]"))
+        .DefineToken("SPACE", toylang::regex::Compile("\\s+"))
+        .DefineKeywords("ID", {"if", "else"});
+  };
+  auto const define_plugin = [](toylang::Lexicon::Builder& builder) {
+    builder.DefineToken("ARROW", toylang::regex::Compile("=>|->"))
+        .DefineToken("HEX", toylang::regex::Compile("0x[0-9a-f]+"))
+        .DefineToken("TAG", toylang::regex::Compile("@\\l+"), {{"attr"}})
+        .DefineKeywords("ID", {"fn"});
+  };
+
+  toylang::Lexicon::Builder base_builder;
+  define_base(base_builder);
+  auto const base = base_builder.EnableExtension().Build();
+
+  toylang::Lexicon::Builder extension_builder{base};
+  define_plugin(extension_builder);
+  auto const extended = extension_builder.Build();
+
+  toylang::Lexicon::Builder full_builder;
+  define_base(full_builder);
+  define_plugin(full_builder);
+  auto const full = full_builder.Build();
+
+  auto const lex = [](std::shared_ptr<toylang::Lexicon const> lexicon,
+                      std::string const& content, std::string const& context) {
+    toylang::Scanner scanner;
+    scanner.SetLexicon(lexicon);
+    scanner.SetSource(toylang::Source::Create(content));
+    scanner.SetContext(context);
+    std::vector<std::tuple<std::string, size_t>> tokens;
+    for (auto token = scanner.NextToken(); token.id != toylang::Token::kEOF;
+         token = scanner.NextToken()) {
+      tokens.emplace_back(token.NameOf(), token.length);
+    }
+    return tokens;
+  };
+  std::string const content = "fn f x => if x -> 0x1f else 42 @tag";
+  EXPECT_EQ(lex(extended, content, "default"), lex(full, content, "default"));
+  EXPECT_EQ(lex(extended, content, "attr"), lex(full, content, "attr"));
+  EXPECT_EQ(std::get<0>(lex(extended, content, "default")[0]), "fn");
+  EXPECT_EQ(std::get<0>(lex(extended, content, "attr").back()), "TAG");
+
+  // 已有的状态被原样复用
+  ASSERT_GT(extended->CountStates(), base->CountStates());
+  for (size_t state = 1; state < base->CountStates(); state++) {
+    EXPECT_EQ(extended->AcceptOfState(state), base->AcceptOfState(state));
+    EXPECT_EQ(extended->TransferOfState(state, 'a'),
+              base->TransferOfState(state, 'a'));
+  }
+
+  // 被扩展的词法规则保持不变
+  auto const original = lex(base, content, "default");
+  EXPECT_EQ(std::get<0>(original[0]), "ID");
+  EXPECT_EQ(std::get<0>(original[6]), "OP");
+  EXPECT_EQ(base->CountTokens(), 6);
+
+  // 扩展后的词法规则可以继续扩展，未启用扩展的词法规则不能
+  toylang::Lexicon::Builder again{extended};
+  again.DefineToken("STRING", toylang::regex::Compile("\"[^\"]*\""));
+  auto const twice = again.Build();
+  EXPECT_EQ(std::get<0>(lex(twice, "x \"s\"", "default").back()), "STRING");
+  EXPECT_THROW(toylang::Lexicon::Builder{full}, std::runtime_error);
+}
+
+TEST(LexiconTest, ExtendRepeatedly) {
+  // 每次都扩展上一次的结果，并丢弃中间的词法规则
+  constexpr int kTimes = 200;
+  auto const base = toylang::Lexicon::Builder{}
+                        .DefineToken("ID", toylang::regex::Compile("[a-z]+"))
+                        .DefineToken("SPACE", toylang::regex::Compile("\\s+"))
+                        .EnableExtension()
+                        .Build();
+  auto lexicon = base;
+  for (int i = 0; i < kTimes; i++) {
+    toylang::Lexicon::Builder builder{lexicon};
+    builder.DefineToken("K" + std::to_string(i),
+                        toylang::regex::Compile("#" + std::to_string(i) + ";"));
+    auto const extended = builder.Build();
+    // 已有状态全部复用，每次扩展只新增首状态与所定义的字面量的状态
+    EXPECT_LE(extended->CountStates(),
+              lexicon->CountStates() + std::to_string(i).size() + 3);
+    lexicon = extended;
+  }
+  EXPECT_EQ(lexicon->CountTokens(), kTimes + 2);
+
+  toylang::Scanner scanner;
+  scanner.SetLexicon(lexicon);
+  scanner.SetSource(toylang::Source::Create("#0; x #123; #199;"));
+  std::vector<std::string> names;
+  for (auto token = scanner.NextToken(); token.id != toylang::Token::kEOF;
+       token = scanner.NextToken()) {
+    if (token.NameOf() != "SPACE") names.push_back(token.NameOf());
+  }
+  EXPECT_EQ(names, (std::vector<std::string>{"K0", "ID", "K123", "K199"}));
+  EXPECT_EQ(base->CountTokens(), 2);
+}
+
+TEST(LexiconTest, ManyTokens) {
+  // 词法记号数量远超调用栈能承受的递归深度
+  constexpr int kTokens = 20000;
+  toylang::Lexicon::Builder builder;
+  for (int i = 0; i < kTokens; i++) {
+    builder.DefineToken("T" + std::to_string(i),
+                        toylang::regex::Compile("k" + std::to_string(i) + ";"));
+  }
+  builder.DefineToken("SPACE", toylang::regex::Compile("\\s+"));
+  auto const lexicon = builder.Build();
+  EXPECT_EQ(lexicon->CountTokens(), kTokens + 1);
+
+  toylang::Scanner scanner;
+  scanner.SetLexicon(lexicon);
+  scanner.SetSource(toylang::Source::Create("k0; k12345; k19999;"));
+  std::vector<std::string> names;
+  for (auto token = scanner.NextToken(); token.id != toylang::Token::kEOF;
+       token = scanner.NextToken()) {
+    if (token.NameOf() != "SPACE") names.push_back(token.NameOf());
+  }
+  EXPECT_EQ(names, (std::vector<std::string>{"T0", "T12345", "T19999"}));
+}
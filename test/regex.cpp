@@ -0,0 +1,136 @@
+#include "toylang/regex.h"
+
+#include "toylang/lexical.h"
+
+#include "gtest/gtest.h"
+
+TEST(RegexTest, Simplify) {
+  using toylang::regex::Node;
+
+  // 单字符候选项合并为一个字符类
+  auto chars = toylang::regex::Simplify(toylang::regex::Compile("a|b|\\d|c"));
+  ASSERT_EQ(chars->type(), Node::kRange);
+  auto const& range = static_cast<toylang::regex::RangeNode&>(*chars);
+  EXPECT_TRUE(range.Match('a'));
+  EXPECT_TRUE(range.Match('c'));
+  EXPECT_TRUE(range.Match('7'));
+  EXPECT_FALSE(range.Match('d'));
+
+  // 字符类与反向字符类合并
+  auto negative = toylang::regex::Simplify(toylang::regex::Compile("[^ab]|a"));
+  ASSERT_EQ(negative->type(), Node::kRange);
+  EXPECT_TRUE(static_cast<toylang::regex::RangeNode&>(*negative).Match('a'));
+  EXPECT_FALSE(static_cast<toylang::regex::RangeNode&>(*negative).Match('b'));
+
+  // 嵌套闭包
+  auto kleene = toylang::regex::Simplify(toylang::regex::Compile("((a+)?)*"));
+  ASSERT_EQ(kleene->type(), Node::kKleene);
+  EXPECT_EQ(static_cast<toylang::regex::KleeneNode&>(*kleene).child_->type(),
+            Node::kChar);
+
+  auto positive = toylang::regex::Simplify(toylang::regex::Compile("(a+)+"));
+  ASSERT_EQ(positive->type(), Node::kPositive);
+
+  // 去除重复的候选项，保留其余候选项
+  auto dedup = toylang::regex::Simplify(toylang::regex::Compile("ab|cd|ab"));
+  ASSERT_EQ(dedup->type(), Node::kUnion);
+  auto const& alt = static_cast<toylang::regex::UnionNode&>(*dedup);
+  EXPECT_EQ(alt.left_->type(), Node::kConcat);
+  EXPECT_EQ(alt.right_->type(), Node::kConcat);
+
+  // 已经是最简形式的正则表达式保持不变
+  auto simple = toylang::regex::Compile("a(bc+|de?)f*g");
+  EXPECT_EQ(toylang::regex::Simplify(simple), simple);
+}
+
+TEST(RegexTest, SimplifyDeep) {
+  using toylang::regex::Node;
+
+  // 不同种节点交替嵌套时无法展平，层数远超调用栈能承受的递归深度
+  constexpr int kDepth = 100000;
+  auto const b = toylang::regex::Compile("b");
+  auto nested = toylang::regex::Compile("a");
+  auto closures = toylang::regex::Compile("a");
+  for (int i = 0; i < kDepth; i++) {
+    auto const concat = std::make_shared<toylang::regex::ConcatNode>();
+    concat->left_ = nested;
+    concat->right_ = b;
+    auto const kleene = std::make_shared<toylang::regex::KleeneNode>();
+    kleene->child_ = concat;
+    nested = kleene;
+
+    auto const optional = std::make_shared<toylang::regex::OptionalNode>();
+    optional->child_ = closures;
+    auto const positive = std::make_shared<toylang::regex::PositiveNode>();
+    positive->child_ = optional;
+    closures = positive;
+  }
+  EXPECT_EQ(toylang::regex::Simplify(nested), nested);
+
+  auto const kleene = toylang::regex::Simplify(closures);
+  ASSERT_EQ(kleene->type(), Node::kKleene);
+  EXPECT_EQ(static_cast<toylang::regex::KleeneNode&>(*kleene).child_->type(),
+            Node::kChar);
+}
+
+TEST(RegexTest, Charset) {
+  using toylang::regex::Charset;
+
+  auto const digit = Charset::Range('0', '9');
+  auto const hex = digit | Charset::Range('a', 'f');
+  EXPECT_EQ(digit.Count(), 10UL);
+  EXPECT_EQ(hex.Count(), 16UL);
+  EXPECT_EQ((hex & digit), digit);
+  EXPECT_EQ((hex - digit).Min(), static_cast<unsigned>('a'));
+  EXPECT_EQ((~hex).Count(), 240UL);
+  EXPECT_TRUE((digit - hex).Empty());
+
+  std::string chars;
+  (hex - digit).ForEach([&](unsigned char ch) { chars += ch; });
+  EXPECT_EQ(chars, "abcdef");
+
+  // 等价类互不相交且覆盖全部字符
+  auto const blocks = toylang::regex::Partition({digit, hex});
+  ASSERT_EQ(blocks.size(), 3UL);
+  Charset all;
+  for (auto const& block : blocks) {
+    EXPECT_TRUE((all & block).Empty());
+    all |= block;
+  }
+  EXPECT_EQ(all, Charset::All());
+}
+
+TEST(RegexTest, Unicode) {
+  auto lexicon =
+      toylang::Lexicon::Builder{}
+          .DefineToken("ID", toylang::regex::Compile(
+                                 "[\\l\\u_\\u{4e00}-\\u{9fff}][\\w\\u{4e00}-"
+                                 "\\u{9fff}]*"))
+          .DefineToken("EMOJI", toylang::regex::Compile("\\u{1F600}+"))
+          .DefineToken("OTHER", toylang::regex::Compile("[^\\s\\w\\u{1F600}]"))
+          .DefineToken("SPACE", toylang::regex::Compile("\\s+"))
+          .Build();
+
+  auto const lex = [&](std::string const& content) {
+    toylang::Scanner scanner;
+    scanner.SetLexicon(lexicon);
+    scanner.SetSource(toylang::Source::Create(content));
+    std::vector<std::string> tokens;
+    for (auto token = scanner.NextToken(); token.id != toylang::Token::kEOF;
+         token = scanner.NextToken()) {
+      tokens.push_back(token.NameOf() + ":" + token.TextOf());
+    }
+    return tokens;
+  };
+
+  EXPECT_EQ(lex("变量a1 😀😀 é\xed\xa0\x80"),
+            (std::vector<std::string>{"ID:变量a1", "SPACE: ", "EMOJI:😀😀",
+                                      "SPACE: ", "OTHER:é", "<ERR>:\xed\xa0\x80"}));
+
+  // 多字节字符作为整体参与后缀运算
+  auto const word = toylang::regex::Compile("é+");
+  EXPECT_EQ(word->type(), toylang::regex::Node::kPositive);
+
+  EXPECT_THROW(toylang::regex::Compile("\\u{110000}"), std::runtime_error);
+  EXPECT_THROW(toylang::regex::Compile("[\\u{d800}]"), std::runtime_error);
+}
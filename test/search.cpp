@@ -0,0 +1,104 @@
+#include "toylang/search.h"
+
+#include <chrono>
+
+#include "gtest/gtest.h"
+
+TEST(SearchTest, Required) {
+  auto const required = [](std::string const& expr) {
+    return toylang::regex::Prefilter::RequiredOf(
+        toylang::regex::Simplify(toylang::regex::Compile(expr)));
+  };
+  EXPECT_EQ(required("error: \\d+"), "error: ");
+  EXPECT_EQ(required("\\w+@example\\.com"), "@example.com");
+  EXPECT_EQ(required("(GET|POST) \\/api"), "T /api");
+  EXPECT_EQ(required("timeout (after|before) retry"), "timeout ");
+  EXPECT_EQ(required("(ab)+c"), "abc");
+  EXPECT_EQ(required("x*"), "");
+}
+
+TEST(SearchTest, Set) {
+  auto const set = toylang::regex::Set::Compile({
+      toylang::regex::Compile("error"),
+      toylang::regex::Compile("disk \\d+%"),
+      toylang::regex::Compile("(GET|POST) \\/api\\/\\w+"),
+      toylang::regex::Compile("user=\\w+"),
+  });
+  ASSERT_NE(set->GetPrefilter(), nullptr);
+  EXPECT_EQ(set->CountPatterns(), 4U);
+
+  EXPECT_EQ(set->Match("info: all good"), std::vector<int>{});
+  EXPECT_EQ(set->Match("error: disk 93% full"), (std::vector<int>{0, 1}));
+  EXPECT_EQ(set->Match("POST /api/login user=alice"),
+            (std::vector<int>{2, 3}));
+  EXPECT_EQ(set->Match("GET /api/ user="), std::vector<int>{});
+  EXPECT_EQ(set->Match("user=bob error GET /api/x disk 5%"),
+            (std::vector<int>{0, 1, 2, 3}));
+
+  // 可以匹配空串的模式使预过滤器失效，并匹配任何文本
+  auto const nullable = toylang::regex::Set::Compile({
+      toylang::regex::Compile("error"),
+      toylang::regex::Compile("x*"),
+  });
+  EXPECT_EQ(nullable->GetPrefilter(), nullptr);
+  EXPECT_EQ(nullable->Match("ok"), std::vector<int>{1});
+  EXPECT_EQ(nullable->Match("an error"), (std::vector<int>{0, 1}));
+}
+
+TEST(SearchTest, Matcher) {
+  using Found = toylang::regex::Matcher::Found;
+  auto const number = toylang::regex::Matcher::Compile(
+      toylang::regex::Compile("\\d+(\\.\\d+)?"));
+  EXPECT_TRUE(number->Match("3.25"));
+  EXPECT_FALSE(number->Match("3."));
+  EXPECT_FALSE(number->Match("x3"));
+  EXPECT_EQ(number->Search("pi is 3.14, e is 2.7"), (Found{6, 4}));
+  EXPECT_EQ(number->Search("pi is 3.14, e is 2.7", 10), (Found{17, 3}));
+  EXPECT_EQ(number->Search("no digits"), std::nullopt);
+  EXPECT_EQ(number->FindAll("1 22 3.x 4.5"),
+            (std::vector<Found>{{0, 1}, {2, 2}, {5, 1}, {9, 3}}));
+
+  // 以文字前缀定位候选位置，必然包含的文字串决定何时停止
+  auto const call = toylang::regex::Matcher::Compile(
+      toylang::regex::Compile("log\\.(info|warn)\\(\\w*\\)"));
+  EXPECT_EQ(call->Prefix(), "log.");
+  EXPECT_EQ(call->FindAll("log.debug(x) log.info(msg); log.warn()"),
+            (std::vector<Found>{{13, 13}, {28, 10}}));
+  auto const tagged = toylang::regex::Matcher::Compile(
+      toylang::regex::Compile("\\w+@example\\.com"));
+  EXPECT_EQ(tagged->Prefix(), "");
+  EXPECT_EQ(tagged->Required(), "@example.com");
+  EXPECT_EQ(tagged->Search("mail bob@example.com now"), (Found{5, 15}));
+  EXPECT_EQ(tagged->Search("mail bob@example.org now"), std::nullopt);
+
+  // 空匹配之后从下一个字节继续
+  auto const spaces = toylang::regex::Matcher::Compile(
+      toylang::regex::Compile(" *"));
+  EXPECT_EQ(spaces->FindAll("a  b"),
+            (std::vector<Found>{{0, 0}, {1, 2}, {3, 0}, {4, 0}}));
+}
+
+TEST(SearchTest, MatcherLinear) {
+  using Found = toylang::regex::Matcher::Found;
+
+  // 起点不同的候选匹配共享同一遍扫描，从每个候选起点重新运行状态机时是平方的
+  constexpr size_t kPairs = 100000;
+  auto const matcher =
+      toylang::regex::Matcher::Compile(toylang::regex::Compile("[ab]*c"));
+  std::string text;
+  for (size_t i = 0; i < kPairs; i++) text += "ab";
+  text += "dc";
+  auto const begin = std::chrono::steady_clock::now();
+  EXPECT_EQ(matcher->Search(text), (Found{kPairs * 2 + 1, 1}));
+  EXPECT_EQ(matcher->FindAll(text), (std::vector<Found>{{kPairs * 2 + 1, 1}}));
+  EXPECT_LT(std::chrono::steady_clock::now() - begin, std::chrono::seconds{1});
+
+  // 最左的起点优先于更早结束的匹配，同一起点取最长的匹配
+  auto const nested = toylang::regex::Matcher::Compile(
+      toylang::regex::Compile("abcd|c|bcx*"));
+  EXPECT_EQ(nested->Search("xabcd"), (Found{1, 4}));
+  EXPECT_EQ(nested->Search("xabce"), (Found{2, 2}));
+  EXPECT_EQ(nested->Search("xabcxxd"), (Found{2, 4}));
+  EXPECT_EQ(nested->FindAll("abcdcbcx"),
+            (std::vector<Found>{{0, 4}, {4, 1}, {5, 3}}));
+}
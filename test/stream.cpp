@@ -0,0 +1,62 @@
+#include "toylang/stream.h"
+
+#include "gtest/gtest.h"
+
+TEST(TokenStreamTest, PeekAndRewind) {
+  auto lexicon = toylang::Lexicon::Builder{}
+                     .DefineToken("ID", toylang::regex::Compile("\\l+"))
+                     .DefineToken("SPACE", toylang::regex::Compile("\\s+"))
+                     .Build();
+  auto const id = lexicon->IdOfToken("ID");
+  auto const space = lexicon->IdOfToken("SPACE");
+
+  for (auto const pipelined : {false, true}) {
+    toylang::Scanner scanner;
+    scanner.SetLexicon(lexicon);
+    scanner.SetSource(toylang::Source::Create("a bb ccc"));
+    toylang::TokenStream stream{scanner, 4, pipelined};
+
+    EXPECT_EQ(stream.Peek(2).TextOf(), "bb");
+    EXPECT_EQ(stream.Peek(0).id, id);
+
+    auto const mark = stream.Mark();
+    EXPECT_EQ(stream.Advance().TextOf(), "a");
+    EXPECT_EQ(stream.Advance().id, space);
+    EXPECT_EQ(stream.Advance().TextOf(), "bb");
+
+    // 标记之后的词法单元仍在缓冲区中，超出容量时抛出异常
+    EXPECT_THROW(stream.Peek(1), std::runtime_error);
+    stream.Rewind(mark);
+    EXPECT_EQ(stream.Advance().TextOf(), "a");
+    stream.Release(mark);
+
+    stream.Advance();
+    stream.Advance();
+    EXPECT_EQ(stream.Peek(2).id, toylang::Token::kEOF);
+    EXPECT_EQ(stream.Peek(3).id, toylang::Token::kEOF);
+    EXPECT_EQ(stream.Advance().id, space);
+    EXPECT_EQ(stream.Advance().TextOf(), "ccc");
+    EXPECT_EQ(stream.Advance().id, toylang::Token::kEOF);
+    EXPECT_EQ(stream.Position(), 6);
+  }
+}
+
+TEST(TokenStreamTest, Pipelined) {
+  auto lexicon = toylang::Lexicon::Builder{}
+                     .DefineToken("NUMBER", toylang::regex::Compile("\\d+"))
+                     .DefineToken("SPACE", toylang::regex::Compile("\\s+"))
+                     .Build();
+
+  std::string content;
+  for (auto i = 0; i < 1000; i++) content += std::to_string(i) + " ";
+
+  toylang::Scanner scanner;
+  scanner.SetLexicon(lexicon);
+  scanner.SetSource(toylang::Source::Create(content));
+  toylang::TokenStream stream{scanner, 16, true};
+  for (auto i = 0; i < 1000; i++) {
+    ASSERT_EQ(stream.Advance().TextOf(), std::to_string(i));
+    ASSERT_EQ(stream.Advance().id, lexicon->IdOfToken("SPACE"));
+  }
+  EXPECT_EQ(stream.Advance().id, toylang::Token::kEOF);
+}
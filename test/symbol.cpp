@@ -0,0 +1,64 @@
+#include "toylang/symbol.h"
+
+#include <thread>
+
+#include "gtest/gtest.h"
+#include "toylang/lexical.h"
+
+TEST(SymbolPoolTest, Intern) {
+  toylang::SymbolPool pool;
+  auto const abc = pool.Intern("abc");
+  EXPECT_NE(abc, toylang::SymbolPool::kNone);
+  EXPECT_EQ(pool.Intern(std::string{"abc"}), abc);
+  EXPECT_NE(pool.Intern("abd"), abc);
+  EXPECT_EQ(pool.TextOf(abc), "abc");
+
+  std::string const large(100000, 'x');
+  auto const symbol = pool.Intern(large);
+  EXPECT_EQ(pool.TextOf(symbol), large);
+  EXPECT_EQ(pool.TextOf(abc), "abc");
+  EXPECT_EQ(pool.CountSymbols(), 3);
+}
+
+TEST(SymbolPoolTest, SharedScanners) {
+  auto lexicon = toylang::Lexicon::Builder{}
+                     .DefineToken("ID", toylang::regex::Compile("\\l\\w*"))
+                     .DefineToken("SPACE", toylang::regex::Compile("\\s+"))
+                     .Build();
+  auto const id = lexicon->IdOfToken("ID");
+
+  std::string content;
+  for (auto i = 0; i < 2000; i++) content += "v" + std::to_string(i % 500) + " ";
+  auto const source = toylang::Source::Create(content);
+
+  // 多个词法分析器并发驻留到同一个符号池
+  auto pool = std::make_shared<toylang::SymbolPool>();
+  std::vector<std::vector<toylang::Token>> results(4);
+  std::vector<std::thread> threads;
+  for (auto& tokens : results) {
+    threads.emplace_back([&] {
+      toylang::Scanner scanner;
+      scanner.SetLexicon(lexicon);
+      scanner.SetSource(source);
+      scanner.SetSymbolPool(pool, {id});
+      for (auto token = scanner.NextToken(); token.id != toylang::Token::kEOF;
+           token = scanner.NextToken()) {
+        tokens.push_back(token);
+      }
+    });
+  }
+  for (auto& thread : threads) thread.join();
+
+  EXPECT_EQ(pool->CountSymbols(), 500);
+  for (auto const& tokens : results) {
+    ASSERT_EQ(tokens.size(), results.front().size());
+    for (size_t i = 0; i < tokens.size(); i++) {
+      EXPECT_EQ(tokens[i].symbol, results.front()[i].symbol);
+      if (tokens[i].id == id) {
+        EXPECT_EQ(pool->TextOf(tokens[i].symbol), tokens[i].TextOf());
+      } else {
+        EXPECT_EQ(tokens[i].symbol, toylang::SymbolPool::kNone);
+      }
+    }
+  }
+}